@@ -1,748 +1,4040 @@
 #include "archive.h"
 #include "diretorio.h"
+#include "io.h"
+#include "lz.h"
+#include "fila.h"
+#include "varredura.h"
+#include "arena.h"
+#include "metricas.h"
+#include "soma.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
-#include <libgen.h> // Para basename
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
 
 
-// Função para extrair o nome base do arquivo
-const char *get_basename(const char *path) {
-    const char *base = strrchr(path, '/');
-    if (base) {
-        return base + 1;  // Pula o caractere '/'
+// Opções globais (preenchidas pelo main)
+struct Opcoes opcoes = { .embutir = LIMITE_EMBUTIDO_PADRAO };
+
+// Cada uso que cresce com a carga (buffers de compressão, fila de escrita,
+// leitura antecipada, lote de inserção...) pode ocupar esta fração do
+// orçamento de --limite-memoria; o resto fica para o diretório e o programa
+#define FRACAO_ORCAMENTO 8
+
+// Menor bloco de compressão usado sob um orçamento
+#define TAM_BLOCO_MIN (64 * 1024)
+
+// Quanto de um membro grande é escrito na extração antes de suas páginas
+// serem descartadas
+#define JANELA_EXTRACAO (8 * 1024 * 1024)
+
+// Memória disponível para um uso que cresce com a carga
+// RETORNO: bytes da parcela (UINT64_MAX se não há orçamento)
+static uint64_t parcela_memoria(void) {
+    return opcoes.limite_memoria ? opcoes.limite_memoria / FRACAO_ORCAMENTO : UINT64_MAX;
+}
+
+// Limita 'tam' à parcela do orçamento, sem passar de 'minimo'
+// RETORNO: o menor entre 'tam' e a parcela, ou 'minimo'
+static uint64_t limita_parcela(uint64_t tam, uint64_t minimo) {
+    uint64_t parcela = parcela_memoria();
+    if (tam > parcela)
+        tam = parcela;
+    return tam < minimo ? minimo : tam;
+}
+
+// Escolhe o tamanho dos blocos de compressão e dos segmentos sólidos: o
+// maior, até TAM_BLOCO, cujos buffers (pedaço da entrada, saída comprimida e
+// tabela do LZ) cabem na parcela do orçamento. Blocos menores continuam
+// legíveis por qualquer versão.
+// RETORNO: tamanho do bloco em bytes
+static size_t tam_bloco_orcado(void) {
+    size_t bloco = TAM_BLOCO;
+    while (bloco > TAM_BLOCO_MIN &&
+           2 * bloco + bloco / 256 + 1 + (bloco + 65536) * sizeof(unsigned int) > parcela_memoria())
+        bloco /= 2;
+    return bloco;
+}
+
+// Bytes dos buffers de gravação de um delta em blocos de 'bloco' bytes:
+// janela (história e pedaço), saída comprimida e tabela do LZ
+static uint64_t custo_grava_delta(size_t bloco) {
+    return 2 * bloco + bloco + bloco / 256 + 1 +
+           (uint64_t)LZ_DELTA_WORKSIZE(bloco, bloco) * sizeof(unsigned int);
+}
+
+// Escolhe o bloco dos deltas gravados: o maior, até TAM_BLOCO, cujos buffers
+// de gravação cabem na parcela do orçamento
+// RETORNO: tamanho do bloco em bytes
+static size_t tam_bloco_delta_orcado(void) {
+    size_t bloco = TAM_BLOCO;
+    while (bloco > TAM_BLOCO_MIN && custo_grava_delta(bloco) > parcela_memoria())
+        bloco /= 2;
+    return bloco;
+}
+
+// Converte um caminho no nome guardado no archive: relativo, sem '/' no início,
+// sem componentes "." e sem barras repetidas ("./a//b" vira "a/b")
+// RETORNO: 0 em caso de sucesso, 1 se o caminho é vazio, longo demais ou tem ".."
+static int normaliza_nome(const char *caminho, char *nome, size_t tam) {
+    size_t n = 0;
+    const char *p = caminho;
+
+    while (*p) {
+        // Isola o próximo componente
+        while (*p == '/')
+            p++;
+        size_t comp = strcspn(p, "/");
+
+        if (comp == 0 || (comp == 1 && p[0] == '.')) {
+            p += comp;
+            continue;
+        }
+        if (comp == 2 && p[0] == '.' && p[1] == '.')
+            return 1;
+
+        // Junta ao nome, separado por '/'
+        if (n + (n > 0) + comp >= tam)
+            return 1;
+        if (n > 0)
+            nome[n++] = '/';
+        memcpy(nome + n, p, comp);
+        n += comp;
+        p += comp;
+    }
+
+    nome[n] = '\0';
+    return n == 0;
+}
+
+// Cria os diretórios que contêm 'nome' (como mkdir -p do diretório pai).
+// 'ultimo' guarda o último diretório criado, para evitar repetir chamadas
+// quando membros seguidos estão no mesmo diretório.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int cria_diretorios_pai(const char *nome, char *ultimo, size_t tam_ultimo) {
+    const char *barra = strrchr(nome, '/');
+    if (!barra)
+        return 0;
+
+    size_t tam = barra - nome;
+    if (tam >= tam_ultimo)
+        return 1;
+    if (strncmp(ultimo, nome, tam) == 0 && ultimo[tam] == '\0')
+        return 0;
+
+    char caminho[1024];
+    memcpy(caminho, nome, tam);
+    caminho[tam] = '\0';
+
+    // Cria cada nível; os que já existem são ignorados
+    for (size_t i = 1; i <= tam; i++) {
+        if (caminho[i] != '/' && caminho[i] != '\0')
+            continue;
+
+        char c = caminho[i];
+        caminho[i] = '\0';
+        if (mkdir(caminho, 0777) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Erro ao criar diretório: %s\n", caminho);
+            return 1;
+        }
+        caminho[i] = c;
+    }
+
+    memcpy(ultimo, caminho, tam + 1);
+    return 0;
+}
+
+
+// Tamanho máximo de um bloco depois de comprimido (pior caso do LZ: 257/256 + 1)
+#define TAM_BLOCO_COMPRIMIDO (TAM_BLOCO + TAM_BLOCO / 256 + 1)
+
+// RETORNO: 1 se os 'tam' bytes de 'dados' são todos zero, 0 caso contrário
+static int so_zeros(const unsigned char *dados, size_t tam) {
+    return tam > 0 && dados[0] == 0 && memcmp(dados, dados + 1, tam - 1) == 0;
+}
+
+// Diz se o pedaço 'bloco' recém-lido de 'entrada' vira um bloco de zeros (ver
+// struct Bloco): buracos do arquivo nem são lidos; os demais pedaços só se
+// forem todos zero
+// RETORNO: 1 se o pedaço é só de zeros, 0 caso contrário
+static int pedaco_de_zeros(struct Entrada *entrada, const unsigned char *bloco, size_t lidos) {
+    return entrada_buraco(entrada, entrada->pos - lidos, lidos) || so_zeros(bloco, lidos);
+}
+
+// Grava o conteúdo de 'entrada' no archive a partir da posição atual de 'temp',
+// bloco a bloco. Os blocos vêm direto do mapa da entrada (ou de um buffer fixo,
+// para pipes), com o tamanho de pedaço da entrada (no máximo TAM_BLOCO). Cada
+// bloco é comprimido com LZ_CompressFast; blocos que não diminuem são
+// guardados sem compressão e pedaços só de zeros viram blocos de zeros. O
+// conteúdo também é somado em 'soma'. Os buffers vêm da arena e voltam para
+// ela.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int comprime_fluxo(struct Arena *arena, struct Entrada *entrada, FILE *temp,
+                          uint64_t *tam_orig, uint64_t *tam_disco, struct Soma *soma) {
+    size_t bloco_max = entrada->tam_buffer;
+    unsigned char *comprimido = arena_obtem(arena, bloco_max + bloco_max / 256 + 1);
+    unsigned int *trabalho = arena_obtem(arena, (bloco_max + 65536) * sizeof(unsigned int));
+
+    if (!comprimido || !trabalho) {
+        fprintf(stderr, "Erro ao alocar buffers de compressão\n");
+        arena_devolve(arena, comprimido);
+        arena_devolve(arena, trabalho);
+        return 1;
+    }
+
+    *tam_orig = 0;
+    *tam_disco = 0;
+    int erro = 0;
+
+    const unsigned char *bloco;
+    size_t lidos;
+    uint64_t relogio = metricas_relogio();
+    while ((lidos = entrada_le(entrada, &bloco)) > 0) {
+        metricas_fase(FASE_LEITURA, relogio);
+
+        // Comprime o bloco; se não diminuir, guarda o original
+        struct Bloco cab;
+        const unsigned char *dados = bloco;
+        cab.tam_orig = lidos;
+        cab.tam_disco = lidos;
+
+        relogio = metricas_relogio();
+        if (pedaco_de_zeros(entrada, bloco, lidos)) {
+            soma_zeros(soma, lidos);
+            cab.tam_disco = 0;
+        } else {
+            soma_acrescenta(soma, bloco, lidos);
+            unsigned int tam_comp = LZ_CompressFast((unsigned char *)bloco, comprimido, lidos, trabalho);
+            if (tam_comp < lidos) {
+                dados = comprimido;
+                cab.tam_disco = tam_comp;
+            }
+        }
+        metricas_fase(FASE_COMPRESSAO, relogio);
+
+        relogio = metricas_relogio();
+        if (fwrite(&cab, sizeof(struct Bloco), 1, temp) != 1 ||
+            fwrite(dados, 1, cab.tam_disco, temp) != cab.tam_disco) {
+            fprintf(stderr, "Erro ao escrever bloco comprimido\n");
+            erro = 1;
+            break;
+        }
+        metricas_fase(FASE_ESCRITA, relogio);
+        relogio = metricas_relogio();
+
+        *tam_orig += lidos;
+        *tam_disco += sizeof(struct Bloco) + cab.tam_disco;
+    }
+
+    if (entrada->erro)
+        erro = 1;
+
+    arena_devolve(arena, comprimido);
+    arena_devolve(arena, trabalho);
+    return erro;
+}
+
+// Onde procurar as versões base dos membros delta: o diretório na memória
+// ou o índice de um archive mapeado (um dos dois). Os dados das versões são
+// lidos de 'fd' com pread.
+struct Versoes {
+    int fd;
+    const struct Diretorio *dir;
+    const struct Indice *ind;
+};
+
+// Só membros guardados em blocos (ou sem compressão) servem de base
+// RETORNO: 1 se o tipo de membro pode ser base de um delta, 0 caso contrário
+static int pode_ser_base(int comprimido) {
+    return comprimido == 0 || comprimido == 1 || comprimido == MEMBRO_DELTA;
+}
+
+// Procura a versão de conteúdo 'soma', preferindo uma que não seja delta (a
+// cadeia fica mais curta). O membro de dados em 'exceto' é ignorado. Lida do
+// índice, a base tem o nome decodificado em 'nome' (TAM_NOME bytes).
+// RETORNO: 0 se encontrou (em *base), 1 caso contrário
+static int busca_base(const struct Versoes *vs, uint64_t soma, int64_t exceto, struct Membro *base,
+                      char *nome) {
+    int achou = 0;
+    int quantidade = vs->dir ? vs->dir->quantidade : vs->ind->quantidade;
+    for (int i = 0; i < quantidade; i++) {
+        int comprimido = vs->dir ? vs->dir->membros[i].comprimido : vs->ind->registros[i].comprimido;
+        uint64_t soma_i = vs->dir ? vs->dir->membros[i].soma : vs->ind->registros[i].soma;
+        int64_t offset = vs->dir ? vs->dir->membros[i].offset : vs->ind->registros[i].offset;
+        if (soma_i != soma || offset == exceto || !pode_ser_base(comprimido) ||
+            (achou && comprimido == MEMBRO_DELTA))
+            continue;
+
+        if (vs->dir)
+            *base = vs->dir->membros[i];
+        else if (indice_membro(vs->ind, i, base, nome) != 0)
+            continue;
+        achou = 1;
+        if (comprimido != MEMBRO_DELTA)
+            break;
+    }
+    return !achou;
+}
+
+// Bytes originais de cada bloco de um delta (ver MEMBRO_DELTA)
+static size_t bloco_delta(const struct Membro *m) {
+    return m->pos_segmento ? m->pos_segmento : TAM_BLOCO;
+}
+
+// Memória aproximada do leitor de um nível da cadeia: janela (com a
+// história, se delta) e bloco do disco. Os blocos de um membro que não é
+// delta não têm tamanho guardado; conta-se o dos blocos gravados agora.
+static uint64_t custo_leitor(const struct Membro *m) {
+    size_t bloco = m->comprimido == MEMBRO_DELTA ? bloco_delta(m) : tam_bloco_orcado();
+    return (m->comprimido == MEMBRO_DELTA ? 3 : 2) * (uint64_t)bloco;
+}
+
+// Conta os deltas da cadeia que termina em 'm' e soma em *custo a memória
+// dos leitores para lê-la (pode ser NULL)
+// RETORNO: comprimento da cadeia (0 se 'm' não é delta) ou -1 se uma base
+// não foi encontrada
+static int comprimento_cadeia(const struct Versoes *vs, const struct Membro *m, uint64_t *custo) {
+    struct Membro atual = *m;
+    char nome[TAM_NOME];
+    int comprimento = 0;
+    uint64_t total = custo_leitor(&atual);
+    while (atual.comprimido == MEMBRO_DELTA) {
+        if (++comprimento > LIMITE_CADEIA_MAX ||
+            busca_base(vs, atual.soma_base, atual.offset, &atual, nome) != 0)
+            return -1;
+        total += custo_leitor(&atual);
+    }
+    if (custo)
+        *custo = total;
+    return comprimento;
+}
+
+// Leitor sequencial do conteúdo de um membro guardado em blocos, sem
+// compressão ou em delta. O leitor de um delta lê junto o da sua base,
+// bloco_delta bytes de história para cada bloco do delta. Os buffers crescem
+// até o tamanho dos blocos que o membro de fato tem.
+struct Leitor {
+    const struct Versoes *vs;
+    struct Membro m;
+    char nome[TAM_NOME];        // Cópia do nome de 'm' (m.nome aponta para ela)
+    uint64_t pos;               // Bytes dos dados do membro já lidos do archive
+    unsigned char *janela;      // História (só delta) seguida do bloco decodificado
+    size_t tam_janela;
+    unsigned char *disco;       // Bloco como está no archive
+    size_t tam_disco;
+    const unsigned char *dados; // Parte decodificada ainda não entregue
+    size_t restantes;
+    struct Leitor *base;        // Leitor da versão base (só delta)
+    int erro;                   // 1 se alguma leitura falhou
+};
+
+static size_t leitor_preenche(struct Leitor *l, unsigned char *destino, size_t tam);
+
+static void leitor_fecha(struct Leitor *l) {
+    if (!l)
+        return;
+    leitor_fecha(l->base);
+    free(l->janela);
+    free(l->disco);
+    free(l);
+}
+
+// Abre o leitor de 'm' e, se for delta, os das bases ('profundidade' é a
+// posição na cadeia)
+// RETORNO: leitor ou NULL em caso de erro
+static struct Leitor *leitor_abre(const struct Versoes *vs, const struct Membro *m, int profundidade) {
+    if (!pode_ser_base(m->comprimido))
+        return NULL;
+    if (profundidade > LIMITE_CADEIA_MAX) {
+        fprintf(stderr, "Erro: cadeia de versões longa demais no membro %s\n", m->nome);
+        return NULL;
+    }
+
+    struct Leitor *l = calloc(1, sizeof(struct Leitor));
+    if (!l)
+        return NULL;
+    l->vs = vs;
+    l->m = *m;
+    snprintf(l->nome, sizeof(l->nome), "%s", m->nome);
+    l->m.nome = l->nome;
+
+    if (m->comprimido == MEMBRO_DELTA) {
+        struct Membro base;
+        char nome_base[TAM_NOME];
+        if (busca_base(vs, m->soma_base, m->offset, &base, nome_base) != 0) {
+            fprintf(stderr, "Erro: versão base do membro %s não encontrada\n", m->nome);
+            leitor_fecha(l);
+            return NULL;
+        }
+        if (!(l->base = leitor_abre(vs, &base, profundidade + 1))) {
+            leitor_fecha(l);
+            return NULL;
+        }
+    }
+    return l;
+}
+
+// Garante que '*buffer' tenha pelo menos 'tam' bytes (o conteúdo se perde)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int garante_buffer(unsigned char **buffer, size_t *capacidade, size_t tam) {
+    if (tam <= *capacidade)
+        return 0;
+
+    free(*buffer);
+    *capacidade = 0;
+    if (!(*buffer = malloc(tam))) {
+        fprintf(stderr, "Erro ao alocar memória para a leitura\n");
+        return 1;
+    }
+    *capacidade = tam;
+    return 0;
+}
+
+// Lê e decodifica o próximo bloco do membro em l->dados (l->restantes == 0
+// no fim dos dados)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int leitor_bloco(struct Leitor *l) {
+    const struct Membro *m = &l->m;
+    l->restantes = 0;
+    if (l->pos >= m->tam_disco)
+        return 0;
+
+    // Sem compressão: os dados vêm como estão, em pedaços do bloco orçado
+    if (m->comprimido == 0) {
+        size_t pedaco = tam_bloco_orcado();
+        size_t n = m->tam_disco - l->pos < pedaco ? m->tam_disco - l->pos : pedaco;
+        if (garante_buffer(&l->janela, &l->tam_janela, n) != 0)
+            return 1;
+        uint64_t relogio = metricas_relogio();
+        if (pread(l->vs->fd, l->janela, n, m->offset + l->pos) != (ssize_t)n) {
+            fprintf(stderr, "Erro ao ler dados do membro %s\n", m->nome);
+            return 1;
+        }
+        metricas_fase(FASE_LEITURA, relogio);
+        l->pos += n;
+        l->dados = l->janela;
+        l->restantes = n;
+        return 0;
+    }
+
+    struct Bloco cab;
+    uint64_t relogio = metricas_relogio();
+    if (m->tam_disco - l->pos < sizeof(struct Bloco) ||
+        pread(l->vs->fd, &cab, sizeof(struct Bloco), m->offset + l->pos) != sizeof(struct Bloco)) {
+        fprintf(stderr, "Erro ao ler dados do membro %s\n", m->nome);
+        return 1;
+    }
+    l->pos += sizeof(struct Bloco);
+    size_t bloco_base = l->base ? bloco_delta(m) : 0;
+    if (cab.tam_orig > (l->base ? bloco_base : TAM_BLOCO) || cab.tam_disco > cab.tam_orig ||
+        cab.tam_disco > m->tam_disco - l->pos) {
+        fprintf(stderr, "Bloco inválido no membro %s\n", m->nome);
+        return 1;
+    }
+    if (garante_buffer(&l->disco, &l->tam_disco, cab.tam_disco) != 0 ||
+        garante_buffer(&l->janela, &l->tam_janela, bloco_base + cab.tam_orig) != 0)
+        return 1;
+    if (pread(l->vs->fd, l->disco, cab.tam_disco, m->offset + l->pos) != (ssize_t)cab.tam_disco) {
+        fprintf(stderr, "Erro ao ler dados do membro %s\n", m->nome);
+        return 1;
+    }
+    metricas_fase(FASE_LEITURA, relogio);
+    l->pos += cab.tam_disco;
+
+    // Delta: a história é o bloco de mesma posição da base (consumido mesmo
+    // que este bloco esteja sem compressão, para manter o alinhamento)
+    size_t historia = 0;
+    if (l->base) {
+        historia = leitor_preenche(l->base, l->janela, bloco_base);
+        if (l->base->erro)
+            return 1;
+    }
+
+    relogio = metricas_relogio();
+    l->dados = l->disco;
+    if (cab.tam_disco == 0) {
+        memset(l->janela, 0, cab.tam_orig);
+        l->dados = l->janela;
+    } else if (cab.tam_disco < cab.tam_orig) {
+        int n = l->base ? LZ_UncompressDelta(l->disco, l->janela, cab.tam_disco, historia, cab.tam_orig)
+                        : LZ_Uncompress(l->disco, l->janela, cab.tam_disco, cab.tam_orig);
+        if (n != (int)cab.tam_orig) {
+            fprintf(stderr, "Bloco inválido no membro %s\n", m->nome);
+            return 1;
+        }
+        l->dados = l->janela + historia;
+    }
+    metricas_fase(FASE_DESCOMPRESSAO, relogio);
+    l->restantes = cab.tam_orig;
+    return 0;
+}
+
+// Copia os próximos 'tam' bytes do conteúdo para 'destino' (menos, no fim)
+// RETORNO: bytes copiados (l->erro indica se houve erro)
+static size_t leitor_preenche(struct Leitor *l, unsigned char *destino, size_t tam) {
+    size_t copiados = 0;
+    while (copiados < tam && !l->erro) {
+        if (l->restantes == 0 && (l->erro = leitor_bloco(l)) != 0)
+            break;
+        if (l->restantes == 0)
+            break;
+
+        size_t n = tam - copiados < l->restantes ? tam - copiados : l->restantes;
+        memcpy(destino + copiados, l->dados, n);
+        copiados += n;
+        l->dados += n;
+        l->restantes -= n;
+    }
+    return copiados;
+}
+
+// Obtém o próximo pedaço decodificado do conteúdo, válido até a próxima chamada
+// RETORNO: bytes disponíveis em *dados; 0 no fim ou em erro (l->erro)
+static size_t leitor_le(struct Leitor *l, const unsigned char **dados) {
+    if (l->restantes == 0 && (l->erro = leitor_bloco(l)) != 0)
+        return 0;
+
+    size_t n = l->restantes;
+    *dados = l->dados;
+    l->restantes = 0;
+    return n;
+}
+
+// Grava 'membro' como delta da versão de conteúdo m->soma_base, a partir de
+// m->offset em 'temp' (ver MEMBRO_DELTA). A base é lida do archive de 'vs'.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int grava_delta(struct Arena *arena, const char *membro, FILE *temp, struct Membro *m,
+                       const struct Versoes *vs) {
+    struct Membro base;
+    char nome_base[TAM_NOME];
+    if (busca_base(vs, m->soma_base, -1, &base, nome_base) != 0)
+        return 1;
+
+    size_t tam_bloco = tam_bloco_delta_orcado();
+    struct Entrada entrada;
+    if (entrada_abre(&entrada, membro, tam_bloco) != 0)
+        return 1;
+
+    struct Leitor *leitor = leitor_abre(vs, &base, 0);
+    unsigned char *janela = arena_obtem(arena, 2 * tam_bloco);
+    unsigned char *comprimido = arena_obtem(arena, tam_bloco + tam_bloco / 256 + 1);
+    unsigned int *trabalho = arena_obtem(arena, LZ_DELTA_WORKSIZE(tam_bloco, tam_bloco) * sizeof(unsigned int));
+    int erro = !leitor || !janela || !comprimido || !trabalho || fseek(temp, m->offset, SEEK_SET) != 0;
+
+    struct Soma soma;
+    soma_inicia(&soma);
+    m->tam_orig = 0;
+    m->tam_disco = 0;
+    m->pos_segmento = tam_bloco;
+
+    // Cada pedaço da entrada (tam_bloco bytes, menos no último) vai depois
+    // do bloco de mesma posição da base, na janela
+    const unsigned char *bloco;
+    size_t lidos;
+    uint64_t relogio = metricas_relogio();
+    while (!erro && (lidos = entrada_le(&entrada, &bloco)) > 0) {
+        metricas_fase(FASE_LEITURA, relogio);
+
+        // A história é consumida mesmo para um bloco de zeros, para manter o
+        // alinhamento com a base
+        size_t historia = leitor_preenche(leitor, janela, tam_bloco);
+        if (leitor->erro) {
+            erro = 1;
+            break;
+        }
+
+        struct Bloco cab = { lidos, lidos };
+        const unsigned char *dados = bloco;
+        relogio = metricas_relogio();
+        if (pedaco_de_zeros(&entrada, bloco, lidos)) {
+            soma_zeros(&soma, lidos);
+            cab.tam_disco = 0;
+        } else {
+            soma_acrescenta(&soma, bloco, lidos);
+            memcpy(janela + historia, bloco, lidos);
+            unsigned int tam_comp = LZ_CompressDelta(janela, historia, comprimido, lidos, trabalho);
+            if (tam_comp < lidos) {
+                cab.tam_disco = tam_comp;
+                dados = comprimido;
+            }
+        }
+        metricas_fase(FASE_COMPRESSAO, relogio);
+
+        relogio = metricas_relogio();
+        if (fwrite(&cab, sizeof(struct Bloco), 1, temp) != 1 ||
+            fwrite(dados, 1, cab.tam_disco, temp) != cab.tam_disco) {
+            fprintf(stderr, "Erro ao escrever bloco comprimido\n");
+            erro = 1;
+            break;
+        }
+        metricas_fase(FASE_ESCRITA, relogio);
+        relogio = metricas_relogio();
+
+        m->tam_orig += lidos;
+        m->tam_disco += sizeof(struct Bloco) + cab.tam_disco;
+    }
+
+    if (entrada.erro)
+        erro = 1;
+    entrada_fecha(&entrada);
+    leitor_fecha(leitor);
+    arena_devolve(arena, janela);
+    arena_devolve(arena, comprimido);
+    arena_devolve(arena, trabalho);
+
+    m->comprimido = MEMBRO_DELTA;
+    m->soma = soma_final(&soma);
+    metricas_bytes(m->tam_orig, m->tam_disco);
+    return erro;
+}
+
+// Grava o membro 'membro' no final do arquivo temporário, no offset indicado.
+// Se a compressão não reduzir o tamanho, os dados são regravados sem compressão.
+// Entradas que não podem ser relidas (pipes) sempre ficam em blocos.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int grava_membro(struct Arena *arena, const char *membro, FILE *temp, struct Membro *m,
+                        int comprimir) {
+    struct Entrada entrada;
+    if (entrada_abre(&entrada, membro, tam_bloco_orcado()) != 0)
+        return 1;
+
+    if (fseek(temp, m->offset, SEEK_SET) != 0) {
+        entrada_fecha(&entrada);
+        return 1;
+    }
+
+    struct Soma soma;
+    soma_inicia(&soma);
+
+    int mapeada = entrada.mapa.dados != NULL;
+    if (comprimir || !mapeada) {
+        if (comprime_fluxo(arena, &entrada, temp, &m->tam_orig, &m->tam_disco, &soma) != 0) {
+            entrada_fecha(&entrada);
+            return 1;
+        }
+        m->comprimido = 1;
+        m->soma = soma_final(&soma);
+
+        // Compressão valeu a pena (ou a entrada não pode ser relida)
+        if (m->tam_disco < m->tam_orig || !mapeada) {
+            entrada_fecha(&entrada);
+            metricas_bytes(m->tam_orig, m->tam_disco);
+            return 0;
+        }
+
+        // Descarta os blocos e volta ao início da entrada
+        fflush(temp);
+        if (ftruncate(fileno(temp), m->offset) != 0 || entrada_reinicia(&entrada) != 0) {
+            entrada_fecha(&entrada);
+            return 1;
+        }
+    }
+
+    // Guarda sem compressão, copiando a entrada direto para o archive. Sem a
+    // tentativa de compressão, a soma é feita sobre o mapa
+    if (!comprimir) {
+        soma_acrescenta(&soma, entrada.mapa.dados, entrada.mapa.tam);
+        m->soma = soma_final(&soma);
+    }
+    m->comprimido = 0;
+    m->tam_orig = entrada.mapa.tam;
+    m->tam_disco = entrada.mapa.tam;
+
+    fflush(temp);
+    uint64_t relogio = metricas_relogio();
+    int erro = copia_intervalo(entrada.fd, 0, fileno(temp), m->offset, entrada.mapa.tam);
+    metricas_fase(FASE_ESCRITA, relogio);
+    metricas_bytes(m->tam_orig, m->tam_disco);
+
+    entrada_fecha(&entrada);
+    return erro;
+}
+
+// Membro identificado pela posição dos dados no archive (para ordenar leituras
+// e agrupar membros do mesmo segmento sólido)
+struct Selecao {
+    int64_t offset;          // Posição dos dados no archive
+    int indice;              // Posição do membro no diretório
+};
+
+// Compara duas seleções pela posição dos dados no archive (para qsort)
+static int compara_offset(const void *a, const void *b) {
+    const struct Selecao *sa = a;
+    const struct Selecao *sb = b;
+
+    if (sa->offset != sb->offset)
+        return sa->offset < sb->offset ? -1 : 1;
+    return sa->indice - sb->indice;
+}
+
+// Verifica se o membro tem dados próprios no archive (fora do diretório)
+// RETORNO: 1 se tem, 0 se está vazio ou embutido
+static int tem_dados(const struct Membro *m) {
+    return m->tam_disco > 0 && m->comprimido != MEMBRO_EMBUTIDO;
+}
+
+// Membros de um mesmo segmento sólido compartilham os dados. Para cada membro,
+// devolve o índice do primeiro membro (na ordem do diretório) que usa os
+// mesmos dados, seu "dono": só o dono é copiado ao mover os dados, os outros
+// recebem o mesmo offset. Membros marcados em 'ignorar' (pode ser NULL) não
+// entram na conta.
+// RETORNO: vetor da arena com dir->quantidade posições ou NULL em caso de erro
+static int *donos_segmentos(struct Arena *arena, const struct Diretorio *dir, const char *ignorar) {
+    int *dono = arena_obtem(arena, (dir->quantidade + 1) * sizeof(int));
+    struct Selecao *solidos = arena_obtem(arena, (dir->quantidade + 1) * sizeof(struct Selecao));
+    if (!dono || !solidos) {
+        arena_devolve(arena, dono);
+        arena_devolve(arena, solidos);
+        return NULL;
+    }
+
+    int num_solidos = 0;
+    for (int i = 0; i < dir->quantidade; i++) {
+        dono[i] = i;
+        if (dir->membros[i].comprimido == MEMBRO_SOLIDO && !(ignorar && ignorar[i])) {
+            solidos[num_solidos].offset = dir->membros[i].offset;
+            solidos[num_solidos].indice = i;
+            num_solidos++;
+        }
+    }
+
+    // Ordenados por offset e índice, o primeiro de cada grupo é o dono
+    qsort(solidos, num_solidos, sizeof(struct Selecao), compara_offset);
+    for (int k = 1; k < num_solidos; k++)
+        if (solidos[k].offset == solidos[k - 1].offset)
+            dono[solidos[k].indice] = dono[solidos[k - 1].indice];
+
+    arena_devolve(arena, solidos);
+    return dono;
+}
+
+// Membro a ser inserido por inserir_membros
+struct Novo {
+    const char *caminho;     // Caminho de origem
+    char nome[1024];         // Nome normalizado, como fica no archive
+    off_t tam;               // Tamanho de origem (para decidir o alinhamento)
+    struct timespec data_modif; // Data de modificação de origem
+    uint64_t soma_base;      // --delta: conteúdo da versão base (ou SOMA_DESCONHECIDA)
+    int sequencia;           // Posição na lista recebida
+    int indice;              // Posição no novo diretório
+};
+
+static int compara_novo(const void *a, const void *b) {
+    const struct Novo *na = *(const struct Novo *const *)a;
+    const struct Novo *nb = *(const struct Novo *const *)b;
+    int cmp = strcmp(na->nome, nb->nome);
+    return cmp ? cmp : na->sequencia - nb->sequencia;
+}
+
+// Tira do lote os nomes repetidos: vale a última ocorrência, na posição da
+// primeira (como se cada uma substituísse a anterior). Os que ficam mantêm a
+// ordem da lista recebida, que é a ordem em que entram no archive; só uma
+// cópia ordenada pelo nome é usada para achar as repetições.
+// RETORNO: quantidade de membros que ficam em 'novos' ou -1 em caso de erro
+static int descarta_repetidos(struct Arena *arena, struct Novo *novos, int num_novos) {
+    struct Novo **ordem = arena_obtem(arena, (num_novos + 1) * sizeof(struct Novo *));
+    if (!ordem)
+        return -1;
+    for (int i = 0; i < num_novos; i++)
+        ordem[i] = &novos[i];
+    qsort(ordem, num_novos, sizeof(struct Novo *), compara_novo);
+
+    // Cada grupo de nomes iguais está na ordem da lista; os repetidos são
+    // marcados com caminho NULL
+    for (int i = 0; i < num_novos; ) {
+        int j = i;
+        while (j + 1 < num_novos && strcmp(ordem[j + 1]->nome, ordem[i]->nome) == 0)
+            j++;
+        if (j > i) {
+            int sequencia = ordem[i]->sequencia;
+            *ordem[i] = *ordem[j];
+            ordem[i]->sequencia = sequencia;
+            for (int k = i + 1; k <= j; k++)
+                ordem[k]->caminho = NULL;
+        }
+        i = j + 1;
+    }
+    arena_devolve(arena, ordem);
+
+    int mantidos = 0;
+    for (int i = 0; i < num_novos; i++)
+        if (novos[i].caminho)
+            novos[mantidos++] = novos[i];
+    return mantidos;
+}
+
+static int compara_nome_membro(const void *a, const void *b) {
+    const struct Membro *ma = *(const struct Membro *const *)a;
+    const struct Membro *mb = *(const struct Membro *const *)b;
+    return strcmp(ma->nome, mb->nome);
+}
+
+// Até esta quantidade de novos membros, a busca no diretório é linear
+#define LIMITE_BUSCA_LINEAR 8
+
+// Preenche 'indice' de cada novo membro com a posição do membro de mesmo nome
+// no diretório, ou -1. Lotes grandes ordenam o diretório uma vez e usam busca
+// binária, em vez de percorrê-lo inteiro para cada membro.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int localiza_existentes(struct Arena *arena, const struct Diretorio *dir, struct Novo *novos,
+                               int num_novos) {
+    if (num_novos <= LIMITE_BUSCA_LINEAR || dir->quantidade == 0) {
+        for (int i = 0; i < num_novos; i++)
+            novos[i].indice = busca_membro(novos[i].nome, dir->membros, dir->quantidade);
+        return 0;
+    }
+
+    struct Membro **ordenados = arena_obtem(arena, dir->quantidade * sizeof(struct Membro *));
+    if (!ordenados)
+        return 1;
+    for (int i = 0; i < dir->quantidade; i++)
+        ordenados[i] = &dir->membros[i];
+    qsort(ordenados, dir->quantidade, sizeof(struct Membro *), compara_nome_membro);
+
+    for (int i = 0; i < num_novos; i++) {
+        int ini = 0, fim = dir->quantidade;
+        while (ini < fim) {
+            int meio = ini + (fim - ini) / 2;
+            if (strcmp(ordenados[meio]->nome, novos[i].nome) < 0)
+                ini = meio + 1;
+            else
+                fim = meio;
+        }
+        novos[i].indice = (ini < dir->quantidade && strcmp(ordenados[ini]->nome, novos[i].nome) == 0)
+                          ? (int)(ordenados[ini] - dir->membros) : -1;
+    }
+
+    arena_devolve(arena, ordenados);
+    return 0;
+}
+
+// Com -u, a data de um membro só é confiável se for anterior em mais de
+// tantos segundos à última gravação do archive. Um arquivo alterado no mesmo
+// instante (na resolução do sistema de arquivos) em que foi lido poderia
+// manter a data e o tamanho guardados.
+#define MARGEM_DATA_CONFIAVEL 2
+
+// -u: tira de 'novos' os arquivos que não mudaram desde que foram guardados.
+// Mesmo tamanho e mesma data (confiável) bastam, sem ler o arquivo; com o
+// mesmo tamanho mas data diferente ou não confiável (ou com
+// opcoes.conferir_conteudo), o conteúdo é somado e comparado com a soma
+// guardada. Se só a data mudou, ela é atualizada no próprio 'dir' e
+// *atualizados é incrementado. 'gravado' é a data de modificação do archive.
+// RETORNO: quantidade de arquivos que continuam em 'novos'
+static int descarta_inalterados(struct Diretorio *dir, struct Novo *novos, int num_novos,
+                                time_t gravado, int *atualizados) {
+    int mantidos = 0;
+    for (int i = 0; i < num_novos; i++) {
+        struct Membro *m = novos[i].indice == -1 ? NULL : &dir->membros[novos[i].indice];
+        if (!m || m->tam_orig != (uint64_t)novos[i].tam) {
+            novos[mantidos++] = novos[i];
+            continue;
+        }
+
+        int mesma_data = m->data_modif == novos[i].data_modif.tv_sec &&
+                         m->data_modif_ns == (uint32_t)novos[i].data_modif.tv_nsec;
+        int confiavel = m->data_modif + MARGEM_DATA_CONFIAVEL < gravado;
+        if (mesma_data && confiavel && !opcoes.conferir_conteudo)
+            continue;
+
+        // Sem soma guardada (ou se o arquivo não pôde ser lido) não há como
+        // saber: o arquivo é inserido de novo
+        uint64_t soma;
+        if (m->soma == SOMA_DESCONHECIDA || soma_arquivo(novos[i].caminho, &soma) != 0 ||
+            soma != m->soma) {
+            novos[mantidos++] = novos[i];
+            continue;
+        }
+
+        // Conteúdo igual: regravar o diretório guarda a nova data e torna a
+        // data confiável nas próximas atualizações
+        if (!mesma_data || !confiavel) {
+            m->data_modif = novos[i].data_modif.tv_sec;
+            m->data_modif_ns = novos[i].data_modif.tv_nsec;
+            (*atualizados)++;
+        }
+    }
+    return mantidos;
+}
+
+// Membros até este tamanho vão para segmentos sólidos (--solido)
+#define TAM_MAX_SOLIDO (64 * 1024)
+
+// Próximo número de versão de 'nome': um a mais que o maior N entre os
+// membros "nome;N"
+// RETORNO: número da versão
+static int proxima_versao(const struct Diretorio *dir, const char *nome) {
+    size_t tam = strlen(nome);
+    int maior = 0;
+    for (int i = 0; i < dir->quantidade; i++) {
+        const char *m = dir->membros[i].nome;
+        if (strncmp(m, nome, tam) != 0 || m[tam] != ';' || !m[tam + 1] ||
+            strspn(m + tam + 1, "0123456789") != strlen(m + tam + 1))
+            continue;
+        int versao = atoi(m + tam + 1);
+        if (versao > maior)
+            maior = versao;
+    }
+    return maior + 1;
+}
+
+// Verifica se os membros marcados podem sair do diretório (removidos ou
+// substituídos): um delta que fica não pode perder todas as suas bases
+// RETORNO: 0 se podem, 1 caso contrário
+static int confere_bases(const struct Diretorio *dir, const char *marcado) {
+    for (int i = 0; i < dir->quantidade; i++) {
+        const struct Membro *delta = &dir->membros[i];
+        if (marcado[i] || delta->comprimido != MEMBRO_DELTA)
+            continue;
+
+        int fica = 0;
+        int sai = -1;
+        for (int j = 0; j < dir->quantidade && !fica; j++) {
+            const struct Membro *base = &dir->membros[j];
+            if (j == i || base->soma != delta->soma_base || !pode_ser_base(base->comprimido))
+                continue;
+            if (marcado[j])
+                sai = j;
+            else
+                fica = 1;
+        }
+        if (!fica && sai != -1) {
+            fprintf(stderr, "Erro: %s é a versão base de %s e não pode sair do archive sem ela\n",
+                    dir->membros[sai].nome, delta->nome);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Com --delta, os membros grandes substituídos continuam no archive como
+// "nome;N" e os novos passam a ser acrescentados, como deltas deles se a
+// cadeia não passar de opcoes.delta e os leitores dela, com o do novo delta,
+// couberem na parcela do orçamento (senão, começam uma cadeia nova)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int guarda_versoes(struct Diretorio *dir, struct Novo *novos, int num_novos,
+                          const struct Versoes *vs) {
+    for (int i = 0; i < num_novos; i++) {
+        struct Membro *antigo = novos[i].indice == -1 ? NULL : &dir->membros[novos[i].indice];
+        if (!antigo || novos[i].tam <= TAM_MAX_SOLIDO || novos[i].tam <= opcoes.embutir ||
+            !pode_ser_base(antigo->comprimido))
+            continue;
+
+        char nome_versao[TAM_NOME];
+        int tam = snprintf(nome_versao, sizeof(nome_versao), "%s;%d", antigo->nome,
+                           proxima_versao(dir, antigo->nome));
+        if (tam < 0 || (size_t)tam >= sizeof(nome_versao)) {
+            fprintf(stderr, "Erro: nome longo demais para guardar a versão de %s\n", antigo->nome);
+            return 1;
+        }
+
+        uint64_t custo;
+        int cadeia = comprimento_cadeia(vs, antigo, &custo);
+        if (antigo->soma != SOMA_DESCONHECIDA && cadeia >= 0 && cadeia < opcoes.delta &&
+            custo + 3 * (uint64_t)tam_bloco_delta_orcado() <= parcela_memoria())
+            novos[i].soma_base = antigo->soma;
+        if (!(antigo->nome = diretorio_guarda_nome(dir, nome_versao)))
+            return 1;
+        novos[i].indice = -1;
+    }
+    return 0;
+}
+
+// Extensão de um nome ("" se não há), para agrupar arquivos parecidos
+static const char *extensao(const char *nome) {
+    const char *base = strrchr(nome, '/');
+    const char *ponto = strrchr(base ? base + 1 : nome, '.');
+    return ponto ? ponto + 1 : "";
+}
+
+// Ordena os membros de um segmento por extensão e depois pelo nome do
+// arquivo, para que arquivos parecidos fiquem próximos dentro da janela do LZ
+static int compara_extensao(const void *a, const void *b) {
+    const struct Novo *na = *(const struct Novo *const *)a;
+    const struct Novo *nb = *(const struct Novo *const *)b;
+
+    int cmp = strcmp(extensao(na->nome), extensao(nb->nome));
+    if (cmp)
+        return cmp;
+
+    const char *base_a = strrchr(na->nome, '/');
+    const char *base_b = strrchr(nb->nome, '/');
+    cmp = strcmp(base_a ? base_a + 1 : na->nome, base_b ? base_b + 1 : nb->nome);
+    return cmp ? cmp : strcmp(na->nome, nb->nome);
+}
+
+// Comprime 'tam' bytes de 'dados' como um segmento de um bloco e grava em 'offset'
+// RETORNO: bytes gravados ou 0 em caso de erro
+static uint64_t grava_segmento(FILE *arq, int64_t offset, unsigned char *dados, uint32_t tam,
+                               unsigned char *comprimido, unsigned int *trabalho) {
+    struct Bloco cab = { tam, tam };
+    const unsigned char *saida = dados;
+
+    uint64_t relogio = metricas_relogio();
+    unsigned int tam_comp = LZ_CompressFast(dados, comprimido, tam, trabalho);
+    if (tam_comp < tam) {
+        cab.tam_disco = tam_comp;
+        saida = comprimido;
+    }
+    metricas_fase(FASE_COMPRESSAO, relogio);
+
+    relogio = metricas_relogio();
+    if (fseek(arq, offset, SEEK_SET) != 0 ||
+        fwrite(&cab, sizeof(struct Bloco), 1, arq) != 1 ||
+        fwrite(saida, 1, cab.tam_disco, arq) != cab.tam_disco) {
+        fprintf(stderr, "Erro ao escrever segmento sólido\n");
+        return 0;
+    }
+    metricas_fase(FASE_ESCRITA, relogio);
+    metricas_bytes(0, sizeof(struct Bloco) + cab.tam_disco);
+
+    return sizeof(struct Bloco) + cab.tam_disco;
+}
+
+// Junta os membros pequenos em segmentos sólidos, gravados a partir de
+// *offset. Os membros gravados são marcados em 'gravado'.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int grava_solidos(struct Arena *arena, FILE *arq, struct Membro *membros, struct Novo *novos,
+                         int num_novos, char *gravado, int64_t *offset) {
+    uint32_t tam_max_seg = tam_bloco_orcado();
+    struct Novo **pequenos = arena_obtem(arena, (num_novos + 1) * sizeof(struct Novo *));
+    unsigned char *segmento = arena_obtem(arena, tam_max_seg);
+    unsigned char *comprimido = arena_obtem(arena, tam_max_seg + tam_max_seg / 256 + 1);
+    unsigned int *trabalho = arena_obtem(arena, (tam_max_seg + 65536) * sizeof(unsigned int));
+    int erro = !pequenos || !segmento || !comprimido || !trabalho;
+
+    int num_pequenos = 0;
+    for (int i = 0; !erro && i < num_novos; i++)
+        if (!gravado[i] && novos[i].tam <= TAM_MAX_SOLIDO)
+            pequenos[num_pequenos++] = &novos[i];
+    if (!erro)
+        qsort(pequenos, num_pequenos, sizeof(struct Novo *), compara_extensao);
+
+    // Enche o segmento e o grava quando o próximo membro não cabe
+    uint32_t tam_seg = 0;
+    int inicio_seg = 0;
+    for (int k = 0; !erro && k <= num_pequenos; k++) {
+        if (k == num_pequenos || tam_seg + pequenos[k]->tam > tam_max_seg) {
+            if (k > inicio_seg) {
+                uint64_t tam_disco = grava_segmento(arq, *offset, segmento, tam_seg, comprimido, trabalho);
+                if (tam_disco == 0) {
+                    erro = 1;
+                    break;
+                }
+                for (int j = inicio_seg; j < k; j++) {
+                    struct Membro *m = &membros[pequenos[j]->indice];
+                    m->offset = *offset;
+                    m->tam_disco = tam_disco;
+                    gravado[pequenos[j] - novos] = 1;
+                }
+                *offset += tam_disco;
+            }
+            inicio_seg = k;
+            tam_seg = 0;
+            if (k == num_pequenos)
+                break;
+        }
+
+        // Copia o conteúdo do membro (até o tamanho visto no stat) para o segmento
+        struct Novo *novo = pequenos[k];
+        struct Membro *m = &membros[novo->indice];
+        uint64_t relogio = metricas_relogio();
+        struct Entrada entrada;
+        if (entrada_abre(&entrada, novo->caminho, TAM_BLOCO) != 0) {
+            fprintf(stderr, "Erro ao inserir membro: %s\n", novo->caminho);
+            erro = 1;
+            break;
+        }
+
+        m->comprimido = MEMBRO_SOLIDO;
+        m->pos_segmento = tam_seg;
+        m->tam_orig = 0;
+
+        const unsigned char *dados;
+        size_t lidos;
+        while (m->tam_orig < (uint64_t)novo->tam && (lidos = entrada_le(&entrada, &dados)) > 0) {
+            if (lidos > novo->tam - m->tam_orig)
+                lidos = novo->tam - m->tam_orig;
+            memcpy(segmento + tam_seg, dados, lidos);
+            tam_seg += lidos;
+            m->tam_orig += lidos;
+        }
+        m->soma = soma_dados(segmento + m->pos_segmento, m->tam_orig);
+        if (entrada.erro)
+            erro = 1;
+        entrada_fecha(&entrada);
+
+        // Os bytes gravados são contados por segmento
+        metricas_fase(FASE_LEITURA, relogio);
+        metricas_bytes(m->tam_orig, 0);
+        metricas_membro(m->nome, m->tam_orig, 0, relogio);
+    }
+
+    arena_devolve(arena, pequenos);
+    arena_devolve(arena, segmento);
+    arena_devolve(arena, comprimido);
+    arena_devolve(arena, trabalho);
+    return erro;
+}
+
+// Grava os dados dos membros novos a partir de 'offset', um após o outro (o
+// tamanho comprimido de cada um só é conhecido depois de gravá-lo). Com
+// --solido, os pequenos vão antes, agrupados em segmentos. Os embutidos são
+// pulados. Membros com soma_base viram deltas de versões lidas de 'vs'.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int grava_novos(struct Arena *arena, FILE *arq, struct Membro *membros, struct Novo *novos,
+                       int num_novos, int64_t offset, int comprimir, const struct Versoes *vs) {
+    char *gravado = arena_obtem(arena, num_novos + 1);
+    if (!gravado)
+        return 1;
+
+    // Os embutidos já estão no diretório
+    for (int i = 0; i < num_novos; i++)
+        gravado[i] = membros[novos[i].indice].comprimido == MEMBRO_EMBUTIDO;
+
+    int erro = opcoes.solido && grava_solidos(arena, arq, membros, novos, num_novos, gravado, &offset);
+
+    for (int i = 0; !erro && i < num_novos; i++) {
+        if (gravado[i])
+            continue;
+
+        struct Membro *m = &membros[novos[i].indice];
+        if (novos[i].tam >= TAM_MIN_ALINHADO)
+            offset = alinha_offset(offset);
+        m->offset = offset;
+
+        uint64_t relogio = metricas_relogio();
+        int erro_membro = vs && m->soma_base != SOMA_DESCONHECIDA
+                          ? grava_delta(arena, novos[i].caminho, arq, m, vs)
+                          : grava_membro(arena, novos[i].caminho, arq, m, comprimir);
+        if (erro_membro != 0) {
+            fprintf(stderr, "Erro ao inserir membro: %s\n", novos[i].caminho);
+            erro = 1;
+        }
+        metricas_membro(m->nome, m->tam_orig, m->tam_disco, relogio);
+        offset = m->offset + m->tam_disco;
+    }
+
+    arena_devolve(arena, gravado);
+    return erro;
+}
+
+// Embute no diretório os membros novos de até opcoes.embutir bytes: os
+// dados deles são acrescentados a uma cópia da área de embutidos de 'dir',
+// que é devolvida em *area (a ser liberada pelo chamador)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int embute_novos(const struct Diretorio *dir, struct Membro *membros, struct Novo *novos,
+                        int num_novos, unsigned char **area, uint64_t *tam_area) {
+    uint64_t tam = dir->tam_embutidos;
+    for (int i = 0; i < num_novos; i++)
+        if (novos[i].tam <= opcoes.embutir)
+            tam += novos[i].tam;
+
+    *tam_area = dir->tam_embutidos;
+    *area = malloc(tam + 1);
+    if (!*area)
+        return 1;
+    if (dir->tam_embutidos > 0)
+        memcpy(*area, dir->embutidos, dir->tam_embutidos);
+
+    for (int i = 0; i < num_novos; i++) {
+        if (novos[i].tam > opcoes.embutir)
+            continue;
+
+        // Copia o conteúdo (até o tamanho visto no stat) para a área
+        struct Membro *m = &membros[novos[i].indice];
+        uint64_t relogio = metricas_relogio();
+        struct Entrada entrada;
+        if (entrada_abre(&entrada, novos[i].caminho, TAM_BLOCO) != 0) {
+            fprintf(stderr, "Erro ao inserir membro: %s\n", novos[i].caminho);
+            return 1;
+        }
+
+        m->comprimido = MEMBRO_EMBUTIDO;
+        m->offset = *tam_area;
+        m->tam_orig = 0;
+
+        const unsigned char *dados;
+        size_t lidos;
+        while (m->tam_orig < (uint64_t)novos[i].tam && (lidos = entrada_le(&entrada, &dados)) > 0) {
+            if (lidos > novos[i].tam - m->tam_orig)
+                lidos = novos[i].tam - m->tam_orig;
+            memcpy(*area + *tam_area, dados, lidos);
+            *tam_area += lidos;
+            m->tam_orig += lidos;
+        }
+        m->tam_disco = m->tam_orig;
+        m->soma = soma_dados(*area + m->offset, m->tam_orig);
+
+        int erro = entrada.erro;
+        entrada_fecha(&entrada);
+        if (erro) {
+            fprintf(stderr, "Erro ao inserir membro: %s\n", novos[i].caminho);
+            return 1;
+        }
+        metricas_fase(FASE_LEITURA, relogio);
+        metricas_bytes(m->tam_orig, m->tam_disco);
+        metricas_membro(m->nome, m->tam_orig, m->tam_disco, relogio);
+    }
+    return 0;
+}
+
+// Verifica se uma alteração pode ser feita no lugar, com os dados terminando
+// em 'fim_antigo': o archive não pode ter espaço demais sem uso (dados de
+// membros removidos, substituídos ou copiados e gerações antigas do
+// diretório), que só é recuperado por uma reescrita completa. Membros marcados
+// em 'substituido' (pode ser NULL) não contam como dados em uso.
+// RETORNO: 1 se pode, 0 caso contrário
+static int cabe_no_lugar(const struct Diretorio *dir, const char *substituido, const int *dono,
+                         int64_t tam_dir, int64_t fim_antigo) {
+    int64_t vivos = TAM_RAIZ + tam_dir;
+
+    for (int i = 0; i < dir->quantidade; i++) {
+        if ((substituido && substituido[i]) || dono[i] != i || !tem_dados(&dir->membros[i]))
+            continue;
+        vivos += dir->membros[i].tam_disco;
+    }
+
+    return fim_antigo - vivos <= vivos;
+}
+
+// Começa uma reescrita completa, em outro arquivo ('<archive>.tmp'): leitores
+// do archive antigo continuam com ele até fechá-lo. Os dados dos membros de
+// 'dir' que não estão em 'pular' (pode ser NULL) são copiados de 'arq' na
+// ordem do diretório, logo após a raiz, sem passar por um buffer do tamanho
+// deles, e os offsets são acertados em 'membros', a cópia de dir->membros
+// (com 'quantidade' posições) que vai para o arquivo novo. Membros grandes
+// ficam alinhados ao bloco para que as próximas reescritas possam cloná-los.
+// RETORNO: o fim dos dados copiados ou -1 em caso de erro
+static int64_t copia_mantidos(FILE *arq, const struct Diretorio *dir, struct Membro *membros,
+                              int quantidade, const char *pular, const int *dono, FILE *temp) {
+    int64_t offset = TAM_RAIZ;
+    for (int i = 0; i < quantidade; i++) {
+        if ((pular && pular[i]) || membros[i].comprimido == MEMBRO_EMBUTIDO)
+            continue;
+        if (i < dir->quantidade && dono[i] != i) {
+            membros[i].offset = membros[dono[i]].offset;
+            continue;
+        }
+        if (membros[i].tam_disco >= TAM_MIN_ALINHADO)
+            offset = alinha_offset(offset);
+        membros[i].offset = offset;
+        offset += membros[i].tam_disco;
+    }
+
+    uint64_t relogio = metricas_relogio();
+    for (int i = 0; arq && i < dir->quantidade; i++) {
+        if ((pular && pular[i]) || dono[i] != i || !tem_dados(&dir->membros[i]))
+            continue;
+
+        if (copia_intervalo(fileno(arq), dir->membros[i].offset, fileno(temp),
+                            membros[i].offset, dir->membros[i].tam_disco) != 0)
+            return -1;
+    }
+    metricas_fase(FASE_COPIA, relogio);
+
+    return offset;
+}
+
+// Termina a reescrita começada por copia_mantidos: publica a primeira geração
+// de 'novo_dir' em 'temp', fecha-o e o coloca no lugar do archive. Se 'erro'
+// já vem marcado ou algo falha, o arquivo temporário é apagado.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int conclui_reescrita(const char *archive, const char *temp_file, FILE *temp,
+                             struct Diretorio *novo_dir, int erro) {
+    memset(&novo_dir->raiz, 0, sizeof(novo_dir->raiz));
+    if (!erro && publica_diretorio(temp, novo_dir) != 0)
+        erro = 1;
+
+    if (temp && fclose(temp) != 0)
+        erro = 1;
+
+    if (!erro && rename(temp_file, archive) != 0)
+        erro = 1;
+
+    if (erro && temp)
+        remove(temp_file);
+
+    return erro;
+}
+
+// Reescreve o archive inteiro com o diretório 'dir', lido de 'arq' e já
+// alterado pelo chamador (membros removidos ou em outra ordem). Os dados
+// ficam na ordem do diretório e sem o espaço sem uso.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int reescreve_archive(struct Arena *arena, const char *archive, FILE *arq,
+                             struct Diretorio *dir, const int *dono) {
+    struct Membro *membros = arena_obtem(arena, (dir->quantidade + 1) * sizeof(struct Membro));
+    if (!membros || fflush(arq) != 0)
+        return 1;
+    memcpy(membros, dir->membros, dir->quantidade * sizeof(struct Membro));
+
+    char temp_file[1024];
+    snprintf(temp_file, 1024, "%s.tmp", archive);
+    FILE *temp = fopen(temp_file, "wb");
+    int erro = temp == NULL;
+    if (!erro && copia_mantidos(arq, dir, membros, dir->quantidade, NULL, dono, temp) < 0)
+        erro = 1;
+
+    struct Diretorio novo_dir = { membros, dir->quantidade, dir->quantidade, dir->embutidos,
+                                  dir->tam_embutidos, dir->raiz, NULL };
+    erro = conclui_reescrita(archive, temp_file, temp, &novo_dir, erro);
+
+    // A publicação pode ter refeito a área de embutidos, que é de 'dir'
+    dir->embutidos = novo_dir.embutidos;
+    dir->tam_embutidos = novo_dir.tam_embutidos;
+    if (erro)
+        fprintf(stderr, "Erro ao reescrever o archive: %s\n", archive);
+    return erro;
+}
+
+// Insere no lugar: os dados novos e a geração nova do diretório vão para o
+// fim do archive, sem copiar os membros mantidos. Se algo falha antes da
+// publicação, o archive é truncado de volta ao fim antigo (nenhuma geração
+// publicada usa o que vem depois dele).
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int insere_no_lugar(struct Arena *arena, FILE *arq, struct Diretorio *novo_dir,
+                           struct Novo *novos, int num_novos, int64_t fim_antigo,
+                           int comprimir, const struct Versoes *vs) {
+    if (grava_novos(arena, arq, novo_dir->membros, novos, num_novos, fim_antigo, comprimir, vs) != 0) {
+        fflush(arq);
+        if (ftruncate(fileno(arq), fim_antigo) != 0)
+            fprintf(stderr, "Erro ao descartar dados parciais do archive\n");
+        return 1;
+    }
+
+    return publica_diretorio(arq, novo_dir);
+}
+
+// Insere os membros com os buffers temporários tirados de 'arena' (liberados
+// pelo chamador, inclusive nos erros), com o archive já travado por
+// insere_membros. Um archive vazio é tratado como novo.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int insere_travado(struct Arena *arena, const char *archive, const char **membros,
+                          int num_membros, int comprimir) {
+    struct Novo *novos = arena_obtem(arena, num_membros * sizeof(struct Novo));
+    if (!novos)
+        return 1;
+
+    // Confere os arquivos a serem inseridos antes de mexer no archive. O nome
+    // guardado é o caminho relativo, para que "a/x.conf" e "b/x.conf" não colidam
+    for (int i = 0; i < num_membros; i++) {
+        struct stat st_membro;
+        if (stat(membros[i], &st_membro) != 0) {
+            fprintf(stderr, "Erro ao abrir arquivo: %s\n", membros[i]);
+            return 1;
+        }
+        if (normaliza_nome(membros[i], novos[i].nome, sizeof(novos[i].nome)) != 0) {
+            fprintf(stderr, "Nome de membro inválido: %s\n", membros[i]);
+            return 1;
+        }
+        novos[i].caminho = membros[i];
+        novos[i].tam = st_membro.st_size;
+        novos[i].data_modif = st_membro.st_mtim;
+        novos[i].soma_base = SOMA_DESCONHECIDA;
+        novos[i].sequencia = i;
+    }
+
+    // Se o mesmo nome aparece mais de uma vez no lote, vale a última ocorrência
+    int num_novos = descarta_repetidos(arena, novos, num_membros);
+    if (num_novos < 0)
+        return 1;
+
+    // Lê o diretório, se o archive já existe
+    FILE *arq = fopen(archive, "rb+");
+    if (arq && offset_final(arq) == 0) {
+        fclose(arq);
+        arq = NULL;
+    }
+    struct Diretorio *dir = arq ? le_diretorio(arq) : cria_diretorio();
+    if (!dir || localiza_existentes(arena, dir, novos, num_novos) != 0) {
+        if (dir) destroi_diretorio(dir);
+        if (arq) fclose(arq);
+        return 1;
+    }
+
+    // -u: arquivos que não mudaram ficam de fora; se nada mudou (nem a data
+    // de algum deles), o archive nem é regravado
+    struct stat st_archive;
+    if (opcoes.atualizar && arq && fstat(fileno(arq), &st_archive) == 0) {
+        int atualizados = 0;
+        num_novos = descarta_inalterados(dir, novos, num_novos, st_archive.st_mtime, &atualizados);
+        if (num_novos == 0 && atualizados == 0) {
+            destroi_diretorio(dir);
+            return fclose(arq) != 0;
+        }
+    }
+
+    // --delta: as versões anteriores dos membros grandes ficam no archive
+    struct Versoes versoes = { arq ? fileno(arq) : -1, dir, NULL };
+    if (opcoes.delta && arq && guarda_versoes(dir, novos, num_novos, &versoes) != 0) {
+        destroi_diretorio(dir);
+        fclose(arq);
+        return 1;
+    }
+
+    // Membros já existentes são substituídos no lugar; os demais vão para o fim
+    int nova_quantidade = dir->quantidade;
+    for (int i = 0; i < num_novos; i++)
+        if (novos[i].indice == -1)
+            novos[i].indice = nova_quantidade++;
+
+    // As entradas do diretório ficam na memória duas vezes (as lidas e as
+    // novas), os nomes uma vez só; sob um orçamento, tudo precisa caber na
+    // metade dele
+    uint64_t tam_memoria = (uint64_t)nova_quantidade * 2 * sizeof(struct Membro) +
+                           diretorio_tam_nomes(dir);
+    if (opcoes.limite_memoria && tam_memoria > opcoes.limite_memoria / 2) {
+        fprintf(stderr, "Erro: O diretório com %d membros não cabe no limite de memória\n",
+                nova_quantidade);
+        destroi_diretorio(dir);
+        if (arq) fclose(arq);
+        return 1;
+    }
+
+    struct Membro *novos_membros = arena_obtem(arena, nova_quantidade * sizeof(struct Membro));
+    char *substituido = arena_obtem_zerado(arena, nova_quantidade);
+    if (!novos_membros || !substituido) {
+        destroi_diretorio(dir);
+        if (arq) fclose(arq);
+        return 1;
+    }
+
+    // Copia os membros existentes
+    for (int i = 0; i < dir->quantidade; i++) {
+        novos_membros[i] = dir->membros[i];
+    }
+
+    // Adiciona ou substitui os membros; tamanhos são conhecidos só após gravar
+    for (int i = 0; i < num_novos; i++) {
+        int k = novos[i].indice;
+        novos_membros[k] = inicializa_membro(novos[i].nome, getuid(), 0, 0,
+                                             novos[i].data_modif.tv_sec, k, 0, comprimir ? 1 : 0);
+        novos_membros[k].data_modif_ns = novos[i].data_modif.tv_nsec;
+        novos_membros[k].soma_base = novos[i].soma_base;
+        substituido[k] = 1;
+    }
+
+    // Membros substituídos não podem ser a única base de um delta que fica
+    if (confere_bases(dir, substituido) != 0) {
+        destroi_diretorio(dir);
+        if (arq) fclose(arq);
+        return 1;
+    }
+
+    // Membros mantidos que compartilham um segmento sólido
+    int *dono = donos_segmentos(arena, dir, substituido);
+
+    // Membros minúsculos vão para o próprio diretório
+    struct Diretorio novo_dir = { novos_membros, nova_quantidade, nova_quantidade, NULL, 0,
+                                  dir->raiz, NULL };
+    int embutiu = embute_novos(dir, novos_membros, novos, num_novos,
+                               &novo_dir.embutidos, &novo_dir.tam_embutidos) == 0;
+
+    int64_t tam_dir = embutiu ? tamanho_diretorio(&novo_dir) : -1;
+    int64_t fim_antigo = fim_dados(dir);
+    if (!dono || tam_dir < 0 || fim_antigo < 0) {
+        free(novo_dir.embutidos);
+        destroi_diretorio(dir);
+        if (arq) fclose(arq);
+        return 1;
+    }
+
+    if (arq && cabe_no_lugar(dir, substituido, dono, tam_dir, fim_antigo)) {
+        int erro = insere_no_lugar(arena, arq, &novo_dir, novos, num_novos, fim_antigo,
+                                   comprimir, &versoes);
+        if (fclose(arq) != 0)
+            erro = 1;
+        free(novo_dir.embutidos);
+        destroi_diretorio(dir);
+        return erro;
+    }
+
+    // Reescrita completa: os membros mantidos primeiro, os novos no final (as
+    // bases dos deltas são lidas do archive antigo, que só é fechado depois)
+    char temp_file[1024];
+    snprintf(temp_file, 1024, "%s.tmp", archive);
+    FILE *temp = fopen(temp_file, "wb");
+    int64_t offset = temp ? copia_mantidos(arq, dir, novos_membros, nova_quantidade,
+                                           substituido, dono, temp) : -1;
+    int erro = offset < 0;
+
+    if (!erro)
+        erro = grava_novos(arena, temp, novos_membros, novos, num_novos, offset, comprimir,
+                           arq ? &versoes : NULL);
+    if (arq) fclose(arq);
+
+    // Com todos os tamanhos conhecidos, publica o diretório do arquivo novo
+    erro = conclui_reescrita(archive, temp_file, temp, &novo_dir, erro);
+
+    // Limpeza (o resto volta com a arena)
+    free(novo_dir.embutidos);
+    destroi_diretorio(dir);
+
+    return erro;
+}
+
+// Trava o archive para escrita (criando-o vazio se não existe) e insere os
+// membros. Se a inserção falha, um archive criado aqui é apagado.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int insere_membros(struct Arena *arena, const char *archive, const char **membros,
+                          int num_membros, int comprimir) {
+    int criado;
+    int trava = trava_arquivo(archive, &criado);
+    if (trava < 0) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+        return 1;
+    }
+
+    int erro = insere_travado(arena, archive, membros, num_membros, comprimir);
+
+    struct stat st;
+    if (erro && criado && fstat(trava, &st) == 0 && st.st_size == 0)
+        unlink(archive);
+    close(trava);
+    return erro;
+}
+
+int inserir_membros(const char *archive, const char **membros, int num_membros, int comprimir) {
+    if (num_membros <= 0)
+        return 0;
+
+    struct Arena *arena = arena_cria();
+    if (!arena)
+        return 1;
+
+    int erro = insere_membros(arena, archive, membros, num_membros, comprimir);
+    arena_destroi(arena);
+    return erro;
+}
+
+int inserir_membro(const char *archive, const char *membro, int comprimir) {
+    return inserir_membros(archive, &membro, 1, comprimir);
+}
+
+// Verifica se o archive é "-" ou um arquivo gravado no formato em fluxo
+// RETORNO: 1 se está em fluxo, 0 caso contrário (ou se não pôde ser lido)
+static int archive_em_fluxo(const char *archive) {
+    if (strcmp(archive, "-") == 0)
+        return 1;
+
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    char magica[TAM_MAGICA_FLUXO];
+    int em_fluxo = pread(fd, magica, TAM_MAGICA_FLUXO, 0) == TAM_MAGICA_FLUXO &&
+                   memcmp(magica, MAGICA_FLUXO, TAM_MAGICA_FLUXO) == 0;
+    close(fd);
+    return em_fluxo;
+}
+
+// Archive em fluxo sendo escrito (ver MAGICA_FLUXO em diretorio.h). Os
+// registros do trailer são acumulados à medida que os membros são gravados.
+struct Fluxo {
+    FILE *saida;
+    uint64_t pos;                // Bytes já escritos no fluxo
+    struct Registro *registros;
+    int quantidade;
+    int capacidade;
+    char *nomes;                 // Nomes do trailer, concatenados
+    uint64_t tam_nomes;
+    uint64_t cap_nomes;
+};
+
+// Escreve no fluxo, contando a posição
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int fluxo_escreve(struct Fluxo *fluxo, const void *dados, size_t tam) {
+    if (tam > 0 && fwrite(dados, 1, tam, fluxo->saida) != tam) {
+        fprintf(stderr, "Erro ao escrever o archive em fluxo\n");
+        return 1;
+    }
+    fluxo->pos += tam;
+    return 0;
+}
+
+// Guarda o registro e o nome de um membro para o trailer
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int fluxo_registra(struct Fluxo *fluxo, const struct Registro *reg, const char *nome) {
+    if (fluxo->quantidade == fluxo->capacidade) {
+        int nova_capacidade = fluxo->capacidade ? fluxo->capacidade * 2 : 64;
+        struct Registro *novos = realloc(fluxo->registros, nova_capacidade * sizeof(struct Registro));
+        if (!novos)
+            return 1;
+        fluxo->registros = novos;
+        fluxo->capacidade = nova_capacidade;
+    }
+    if (fluxo->tam_nomes + reg->nome_tam > fluxo->cap_nomes) {
+        uint64_t nova_capacidade = fluxo->cap_nomes ? fluxo->cap_nomes * 2 : 4096;
+        while (nova_capacidade < fluxo->tam_nomes + reg->nome_tam)
+            nova_capacidade *= 2;
+        char *novos = realloc(fluxo->nomes, nova_capacidade);
+        if (!novos)
+            return 1;
+        fluxo->nomes = novos;
+        fluxo->cap_nomes = nova_capacidade;
+    }
+
+    fluxo->registros[fluxo->quantidade++] = *reg;
+    memcpy(fluxo->nomes + fluxo->tam_nomes, nome, reg->nome_tam);
+    fluxo->tam_nomes += reg->nome_tam;
+    return 0;
+}
+
+// Grava membros no fluxo, na ordem recebida. Os dados vão sempre em blocos:
+// sem seek não é possível voltar e regravá-los sem compressão.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int fluxo_grava_membros(struct Arena *arena, struct Fluxo *fluxo, const char **membros,
+                               int num_membros) {
+    for (int i = 0; i < num_membros; i++) {
+        char nome[1024];
+        if (normaliza_nome(membros[i], nome, sizeof(nome)) != 0) {
+            fprintf(stderr, "Nome de membro inválido: %s\n", membros[i]);
+            return 1;
+        }
+
+        uint64_t relogio = metricas_relogio();
+        struct Entrada entrada;
+        if (entrada_abre(&entrada, membros[i], tam_bloco_orcado()) != 0) {
+            fprintf(stderr, "Erro ao abrir arquivo: %s\n", membros[i]);
+            return 1;
+        }
+
+        // A data é a do arquivo de origem (a atual, se não for possível obtê-la)
+        struct stat st;
+        if (fstat(entrada.fd, &st) != 0) {
+            st.st_mtim.tv_sec = time(NULL);
+            st.st_mtim.tv_nsec = 0;
+        }
+
+        struct Registro reg = { 0 };
+        reg.offset = fluxo->pos;
+        reg.data_modif = st.st_mtim.tv_sec;
+        reg.data_modif_ns = st.st_mtim.tv_nsec;
+        reg.uid = getuid();
+        reg.ordem = fluxo->quantidade;
+        reg.posicao = fluxo->quantidade;
+        reg.nome_tam = strlen(nome);
+        reg.comprimido = 1;
+
+        struct MembroFluxo cab = { reg.data_modif, reg.uid, reg.nome_tam, 0 };
+        struct Bloco fim = { 0, 0 };
+        struct Soma soma;
+        soma_inicia(&soma);
+
+        int erro = fluxo_escreve(fluxo, &cab, sizeof(cab)) ||
+                   fluxo_escreve(fluxo, nome, reg.nome_tam) ||
+                   comprime_fluxo(arena, &entrada, fluxo->saida, &reg.tam_orig, &reg.tam_disco,
+                                  &soma) ||
+                   fluxo_escreve(fluxo, &fim, sizeof(fim));
+        entrada_fecha(&entrada);
+        reg.soma = soma_final(&soma);
+
+        if (erro) {
+            fprintf(stderr, "Erro ao inserir membro: %s\n", membros[i]);
+            return 1;
+        }
+
+        fluxo->pos += reg.tam_disco;
+        reg.tam_disco += sizeof(struct Bloco);
+        metricas_bytes(reg.tam_orig, reg.tam_disco);
+        metricas_membro(nome, reg.tam_orig, reg.tam_disco, relogio);
+        if (fluxo_registra(fluxo, &reg, nome) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Fecha a lista de membros e escreve o trailer
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int fluxo_finaliza(struct Fluxo *fluxo) {
+    struct MembroFluxo fim = { 0 };
+    struct FimFluxo rodape;
+    rodape.quantidade = fluxo->quantidade;
+    rodape.tam_trailer = (uint64_t)fluxo->quantidade * sizeof(struct Registro) + fluxo->tam_nomes;
+    memcpy(rodape.magica, MAGICA_FLUXO, TAM_MAGICA_FLUXO);
+
+    if (fluxo_escreve(fluxo, &fim, sizeof(fim)) ||
+        fluxo_escreve(fluxo, fluxo->registros, fluxo->quantidade * sizeof(struct Registro)) ||
+        fluxo_escreve(fluxo, fluxo->nomes, fluxo->tam_nomes) ||
+        fluxo_escreve(fluxo, &rodape, sizeof(rodape)))
+        return 1;
+
+    if (fflush(fluxo->saida) != 0) {
+        fprintf(stderr, "Erro ao escrever o archive em fluxo\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Insere um lote no archive ou, se 'fluxo' não é NULL, no fluxo de saída.
+// Os buffers do lote voltam para a arena no fim, para o próximo lote.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int insere_lote(struct Arena *arena, const char *archive, struct Fluxo *fluxo,
+                       const char **membros, int num_membros, int comprimir) {
+    int erro = fluxo ? fluxo_grava_membros(arena, fluxo, membros, num_membros)
+                     : insere_membros(arena, archive, membros, num_membros, comprimir);
+    arena_recicla(arena);
+    return erro;
+}
+
+// Quantidade de threads da varredura quando não indicada por --threads
+#define MAX_THREADS_VARREDURA 16
+
+// Memória estimada de cada thread da varredura (buffer do getdents, pilha e
+// caminhos pendentes) e de cada arquivo de um lote de inserção (entrada no
+// lote e, duas vezes, no diretório)
+#define CUSTO_THREAD_VARREDURA (1024 * 1024)
+#define CUSTO_ARQUIVO_LOTE (sizeof(struct Novo) + 2 * sizeof(struct Membro) + 256)
+
+// Menor lote de inserção usado sob um orçamento
+#define TAM_LOTE_MIN 64
+
+// Escolhe quantos arquivos vão em cada lote de inserção
+// RETORNO: tamanho do lote, até TAM_LOTE_INSERCAO
+static int tam_lote_orcado(void) {
+    return limita_parcela(TAM_LOTE_INSERCAO * CUSTO_ARQUIVO_LOTE, TAM_LOTE_MIN * CUSTO_ARQUIVO_LOTE) /
+           CUSTO_ARQUIVO_LOTE;
+}
+
+// Insere os arquivos encontrados na varredura de 'raiz', em lotes de até
+// 'tam_lote' arquivos
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int inserir_diretorio(struct Arena *arena, const char *archive, struct Fluxo *fluxo,
+                             const char *raiz, char **lote, int tam_lote, int comprimir) {
+    int num_threads = opcoes.threads;
+    if (num_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus < 2 ? 2 : cpus > MAX_THREADS_VARREDURA ? MAX_THREADS_VARREDURA : cpus;
+
+        // Sob um orçamento, só as threads que cabem nele
+        int cabem = limita_parcela(num_threads * CUSTO_THREAD_VARREDURA, CUSTO_THREAD_VARREDURA) /
+                    CUSTO_THREAD_VARREDURA;
+        if (num_threads > cabem)
+            num_threads = cabem;
+    }
+
+    struct Varredura *var = varredura_inicia(raiz, num_threads, &opcoes.filtro);
+    if (!var) {
+        fprintf(stderr, "Erro ao iniciar a varredura de %s\n", raiz);
+        return 1;
+    }
+
+    // Cada lote é inserido enquanto as threads continuam a varredura
+    int erro = 0;
+    int n;
+    while (!erro && (n = varredura_lote(var, lote, tam_lote)) > 0) {
+        erro = insere_lote(arena, archive, fluxo, (const char **)lote, n, comprimir);
+        for (int i = 0; i < n; i++)
+            free(lote[i]);
+    }
+
+    if (varredura_termina(var) != 0)
+        erro = 1;
+    return erro;
+}
+
+int inserir_caminhos(const char *archive, const char **caminhos, int num_caminhos, int comprimir) {
+
+    // Archive "-": escreve o formato em fluxo na saída padrão
+    struct Fluxo fluxo_saida = { stdout, 0, NULL, 0, 0, NULL, 0, 0 };
+    struct Fluxo *fluxo = NULL;
+    if (strcmp(archive, "-") == 0) {
+        if (isatty(STDOUT_FILENO)) {
+            fprintf(stderr, "Erro: o archive em fluxo não pode ser escrito em um terminal\n");
+            return 1;
+        }
+        setvbuf(stdout, NULL, _IOFBF, TAM_BUFFER_COPIA);
+        fluxo = &fluxo_saida;
+        if (fluxo_escreve(fluxo, MAGICA_FLUXO, TAM_MAGICA_FLUXO) != 0)
+            return 1;
+    } else if (archive_em_fluxo(archive)) {
+        fprintf(stderr, "Erro: %s está no formato em fluxo e não pode ser alterado\n", archive);
+        return 1;
+    }
+
+    // Os buffers temporários de todos os lotes vêm de uma arena só
+    int tam_lote = tam_lote_orcado();
+    char **lote = malloc(tam_lote * sizeof(char *));
+    struct Arena *arena = arena_cria();
+    if (!lote || !arena) {
+        free(lote);
+        arena_destroi(arena);
+        return 1;
+    }
+
+    // Arquivos citados diretamente são agrupados; diretórios são percorridos
+    int n = 0;
+    int erro = 0;
+    for (int i = 0; !erro && i < num_caminhos; i++) {
+        struct stat st;
+        int eh_diretorio = stat(caminhos[i], &st) == 0 && S_ISDIR(st.st_mode);
+
+        if (!eh_diretorio)
+            lote[n++] = (char *)caminhos[i];
+
+        // Insere o lote pendente antes de percorrer um diretório (ou se encheu)
+        if (n > 0 && (eh_diretorio || n == tam_lote)) {
+            erro = insere_lote(arena, archive, fluxo, (const char **)lote, n, comprimir);
+            n = 0;
+        }
+
+        if (!erro && eh_diretorio)
+            erro = inserir_diretorio(arena, archive, fluxo, caminhos[i], lote, tam_lote, comprimir);
+    }
+
+    if (!erro && n > 0)
+        erro = insere_lote(arena, archive, fluxo, (const char **)lote, n, comprimir);
+
+    if (!erro && fluxo)
+        erro = fluxo_finaliza(fluxo);
+
+    free(fluxo_saida.registros);
+    free(fluxo_saida.nomes);
+    free(lote);
+    arena_destroi(arena);
+    return erro;
+}
+
+
+int deve_extrair(const char *nome, const char **membros, int num_membros) {
+
+    // Se não há lista específica, extrai todos os membros
+    if (!membros || num_membros <= 0) 
+        return 1;
+    
+    for (int i = 0; i < num_membros; i++) {
+        if (membros[i] && casa_padrao(nome, membros[i])) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+// Pula 'tam' bytes de 'saida' sem escrevê-los: o trecho fica como buraco
+// (zeros que não ocupam disco). Um buraco no fim do arquivo só existe
+// depois de fixa_tamanho.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int pula_zeros(FILE *saida, uint64_t tam) {
+    return fseeko(saida, tam, SEEK_CUR) != 0;
+}
+
+// Estende 'saida' até a posição atual, depois de um buraco no fim
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int fixa_tamanho(FILE *saida) {
+    off_t fim = ftello(saida);
+    return fim < 0 || fflush(saida) != 0 || ftruncate(fileno(saida), fim) != 0;
+}
+
+// Descomprime um membro gravado em blocos (ver struct Bloco) e escreve o
+// resultado em 'saida', somando-o em 'soma', usando um único buffer de
+// TAM_BLOCO bytes da arena. Blocos de zeros viram buracos na saída.
+// Se 'dados' está em 'mapa' (pode ser NULL), as páginas já consumidas são
+// descartadas a cada janela, para que um membro grande não fique inteiro na
+// memória.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int descomprime_membro(struct Arena *arena, const unsigned char *dados, uint64_t tam_disco,
+                              FILE *saida, const struct Mapa *mapa, struct Soma *soma) {
+    uint64_t janela = limita_parcela(JANELA_EXTRACAO, TAM_BLOCO);
+    uint64_t descartado = 0;
+    unsigned char *bloco = arena_obtem(arena, TAM_BLOCO);
+    if (!bloco) {
+        fprintf(stderr, "Erro ao alocar memória para descompressão\n");
+        return 1;
+    }
+
+    uint64_t pos = 0;
+    int buraco_no_fim = 0;
+    while (pos < tam_disco) {
+        struct Bloco cab;
+
+        // Confere se o cabeçalho e os dados do bloco estão dentro do membro
+        if (tam_disco - pos < sizeof(struct Bloco))
+            return 1;
+        memcpy(&cab, dados + pos, sizeof(struct Bloco));
+        pos += sizeof(struct Bloco);
+
+        if (cab.tam_orig > TAM_BLOCO || cab.tam_disco > cab.tam_orig ||
+            cab.tam_disco > tam_disco - pos) {
+            fprintf(stderr, "Bloco inválido no membro\n");
+            return 1;
+        }
+
+        buraco_no_fim = cab.tam_disco == 0;
+        if (buraco_no_fim) {
+            soma_zeros(soma, cab.tam_orig);
+            if (pula_zeros(saida, cab.tam_orig) != 0)
+                return 1;
+            continue;
+        }
+
+        // Bloco guardado sem compressão vai direto do mapa
+        const unsigned char *saida_bloco = dados + pos;
+        if (cab.tam_disco < cab.tam_orig) {
+            uint64_t relogio = metricas_relogio();
+            int n = LZ_Uncompress((unsigned char *)dados + pos, bloco, cab.tam_disco, cab.tam_orig);
+            metricas_fase(FASE_DESCOMPRESSAO, relogio);
+            if (n != (int)cab.tam_orig) {
+                fprintf(stderr, "Bloco inválido no membro\n");
+                return 1;
+            }
+            saida_bloco = bloco;
+        }
+
+        soma_acrescenta(soma, saida_bloco, cab.tam_orig);
+        uint64_t relogio = metricas_relogio();
+        if (fwrite(saida_bloco, 1, cab.tam_orig, saida) != cab.tam_orig)
+            return 1;
+        metricas_fase(FASE_ESCRITA, relogio);
+
+        pos += cab.tam_disco;
+        if (mapa && pos - descartado >= janela) {
+            aconselha_intervalo(mapa, dados - mapa->dados + descartado, pos - descartado, MADV_DONTNEED);
+            descartado = pos;
+        }
+    }
+
+    if (buraco_no_fim && fixa_tamanho(saida) != 0)
+        return 1;
+
+    // Nos erros acima o buffer fica com a arena até o fim da operação
+    arena_devolve(arena, bloco);
+    return 0;
+}
+
+// Descomprime um membro pequeno direto para 'destino', que tem espaço para
+// 'capacidade' bytes (usado com os buffers registrados da fila de escrita)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int descomprime_buffer(const unsigned char *dados, uint64_t tam_disco,
+                              unsigned char *destino, uint64_t capacidade) {
+    uint64_t pos = 0;
+    uint64_t escritos = 0;
+
+    while (pos < tam_disco) {
+        struct Bloco cab;
+
+        if (tam_disco - pos < sizeof(struct Bloco))
+            return 1;
+        memcpy(&cab, dados + pos, sizeof(struct Bloco));
+        pos += sizeof(struct Bloco);
+
+        if (cab.tam_disco > cab.tam_orig || cab.tam_disco > tam_disco - pos ||
+            cab.tam_orig > capacidade - escritos) {
+            fprintf(stderr, "Bloco inválido no membro\n");
+            return 1;
+        }
+
+        if (cab.tam_disco == cab.tam_orig) {
+            memcpy(destino + escritos, dados + pos, cab.tam_orig);
+        } else if (cab.tam_disco == 0) {
+            memset(destino + escritos, 0, cab.tam_orig);
+        } else if (LZ_Uncompress((unsigned char *)dados + pos, destino + escritos, cab.tam_disco,
+                                 cab.tam_orig) != (int)cab.tam_orig) {
+            fprintf(stderr, "Bloco inválido no membro\n");
+            return 1;
+        }
+
+        escritos += cab.tam_orig;
+        pos += cab.tam_disco;
+    }
+
+    return 0;
+}
+
+// Compara a soma do conteúdo lido com a guardada no membro (membros de
+// archives antigos, sem soma, não são conferidos)
+// RETORNO: 0 se a soma confere, 1 se o conteúdo está corrompido
+static int confere_soma(const struct Membro *m, uint64_t soma) {
+    if (m->soma == SOMA_DESCONHECIDA || soma == m->soma)
+        return 0;
+    fprintf(stderr, "Erro: o conteúdo de %s não confere com a soma guardada\n", m->nome);
+    return 1;
+}
+
+// Reabre um arquivo extraído e mostra seus primeiros bytes em hexadecimal
+static void mostra_primeiros_bytes(const char *nome) {
+    FILE *verificacao = fopen(nome, "rb");
+    if (!verificacao)
+        return;
+
+    unsigned char primeiros_bytes[10];
+    size_t bytes_lidos_verificacao = fread(primeiros_bytes, 1, sizeof(primeiros_bytes), verificacao);
+    
+    for (size_t j = 0; j < bytes_lidos_verificacao; j++) {
+        fprintf(stderr, "%02x ", primeiros_bytes[j]);
+    }
+    fprintf(stderr, "\n");
+    
+    fclose(verificacao);
+}
+
+// Escreve um membro pequeno pela fila assíncrona: membros guardados sem
+// compressão (e os embutidos) saem direto do mapa, os comprimidos são descomprimidos no
+// buffer registrado da vaga
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int enfileira_membro(struct FilaEscrita *fila, const struct Membro *m, const unsigned char *dados) {
+    uint64_t relogio = metricas_relogio();
+    int erro;
+    if (!m->comprimido || m->comprimido == MEMBRO_EMBUTIDO) {
+        if (confere_soma(m, soma_dados(dados, m->tam_disco)) != 0)
+            return 1;
+        erro = fila_escreve(fila, m->nome, dados, m->tam_disco);
+        metricas_fase(FASE_ESCRITA, relogio);
+        return erro;
+    }
+
+    // Obter a vaga pode concluir o lote anterior
+    unsigned char *buffer = fila_buffer(fila);
+    metricas_fase(FASE_ESCRITA, relogio);
+    if (!buffer)
+        return 1;
+
+    // O segmento sólido descomprimido é reaproveitado: copia o trecho do membro
+    if (m->comprimido == MEMBRO_SOLIDO) {
+        memcpy(buffer, dados, m->tam_orig);
+    } else {
+        relogio = metricas_relogio();
+        erro = descomprime_buffer(dados, m->tam_disco, buffer, TAM_BUFFER_FILA);
+        metricas_fase(FASE_DESCOMPRESSAO, relogio);
+        if (erro)
+            return 1;
+    }
+    if (confere_soma(m, soma_dados(buffer, m->tam_orig)) != 0)
+        return 1;
+
+    relogio = metricas_relogio();
+    erro = fila_escreve(fila, m->nome, buffer, m->tam_orig);
+    metricas_fase(FASE_ESCRITA, relogio);
+    return erro;
+}
+
+// Escreve um membro de forma síncrona, em fluxo. Se 'dados' está em 'mapa'
+// (pode ser NULL), a escrita é feita por janelas, descartando as páginas de
+// cada uma depois de escrita.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int escreve_membro(struct Arena *arena, const struct Membro *m, const unsigned char *dados,
+                          const struct Mapa *mapa) {
+    uint64_t relogio = metricas_relogio();
+    FILE *saida = fopen(m->nome, "wb");
+    if (!saida) {
+        fprintf(stderr, "Erro ao criar arquivo de saída: %s\n", m->nome);
+        return 1;
+    }
+
+    // Comprimidos são descomprimidos bloco a bloco; os demais são
+    // escritos direto do mapa (ou do segmento sólido já descomprimido, ou do
+    // diretório, se embutidos)
+    // (descomprime_membro separa o próprio tempo de descompressão e escrita)
+    struct Soma soma;
+    soma_inicia(&soma);
+    int erro;
+    if (m->comprimido == MEMBRO_SOLIDO || m->comprimido == MEMBRO_EMBUTIDO) {
+        soma_acrescenta(&soma, dados, m->tam_orig);
+        erro = fwrite(dados, 1, m->tam_orig, saida) != m->tam_orig;
+    } else if (m->comprimido) {
+        metricas_fase(FASE_ESCRITA, relogio);
+        erro = descomprime_membro(arena, dados, m->tam_disco, saida, mapa, &soma);
+        relogio = metricas_relogio();
+    } else {
+        uint64_t janela = limita_parcela(JANELA_EXTRACAO, TAM_BLOCO);
+        erro = 0;
+        for (uint64_t pos = 0; !erro && pos < m->tam_disco; pos += janela) {
+            size_t n = m->tam_disco - pos < janela ? m->tam_disco - pos : janela;
+            soma_acrescenta(&soma, dados + pos, n);
+            erro = fwrite(dados + pos, 1, n, saida) != n;
+            if (mapa)
+                aconselha_intervalo(mapa, dados - mapa->dados + pos, n, MADV_DONTNEED);
+        }
+    }
+
+    if (fclose(saida) != 0)
+        erro = 1;
+    metricas_fase(FASE_ESCRITA, relogio);
+
+    if (erro) {
+        fprintf(stderr, "Erro ao escrever dados no arquivo %s\n", m->nome);
+        return 1;
+    }
+    if (confere_soma(m, soma_final(&soma)) != 0)
+        return 1;
+
+    if (opcoes.verificar)
+        mostra_primeiros_bytes(m->nome);
+    return 0;
+}
+
+// Escreve um membro delta, reconstruído bloco a bloco a partir da cadeia de
+// versões base
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int escreve_delta(const struct Versoes *vs, const struct Membro *m) {
+    struct Leitor *leitor = leitor_abre(vs, m, 0);
+    if (!leitor)
+        return 1;
+
+    FILE *saida = fopen(m->nome, "wb");
+    if (!saida) {
+        fprintf(stderr, "Erro ao criar arquivo de saída: %s\n", m->nome);
+        leitor_fecha(leitor);
+        return 1;
+    }
+
+    struct Soma soma;
+    soma_inicia(&soma);
+    uint64_t escritos = 0;
+    int erro = 0;
+    const unsigned char *dados;
+    size_t n;
+    while ((n = leitor_le(leitor, &dados)) > 0) {
+        soma_acrescenta(&soma, dados, n);
+        uint64_t relogio = metricas_relogio();
+        if (fwrite(dados, 1, n, saida) != n) {
+            erro = 1;
+            break;
+        }
+        metricas_fase(FASE_ESCRITA, relogio);
+        escritos += n;
+    }
+    if (leitor->erro || escritos != m->tam_orig)
+        erro = 1;
+    leitor_fecha(leitor);
+
+    if (fclose(saida) != 0)
+        erro = 1;
+    if (erro) {
+        fprintf(stderr, "Erro ao escrever dados no arquivo %s\n", m->nome);
+        return 1;
+    }
+    if (confere_soma(m, soma_final(&soma)) != 0)
+        return 1;
+
+    if (opcoes.verificar)
+        mostra_primeiros_bytes(m->nome);
+    return 0;
+}
+
+// Último segmento sólido descomprimido. Membros do mesmo segmento têm o
+// mesmo offset e, na extração em ordem de offset, vêm em seguida.
+struct Segmento {
+    int64_t offset;          // Offset do segmento no archive (-1 se vazio)
+    uint32_t tam;            // Bytes descomprimidos
+    unsigned char *dados;    // TAM_BLOCO bytes
+};
+
+// Obtém o trecho do membro sólido 'm', descomprimindo o segmento se ele
+// ainda não está no cache
+// RETORNO: ponteiro para os dados do membro ou NULL se o segmento é inválido
+static const unsigned char *trecho_solido(struct Segmento *seg, const struct Membro *m,
+                                          const unsigned char *dados) {
+    if (seg->offset != m->offset) {
+        struct Bloco cab;
+        if (m->tam_disco < sizeof(struct Bloco))
+            return NULL;
+        memcpy(&cab, dados, sizeof(struct Bloco));
+        if (cab.tam_orig > TAM_BLOCO || cab.tam_disco > cab.tam_orig ||
+            cab.tam_disco > m->tam_disco - sizeof(struct Bloco))
+            return NULL;
+
+        // Até o fim da descompressão o cache não vale para segmento nenhum
+        seg->offset = -1;
+        uint64_t relogio = metricas_relogio();
+        if (cab.tam_disco == cab.tam_orig)
+            memcpy(seg->dados, dados + sizeof(struct Bloco), cab.tam_orig);
+        else if (LZ_Uncompress((unsigned char *)dados + sizeof(struct Bloco), seg->dados, cab.tam_disco,
+                               cab.tam_orig) != (int)cab.tam_orig)
+            return NULL;
+        metricas_fase(FASE_DESCOMPRESSAO, relogio);
+        metricas_bytes(m->tam_disco, 0);
+        seg->offset = m->offset;
+        seg->tam = cab.tam_orig;
+    }
+
+    if (m->pos_segmento > seg->tam || m->tam_orig > seg->tam - m->pos_segmento)
+        return NULL;
+    return seg->dados + m->pos_segmento;
+}
+
+// Membros escolhidos para extração, em um vetor que cresce conforme a seleção
+struct ListaSelecao {
+    struct Selecao *itens;
+    int quantidade;
+    int capacidade;
+    const struct Indice *ind;
+    size_t tam_archive;      // Para validar a posição dos dados
+    int64_t inicio_embutidos; // Posição da área de embutidos no archive
+};
+
+// Acrescenta o membro 'indice' à lista (usada com indice_seleciona)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int seleciona_membro(int indice, void *arg) {
+    struct ListaSelecao *lista = arg;
+    const struct Registro *reg = &lista->ind->registros[indice];
+    int64_t offset = reg->offset;
+
+    // Verifica se os dados do membro estão dentro do archive (ou da área de
+    // embutidos, se embutido); a posição guardada é a absoluta
+    if (reg->comprimido == MEMBRO_EMBUTIDO) {
+        if (reg->offset < 0 || (uint64_t)reg->offset > lista->ind->tam_embutidos ||
+            reg->tam_disco > lista->ind->tam_embutidos - reg->offset) {
+            fprintf(stderr, "Erro ao ler dados do membro %d: fora da área de embutidos\n", indice);
+            return 1;
+        }
+        offset += lista->inicio_embutidos;
+    } else if (reg->offset < 0 || (size_t)reg->offset > lista->tam_archive ||
+               reg->tam_disco > lista->tam_archive - (size_t)reg->offset) {
+        fprintf(stderr, "Erro ao ler dados do membro %d: offset %" PRId64 " fora do archive\n",
+                indice, reg->offset);
+        return 1;
+    }
+
+    if (lista->quantidade == lista->capacidade) {
+        int nova_capacidade = lista->capacidade ? lista->capacidade * 2 : 64;
+        struct Selecao *novos = realloc(lista->itens, nova_capacidade * sizeof(struct Selecao));
+        if (!novos)
+            return 1;
+        lista->itens = novos;
+        lista->capacidade = nova_capacidade;
+    }
+
+    lista->itens[lista->quantidade].offset = offset;
+    lista->itens[lista->quantidade].indice = indice;
+    lista->quantidade++;
+    return 0;
+}
+
+// Seleciona os membros pedidos (todos, se a lista está vazia). Cada nome,
+// diretório ou glob pedido é resolvido por uma faixa do índice ordenado.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int seleciona_lista(struct ListaSelecao *lista, const char **membros, int num_membros) {
+    int erro = 0;
+    if (membros && num_membros > 0) {
+        for (int i = 0; i < num_membros && !erro; i++) {
+            if (membros[i])
+                erro = indice_seleciona(lista->ind, membros[i], seleciona_membro, lista);
+        }
+    } else {
+        for (int i = 0; i < lista->ind->quantidade && !erro; i++)
+            erro = seleciona_membro(i, lista);
+    }
+    return erro;
+}
+
+// Lê exatamente 'tam' bytes do fluxo
+// RETORNO: 0 em caso de sucesso, 1 se o fluxo terminou antes ou houve erro
+static int le_fluxo(FILE *entrada, void *dados, size_t tam) {
+    uint64_t relogio = metricas_relogio();
+    if (tam > 0 && fread(dados, 1, tam, entrada) != tam) {
+        fprintf(stderr, "Erro: archive em fluxo truncado ou ilegível\n");
+        return 1;
+    }
+    metricas_fase(FASE_LEITURA, relogio);
+    return 0;
+}
+
+// O que percorre_fluxo faz com os membros
+enum ModoFluxo {
+    FLUXO_LISTAR,            // Lista o conteúdo
+    FLUXO_EXTRAIR,           // Escreve os membros pedidos
+    FLUXO_TESTAR             // Descomprime os membros pedidos e confere as somas do trailer
+};
+
+// Confere as somas dos membros testados de um archive em fluxo com as dos
+// registros do trailer, que vem logo depois do último membro ('somas' e
+// 'nomes' têm uma posição por membro; nome NULL se o membro não foi testado)
+// RETORNO: número de membros cuja soma não confere, -1 se o trailer não pôde ser lido
+static int confere_trailer(FILE *entrada, const uint64_t *somas, char **nomes, int quantidade) {
+    int erros = 0;
+    for (int i = 0; i < quantidade; i++) {
+        struct Registro reg;
+        if (le_fluxo(entrada, &reg, sizeof(reg)) != 0)
+            return -1;
+        if (nomes[i] && reg.soma != SOMA_DESCONHECIDA && reg.soma != somas[i]) {
+            fprintf(stderr, "Erro: o conteúdo de %s não confere com a soma guardada\n", nomes[i]);
+            erros++;
+        }
+    }
+    return erros;
+}
+
+// Percorre um archive em fluxo em uma única passada, do início ao fim dos
+// membros; o trailer só é lido no teste. Os membros pedidos (todos, se a
+// lista está vazia) são escritos (FLUXO_EXTRAIR) ou descomprimidos e
+// somados (FLUXO_TESTAR); FLUXO_LISTAR lista o conteúdo.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int percorre_fluxo(FILE *entrada, const char *archive, const char **membros,
+                          int num_membros, enum ModoFluxo modo) {
+    char magica[TAM_MAGICA_FLUXO];
+    if (le_fluxo(entrada, magica, TAM_MAGICA_FLUXO) != 0)
+        return 1;
+    if (memcmp(magica, MAGICA_FLUXO, TAM_MAGICA_FLUXO) != 0) {
+        fprintf(stderr, "Erro: %s não é um archive em fluxo\n", archive);
+        return 1;
+    }
+
+    unsigned char *comprimido = malloc(TAM_BLOCO_COMPRIMIDO);
+    unsigned char *bloco = malloc(TAM_BLOCO);
+    if (!comprimido || !bloco) {
+        fprintf(stderr, "Erro ao alocar memória para descompressão\n");
+        free(comprimido);
+        free(bloco);
+        return 1;
+    }
+
+    if (modo == FLUXO_LISTAR) {
+        printf("Conteúdo do archive '%s':\n", archive);
+        printf("Ordem | Nome | Tamanho Original | Tamanho Disco | UID | Data (timestamp)\n");
+        printf("--------------------------------------------------------------------------------\n");
+    }
+
+    // Soma e nome de cada membro pedido, conferidos no fim com o trailer
+    uint64_t *somas = NULL;
+    char **nomes = NULL;
+    int quantidade = 0;
+    int capacidade = 0;
+
+    char ultimo_dir[1024] = "";
+    int erro = 0;
+    for (int ordem = 0; !erro; ordem++) {
+        struct MembroFluxo cab;
+        char nome[1024];
+        if (le_fluxo(entrada, &cab, sizeof(cab)) != 0) {
+            erro = 1;
+            break;
+        }
+        if (cab.nome_tam == 0)
+            break;
+        if (cab.nome_tam >= sizeof(nome) || le_fluxo(entrada, nome, cab.nome_tam) != 0) {
+            erro = 1;
+            break;
+        }
+        nome[cab.nome_tam] = '\0';
+
+        int pedido = modo != FLUXO_LISTAR && deve_extrair(nome, membros, num_membros);
+        if (modo != FLUXO_LISTAR) {
+            if (quantidade == capacidade) {
+                int nova_capacidade = capacidade ? capacidade * 2 : 64;
+                uint64_t *novas_somas = realloc(somas, nova_capacidade * sizeof(uint64_t));
+                if (novas_somas)
+                    somas = novas_somas;
+                char **novos_nomes = realloc(nomes, nova_capacidade * sizeof(char *));
+                if (novos_nomes)
+                    nomes = novos_nomes;
+                if (!novas_somas || !novos_nomes) {
+                    erro = 1;
+                    break;
+                }
+                capacidade = nova_capacidade;
+            }
+            nomes[quantidade] = pedido ? strdup(nome) : NULL;
+            if (pedido && !nomes[quantidade]) {
+                erro = 1;
+                break;
+            }
+            quantidade++;
+        }
+
+        // Abre a saída se o membro foi pedido, recusando nomes que escapariam
+        // do diretório atual
+        FILE *saida = NULL;
+        if (pedido && modo == FLUXO_EXTRAIR) {
+            char nome_seguro[1024];
+            if (normaliza_nome(nome, nome_seguro, sizeof(nome_seguro)) != 0 ||
+                strcmp(nome_seguro, nome) != 0) {
+                fprintf(stderr, "Nome de membro inválido: %s\n", nome);
+                erro = 1;
+                break;
+            }
+            if (cria_diretorios_pai(nome, ultimo_dir, sizeof(ultimo_dir)) != 0) {
+                erro = 1;
+                break;
+            }
+            saida = fopen(nome, "wb");
+            if (!saida) {
+                fprintf(stderr, "Erro ao criar arquivo de saída: %s\n", nome);
+                erro = 1;
+                break;
+            }
+        }
+
+        // Lê os blocos até o bloco vazio; membros não pedidos são descartados
+        uint64_t relogio = metricas_relogio();
+        uint64_t tam_orig = 0;
+        uint64_t tam_disco = sizeof(struct Bloco);
+        struct Soma soma;
+        soma_inicia(&soma);
+        int buraco_no_fim = 0;
+        for (;;) {
+            struct Bloco b;
+            if (le_fluxo(entrada, &b, sizeof(b)) != 0) {
+                erro = 1;
+                break;
+            }
+            if (b.tam_orig == 0)
+                break;
+            if (b.tam_orig > TAM_BLOCO || b.tam_disco > b.tam_orig) {
+                fprintf(stderr, "Bloco inválido no membro %s\n", nome);
+                erro = 1;
+                break;
+            }
+            if (le_fluxo(entrada, comprimido, b.tam_disco) != 0) {
+                erro = 1;
+                break;
+            }
+
+            // Blocos de zeros viram buracos na saída
+            buraco_no_fim = b.tam_disco == 0;
+            if (pedido && buraco_no_fim) {
+                soma_zeros(&soma, b.tam_orig);
+                if (saida && pula_zeros(saida, b.tam_orig) != 0) {
+                    fprintf(stderr, "Erro ao escrever dados no arquivo %s\n", nome);
+                    erro = 1;
+                    break;
+                }
+            } else if (pedido) {
+                const unsigned char *dados = comprimido;
+                uint64_t inicio = metricas_relogio();
+                if (b.tam_disco < b.tam_orig) {
+                    if (LZ_Uncompress(comprimido, bloco, b.tam_disco, b.tam_orig) != (int)b.tam_orig) {
+                        fprintf(stderr, "Bloco inválido no membro %s\n", nome);
+                        erro = 1;
+                        break;
+                    }
+                    dados = bloco;
+                }
+                metricas_fase(FASE_DESCOMPRESSAO, inicio);
+                soma_acrescenta(&soma, dados, b.tam_orig);
+
+                inicio = metricas_relogio();
+                if (saida && fwrite(dados, 1, b.tam_orig, saida) != b.tam_orig) {
+                    fprintf(stderr, "Erro ao escrever dados no arquivo %s\n", nome);
+                    erro = 1;
+                    break;
+                }
+                metricas_fase(FASE_ESCRITA, inicio);
+            }
+
+            tam_orig += b.tam_orig;
+            tam_disco += sizeof(struct Bloco) + b.tam_disco;
+        }
+
+        if (saida) {
+            if (!erro && buraco_no_fim && fixa_tamanho(saida) != 0) {
+                fprintf(stderr, "Erro ao escrever dados no arquivo %s\n", nome);
+                erro = 1;
+            }
+            if (fclose(saida) != 0)
+                erro = 1;
+            if (!erro && opcoes.verificar)
+                mostra_primeiros_bytes(nome);
+        }
+        if (pedido) {
+            somas[quantidade - 1] = soma_final(&soma);
+            metricas_bytes(tam_disco, tam_orig);
+            metricas_membro(nome, tam_orig, tam_disco, relogio);
+        }
+
+        if (!erro && modo == FLUXO_LISTAR)
+            printf("%5d | %-12s | %15" PRIu64 " | %12" PRIu64 " | %4d | %" PRId64 "\n",
+                   ordem, nome, tam_orig, tam_disco, cab.uid, cab.data_modif);
+    }
+
+    // O trailer vem logo depois do último membro
+    if (!erro && modo != FLUXO_LISTAR) {
+        int erros = confere_trailer(entrada, somas, nomes, quantidade);
+        if (modo == FLUXO_TESTAR && erros >= 0) {
+            int testados = 0;
+            for (int i = 0; i < quantidade; i++)
+                testados += nomes[i] != NULL;
+            printf("%d membros testados, %d com erro\n", testados, erros);
+        }
+        erro = erros != 0;
+    }
+
+    for (int i = 0; i < quantidade; i++)
+        free(nomes[i]);
+    free(nomes);
+    free(somas);
+    free(comprimido);
+    free(bloco);
+    return erro;
+}
+
+// Abre um archive em fluxo ("-" é a entrada padrão) e o percorre
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int abre_fluxo(const char *archive, const char **membros, int num_membros, enum ModoFluxo modo) {
+    if (strcmp(archive, "-") == 0)
+        return percorre_fluxo(stdin, "-", membros, num_membros, modo);
+
+    FILE *entrada = fopen(archive, "rb");
+    if (!entrada) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+        return 1;
+    }
+    posix_fadvise(fileno(entrada), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int erro = percorre_fluxo(entrada, archive, membros, num_membros, modo);
+    fclose(entrada);
+    return erro;
+}
+
+int extrair_membros(const char *archive, const char **membros, int num_membros) {
+
+    // Archives em fluxo são lidos em uma passada, sem o índice
+    if (archive_em_fluxo(archive))
+        return abre_fluxo(archive, membros, num_membros, FLUXO_EXTRAIR);
+    
+    // Abre o arquivo archive
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+        return 1;
+    }
+
+    // Mapeia o archive inteiro: diretório e dados são lidos direto do mapa
+    struct Mapa mapa;
+    if (mapeia_arquivo(fd, &mapa) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    // Abre o índice no próprio mapa; registros são lidos só quando usados
+    struct Indice ind;
+    if (indice_abre(&ind, mapa.dados, mapa.tam) != 0) {
+        fprintf(stderr, "Erro ao ler diretório\n");
+        desmapeia_arquivo(&mapa);
+        close(fd);
+        return 1;
+    }
+
+    // Seleciona os membros pedidos (todos, se a lista está vazia)
+    struct ListaSelecao lista = { NULL, 0, 0, &ind, mapa.tam, ind.embutidos - mapa.dados };
+    if (seleciona_lista(&lista, membros, num_membros) != 0) {
+        free(lista.itens);
+        desmapeia_arquivo(&mapa);
+        close(fd);
+        return 1;
+    }
+
+    struct Selecao *selecionados = lista.itens;
+    int num_selecionados = lista.quantidade;
+
+    // Depois de -m a ordem do diretório não é a ordem física: extrai pela
+    // posição dos dados, para que a leitura do archive seja sequencial
+    qsort(selecionados, num_selecionados, sizeof(struct Selecao), compara_offset);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    aconselha_intervalo(&mapa, 0, mapa.tam, MADV_SEQUENTIAL);
+
+    // Lê o próximo membro enquanto o atual é descomprimido e escrito
+    struct Antecipador *ant = antecipador_cria(&mapa, fd);
+    if (num_selecionados > 0)
+        antecipador_pede(ant, selecionados[0].offset,
+                         limita_parcela(ind.registros[selecionados[0].indice].tam_disco, 0));
+
+    // Fila assíncrona para membros pequenos (NULL se não houver io_uring),
+    // com tantas vagas quanto couberem no orçamento
+    struct FilaEscrita *fila = fila_cria(limita_parcela(PROFUNDIDADE_FILA * TAM_BUFFER_FILA, 0) /
+                                         TAM_BUFFER_FILA);
+    if (fila && opcoes.verificar)
+        fila_ao_concluir(fila, mostra_primeiros_bytes);
+
+    // Buffers temporários da extração e cache do segmento sólido atual
+    struct Arena *arena = arena_cria();
+    struct Segmento seg = { -1, 0, arena_obtem(arena, TAM_BLOCO) };
+    struct Versoes versoes = { fd, NULL, &ind };
+
+    // Extrai cada membro
+    char ultimo_dir[1024] = "";
+    int resultado = seg.dados == NULL;
+    for (int i = 0; i < num_selecionados && resultado == 0; i++) {
+
+        // Nomes repetidos na lista são extraídos uma vez só
+        if (i > 0 && selecionados[i].indice == selecionados[i - 1].indice)
+            continue;
+
+        uint64_t relogio = metricas_relogio();
+        struct Membro m;
+        char nome[TAM_NOME];
+        if (indice_membro(&ind, selecionados[i].indice, &m, nome) != 0) {
+            resultado = 1;
+            break;
+        }
+
+        if (i + 1 < num_selecionados)
+            antecipador_pede(ant, selecionados[i + 1].offset,
+                             limita_parcela(ind.registros[selecionados[i + 1].indice].tam_disco, 0));
+
+        // Recusa nomes que escapariam do diretório atual e cria os diretórios do membro
+        char nome_seguro[1024];
+        if (normaliza_nome(m.nome, nome_seguro, sizeof(nome_seguro)) != 0 ||
+            strcmp(nome_seguro, m.nome) != 0) {
+            fprintf(stderr, "Nome de membro inválido: %s\n", m.nome);
+            resultado = 1;
+            break;
+        }
+        if (cria_diretorios_pai(m.nome, ultimo_dir, sizeof(ultimo_dir)) != 0) {
+            resultado = 1;
+            break;
+        }
+
+        // Deltas são reconstruídos a partir das versões base
+        if (m.comprimido == MEMBRO_DELTA) {
+            resultado = escreve_delta(&versoes, &m);
+            metricas_bytes(m.tam_disco, m.tam_orig);
+            metricas_membro(m.nome, m.tam_orig, m.tam_disco, relogio);
+            continue;
+        }
+
+        // Membros sólidos são recortados do segmento descomprimido; os
+        // embutidos estão na área após os nomes
+        const unsigned char *dados = mapa.dados + selecionados[i].offset;
+        if (m.comprimido == MEMBRO_SOLIDO && !(dados = trecho_solido(&seg, &m, dados))) {
+            fprintf(stderr, "Segmento sólido inválido no membro %s\n", m.nome);
+            resultado = 1;
+            break;
+        }
+
+        // Membros pequenos vão em lote pela fila; os demais, em fluxo
+        if (fila && m.tam_orig <= TAM_BUFFER_FILA) {
+            resultado = enfileira_membro(fila, &m, dados);
+        } else {
+            int no_mapa = m.comprimido != MEMBRO_SOLIDO && m.comprimido != MEMBRO_EMBUTIDO;
+            resultado = escreve_membro(arena, &m, dados, no_mapa ? &mapa : NULL);
+        }
+
+        // As páginas já consumidas não serão mais usadas (as do diretório,
+        // sim)
+        if (m.comprimido != MEMBRO_EMBUTIDO)
+            aconselha_intervalo(&mapa, m.offset, m.tam_disco, MADV_DONTNEED);
+
+        // Os bytes lidos dos sólidos são contados por segmento
+        metricas_bytes(m.comprimido == MEMBRO_SOLIDO ? 0 : m.tam_disco, m.tam_orig);
+        metricas_membro(m.nome, m.tam_orig, m.tam_disco, relogio);
+    }
+
+    // Espera o último lote antes de desfazer o mapa
+    uint64_t relogio = metricas_relogio();
+    if (fila && fila_conclui(fila) != 0)
+        resultado = 1;
+    metricas_fase(FASE_ESCRITA, relogio);
+
+    // Limpeza
+    antecipador_destroi(ant);
+    fila_destroi(fila);
+    arena_destroi(arena);
+    free(selecionados);
+    desmapeia_arquivo(&mapa);
+    close(fd);
+    return resultado;
+}
+
+// Teste de integridade (-t). Os membros selecionados são percorridos na
+// ordem dos dados e divididos em tarefas: cada bloco de um membro
+// comprimido, cada trecho de até TAM_BLOCO bytes de um membro sem
+// compressão, cada segmento sólido (com todos os seus membros) e cada delta
+// ou embutido inteiro. As trabalhadoras pegam as tarefas em ordem e
+// decodificam cada uma em uma vaga; a thread principal soma as vagas na
+// mesma ordem, de modo que um membro grande é descomprimido por várias
+// threads e somado uma vez só. Tarefas que cobrem membros inteiros já são
+// conferidas pela própria trabalhadora.
+
+// Vagas de saída por trabalhadora, cada uma com TAM_BLOCO bytes
+#define VAGAS_TESTE 4
+
+// Trabalhadoras do teste quando não indicadas por --threads
+#define MAX_THREADS_TESTE 64
+
+// Memória de cada trabalhadora: as vagas e o leitor de um delta (janela
+// dupla e bloco comprimido)
+#define CUSTO_THREAD_TESTE ((VAGAS_TESTE + 3) * TAM_BLOCO)
+
+// Leitura antecipada pedida ao kernel à frente da distribuição das tarefas
+#define JANELA_TESTE (64 * 1024 * 1024)
+
+enum TipoTarefa {
+    TAREFA_BLOCO,            // Um bloco de membro comprimido
+    TAREFA_CRU,              // Um trecho de membro sem compressão
+    TAREFA_SOLIDO,           // Um segmento sólido e seus membros
+    TAREFA_DELTA,            // Um membro delta, reconstruído pelas bases
+    TAREFA_EMBUTIDO,         // Um membro embutido no diretório
+    TAREFA_INVALIDA          // Cabeçalho de bloco inválido: o membro termina aqui
+};
+
+// Uma tarefa e o seu resultado
+struct VagaTeste {
+    uint64_t tarefa;         // Número da tarefa (ordem de distribuição)
+    int pronta;              // Resultado disponível para a thread principal
+    enum TipoTarefa tipo;
+    int item;                // Primeiro membro (posição na seleção)
+    int num_itens;           // Membros cobertos (mais de um só no segmento sólido)
+    int inicio;              // Primeiro trecho do membro
+    int fim;                 // Último trecho do membro
+    uint64_t pos;            // Posição do trecho nos dados do membro
+    struct Bloco cab;        // Cabeçalho do bloco (TAREFA_BLOCO)
+    int erros;               // Membros com erro (mensagem já mostrada)
+    int conferido;           // Membros inteiros: a trabalhadora já conferiu a soma
+    unsigned char *dados;    // TAM_BLOCO bytes
+    const unsigned char *trecho; // Conteúdo decodificado (em 'dados' ou no diretório; NULL se zeros)
+    size_t tam;
+};
+
+struct Teste {
+    const struct Indice *ind;
+    const struct Mapa *mapa;
+    struct Versoes versoes;
+    const struct Selecao *itens;
+    int num_itens;
+    struct VagaTeste *vagas;
+    int num_vagas;
+
+    // Distribuição das tarefas, protegida por 'trava'
+    pthread_mutex_t trava;
+    pthread_cond_t mudou;
+    int item;                // Membro sendo dividido em tarefas
+    uint64_t pos;            // Próxima posição nos dados dele
+    uint64_t proxima;        // Número da próxima tarefa
+    uint64_t consumidas;     // Tarefas já somadas pela thread principal
+    uint64_t antecipado;     // Até onde a leitura antecipada foi pedida
+    int acabou;              // Não há mais tarefas
+};
+
+// Prepara a próxima tarefa em 'v' e avança a distribuição (com a trava)
+// RETORNO: 0 se há tarefa, 1 se todos os membros já foram distribuídos
+static int teste_distribui(struct Teste *t, struct VagaTeste *v) {
+    if (t->item >= t->num_itens)
+        return 1;
+
+    const struct Registro *reg = &t->ind->registros[t->itens[t->item].indice];
+    const unsigned char *dados = t->mapa->dados + t->itens[t->item].offset;
+    v->item = t->item;
+    v->num_itens = 1;
+    v->inicio = t->pos == 0;
+    v->fim = 1;
+    v->pos = t->pos;
+
+    if (reg->comprimido == MEMBRO_SOLIDO) {
+        // Os membros do segmento são vizinhos na seleção
+        v->tipo = TAREFA_SOLIDO;
+        while (t->item + v->num_itens < t->num_itens &&
+               t->itens[t->item + v->num_itens].offset == t->itens[t->item].offset)
+            v->num_itens++;
+    } else if (reg->comprimido == MEMBRO_DELTA || reg->comprimido == MEMBRO_EMBUTIDO) {
+        v->tipo = reg->comprimido == MEMBRO_DELTA ? TAREFA_DELTA : TAREFA_EMBUTIDO;
+    } else if (reg->comprimido == 0 || reg->tam_disco == 0) {
+        v->tipo = TAREFA_CRU;
+        t->pos += reg->tam_disco - t->pos < TAM_BLOCO ? reg->tam_disco - t->pos : TAM_BLOCO;
+        v->fim = t->pos >= reg->tam_disco;
     } else {
-        return path;  // Não há '/' no caminho
+        // O cabeçalho é lido aqui para saber onde começa o próximo bloco
+        v->tipo = TAREFA_INVALIDA;
+        if (reg->tam_disco - t->pos >= sizeof(struct Bloco)) {
+            memcpy(&v->cab, dados + t->pos, sizeof(struct Bloco));
+            uint64_t resto = reg->tam_disco - t->pos - sizeof(struct Bloco);
+            if (v->cab.tam_orig <= TAM_BLOCO && v->cab.tam_disco <= v->cab.tam_orig &&
+                v->cab.tam_disco <= resto) {
+                v->tipo = TAREFA_BLOCO;
+                t->pos += sizeof(struct Bloco) + v->cab.tam_disco;
+                v->fim = t->pos >= reg->tam_disco;
+            }
+        }
+    }
+
+    // Pede ao kernel a leitura da próxima janela antes que as trabalhadoras
+    // cheguem nela
+    if (reg->comprimido != MEMBRO_EMBUTIDO) {
+        uint64_t chegou = t->itens[t->item].offset + t->pos;
+        if (chegou + JANELA_TESTE / 2 > t->antecipado) {
+            uint64_t inicio = chegou > t->antecipado ? chegou : t->antecipado;
+            aconselha_intervalo(t->mapa, inicio, chegou + JANELA_TESTE - inicio, MADV_WILLNEED);
+            t->antecipado = chegou + JANELA_TESTE;
+        }
+    }
+
+    if (v->fim) {
+        t->item += v->num_itens;
+        t->pos = 0;
+    }
+    v->tarefa = t->proxima++;
+    return 0;
+}
+
+// Decodifica a tarefa da vaga 'v'; membros inteiros são conferidos aqui
+static void teste_executa(struct Teste *t, struct VagaTeste *v) {
+    v->erros = 0;
+    v->conferido = v->inicio && v->fim;
+    v->trecho = v->dados;
+    v->tam = 0;
+
+    struct Membro m;
+    char nome[TAM_NOME];
+    if (indice_membro(t->ind, t->itens[v->item].indice, &m, nome) != 0) {
+        v->erros = v->num_itens;
+        v->conferido = 1;
+        return;
+    }
+    const unsigned char *dados = t->mapa->dados + t->itens[v->item].offset;
+
+    uint64_t relogio = metricas_relogio();
+    switch (v->tipo) {
+    case TAREFA_BLOCO:
+        v->tam = v->cab.tam_orig;
+        if (v->cab.tam_disco == 0) {
+            v->trecho = NULL;
+        } else if (v->cab.tam_disco == v->cab.tam_orig) {
+            memcpy(v->dados, dados + v->pos + sizeof(struct Bloco), v->tam);
+        } else if (LZ_Uncompress((unsigned char *)dados + v->pos + sizeof(struct Bloco), v->dados,
+                                 v->cab.tam_disco, v->cab.tam_orig) != (int)v->cab.tam_orig) {
+            fprintf(stderr, "Bloco inválido no membro %s\n", m.nome);
+            v->erros = 1;
+        }
+        aconselha_intervalo(t->mapa, m.offset + v->pos, sizeof(struct Bloco) + v->cab.tam_disco,
+                            MADV_DONTNEED);
+        break;
+
+    case TAREFA_CRU:
+        v->tam = m.tam_disco - v->pos < TAM_BLOCO ? m.tam_disco - v->pos : TAM_BLOCO;
+        memcpy(v->dados, dados + v->pos, v->tam);
+        aconselha_intervalo(t->mapa, m.offset + v->pos, v->tam, MADV_DONTNEED);
+        break;
+
+    case TAREFA_EMBUTIDO:
+        v->trecho = dados;
+        v->tam = m.tam_orig;
+        break;
+
+    case TAREFA_INVALIDA:
+        fprintf(stderr, "Bloco inválido no membro %s\n", m.nome);
+        v->erros = 1;
+        break;
+
+    case TAREFA_SOLIDO: {
+        // O segmento é descomprimido uma vez, na vaga, e cada membro é
+        // conferido no seu trecho
+        struct Segmento seg = { -1, 0, v->dados };
+        for (int i = 0; i < v->num_itens; i++) {
+            struct Membro mi;
+            char nome_i[TAM_NOME];
+            const unsigned char *trecho = NULL;
+            if (indice_membro(t->ind, t->itens[v->item + i].indice, &mi, nome_i) == 0 &&
+                !(trecho = trecho_solido(&seg, &mi, dados)))
+                fprintf(stderr, "Segmento sólido inválido no membro %s\n", mi.nome);
+            if (!trecho || confere_soma(&mi, soma_dados(trecho, mi.tam_orig)) != 0)
+                v->erros++;
+        }
+        aconselha_intervalo(t->mapa, m.offset, m.tam_disco, MADV_DONTNEED);
+        metricas_fase(FASE_DESCOMPRESSAO, relogio);
+        return;
+    }
+
+    case TAREFA_DELTA: {
+        // Reconstruído pela cadeia de bases (que o leitor lê com pread)
+        struct Leitor *leitor = leitor_abre(&t->versoes, &m, 0);
+        struct Soma soma;
+        soma_inicia(&soma);
+        uint64_t lidos = 0;
+        const unsigned char *pedaco;
+        size_t n;
+        while (leitor && (n = leitor_le(leitor, &pedaco)) > 0) {
+            soma_acrescenta(&soma, pedaco, n);
+            lidos += n;
+        }
+        if (!leitor || leitor->erro || lidos != m.tam_orig)
+            fprintf(stderr, "Erro ao ler o membro %s\n", m.nome);
+        v->erros = !leitor || leitor->erro || lidos != m.tam_orig ||
+                   confere_soma(&m, soma_final(&soma)) != 0;
+        leitor_fecha(leitor);
+        return;
+    }
+    }
+    metricas_fase(FASE_DESCOMPRESSAO, relogio);
+
+    if (v->conferido && !v->erros) {
+        struct Soma soma;
+        soma_inicia(&soma);
+        if (v->trecho)
+            soma_acrescenta(&soma, v->trecho, v->tam);
+        else
+            soma_zeros(&soma, v->tam);
+        v->erros = confere_soma(&m, soma_final(&soma));
     }
 }
 
+// Laço de uma trabalhadora: pega a próxima tarefa quando há vaga livre
+static void *teste_trabalhadora(void *arg) {
+    struct Teste *t = arg;
+    pthread_mutex_lock(&t->trava);
+    for (;;) {
+        while (!t->acabou && t->proxima - t->consumidas >= (uint64_t)t->num_vagas)
+            pthread_cond_wait(&t->mudou, &t->trava);
+        if (t->acabou)
+            break;
+
+        struct VagaTeste *v = &t->vagas[t->proxima % t->num_vagas];
+        if (teste_distribui(t, v) != 0) {
+            t->acabou = 1;
+            pthread_cond_broadcast(&t->mudou);
+            break;
+        }
+        pthread_mutex_unlock(&t->trava);
 
-unsigned char *le_arquivo(const char *nome_arq, unsigned int *tam) {
+        teste_executa(t, v);
 
-    // Abre o arquivo
-    FILE *arquivo = fopen(nome_arq, "rb");
+        pthread_mutex_lock(&t->trava);
+        v->pronta = 1;
+        pthread_cond_broadcast(&t->mudou);
+    }
+    pthread_mutex_unlock(&t->trava);
+    return NULL;
+}
 
-    //Verifica caso de erro:
-    if (!arquivo) {
-        fprintf(stderr, "Erro ao abrir arquivo: %s\n", nome_arq);
-        return NULL;
+// Escolhe quantas trabalhadoras testam o archive
+// RETORNO: quantidade de threads (pelo menos uma)
+static int threads_teste(void) {
+    int num_threads = opcoes.threads;
+    if (num_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus < 1 ? 1 : cpus > MAX_THREADS_TESTE ? MAX_THREADS_TESTE : cpus;
     }
 
-    // Determina o tamanho do arquivo
-    if (fseek(arquivo, 0, SEEK_END) != 0) {
-        fprintf(stderr, "Erro ao posicionar no final do arquivo: %s\n", nome_arq);
-        fclose(arquivo);
-        return NULL;
+    // Sob um orçamento, só as threads que cabem nele
+    int cabem = limita_parcela((uint64_t)num_threads * CUSTO_THREAD_TESTE, CUSTO_THREAD_TESTE) /
+                CUSTO_THREAD_TESTE;
+    return num_threads > cabem ? cabem : num_threads;
+}
+
+// Soma, na ordem, os resultados das tarefas e confere os membros que
+// ocuparam mais de uma tarefa
+// RETORNO: número de membros com erro
+static int teste_consome(struct Teste *t, int *testados) {
+    struct Soma soma;
+    int falhou = 0;
+    int erros = 0;
+    uint64_t relogio = 0;
+
+    for (uint64_t n = 0;; n++) {
+        struct VagaTeste *v = &t->vagas[n % t->num_vagas];
+        pthread_mutex_lock(&t->trava);
+        while (!(v->pronta && v->tarefa == n) && !(t->acabou && t->proxima == n))
+            pthread_cond_wait(&t->mudou, &t->trava);
+        int acabou = !(v->pronta && v->tarefa == n);
+        pthread_mutex_unlock(&t->trava);
+        if (acabou)
+            break;
+
+        if (v->inicio) {
+            soma_inicia(&soma);
+            falhou = 0;
+            relogio = metricas_relogio();
+        }
+        if (v->conferido)
+            falhou = v->erros;
+        else if (v->erros)
+            falhou = 1;
+        else if (!falhou && v->trecho)
+            soma_acrescenta(&soma, v->trecho, v->tam);
+        else if (!falhou)
+            soma_zeros(&soma, v->tam);
+
+        // No último trecho, o membro (ou os do segmento) está pronto
+        for (int i = 0; v->fim && i < v->num_itens; i++) {
+            struct Membro m;
+            char nome[TAM_NOME];
+            if (indice_membro(t->ind, t->itens[v->item + i].indice, &m, nome) != 0)
+                continue;
+            if (!v->conferido && !falhou)
+                falhou = confere_soma(&m, soma_final(&soma));
+            metricas_bytes(m.comprimido == MEMBRO_SOLIDO ? 0 : m.tam_disco, m.tam_orig);
+            metricas_membro(m.nome, m.tam_orig, m.tam_disco, relogio);
+        }
+        if (v->fim) {
+            *testados += v->num_itens;
+            erros += v->conferido ? v->erros : falhou;
+        }
+
+        pthread_mutex_lock(&t->trava);
+        v->pronta = 0;
+        t->consumidas = n + 1;
+        pthread_cond_broadcast(&t->mudou);
+        pthread_mutex_unlock(&t->trava);
+    }
+    return erros;
+}
+
+int testar_membros(const char *archive, const char **membros, int num_membros) {
+
+    // Archives em fluxo são testados em uma passada, com as somas do trailer
+    if (archive_em_fluxo(archive))
+        return abre_fluxo(archive, membros, num_membros, FLUXO_TESTAR);
+
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+        return 1;
+    }
+    struct Mapa mapa;
+    if (mapeia_arquivo(fd, &mapa) != 0) {
+        close(fd);
+        return 1;
+    }
+    struct Indice ind;
+    if (indice_abre(&ind, mapa.dados, mapa.tam) != 0) {
+        fprintf(stderr, "Erro ao ler diretório\n");
+        desmapeia_arquivo(&mapa);
+        close(fd);
+        return 1;
+    }
+
+    // Seleciona os membros na ordem dos dados, sem repetições
+    struct ListaSelecao lista = { NULL, 0, 0, &ind, mapa.tam, ind.embutidos - mapa.dados };
+    if (seleciona_lista(&lista, membros, num_membros) != 0) {
+        free(lista.itens);
+        desmapeia_arquivo(&mapa);
+        close(fd);
+        return 1;
+    }
+    qsort(lista.itens, lista.quantidade, sizeof(struct Selecao), compara_offset);
+    int num_itens = 0;
+    for (int i = 0; i < lista.quantidade; i++)
+        if (i == 0 || lista.itens[i].indice != lista.itens[i - 1].indice)
+            lista.itens[num_itens++] = lista.itens[i];
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    aconselha_intervalo(&mapa, 0, mapa.tam, MADV_SEQUENTIAL);
+
+    int num_threads = threads_teste();
+    struct Teste t = { &ind, &mapa, { fd, NULL, &ind }, lista.itens, num_itens, NULL,
+                       num_threads * VAGAS_TESTE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                       0, 0, 0, 0, 0, 0 };
+    t.vagas = calloc(t.num_vagas, sizeof(struct VagaTeste));
+    unsigned char *buffers = malloc((size_t)t.num_vagas * TAM_BLOCO);
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (!t.vagas || !buffers || !threads) {
+        fprintf(stderr, "Erro ao alocar memória para o teste\n");
+        free(t.vagas);
+        free(buffers);
+        free(threads);
+        free(lista.itens);
+        desmapeia_arquivo(&mapa);
+        close(fd);
+        return 1;
+    }
+    for (int i = 0; i < t.num_vagas; i++)
+        t.vagas[i].dados = buffers + (size_t)i * TAM_BLOCO;
+
+    // Sem threads criadas o teste não anda: a falha é tratada como o fim
+    // da distribuição
+    int criadas = 0;
+    while (criadas < num_threads &&
+           pthread_create(&threads[criadas], NULL, teste_trabalhadora, &t) == 0)
+        criadas++;
+    int testados = 0;
+    int erros;
+    if (criadas == 0) {
+        fprintf(stderr, "Erro ao criar as threads do teste\n");
+        erros = -1;
+    } else {
+        erros = teste_consome(&t, &testados);
+    }
+    for (int i = 0; i < criadas; i++)
+        pthread_join(threads[i], NULL);
+
+    if (erros >= 0)
+        printf("%d membros testados, %d com erro\n", testados, erros);
+
+    pthread_mutex_destroy(&t.trava);
+    pthread_cond_destroy(&t.mudou);
+    free(threads);
+    free(buffers);
+    free(t.vagas);
+    free(lista.itens);
+    desmapeia_arquivo(&mapa);
+    close(fd);
+    return erros != 0;
+}
+
+// Abre o archive para alteração, com a trava de escritor (ver trava_arquivo),
+// que fica com o arquivo até o fclose
+// RETORNO: o arquivo aberto ou NULL em caso de erro
+static FILE *abre_travado(const char *archive) {
+    int fd = trava_arquivo(archive, NULL);
+    FILE *arq = fd < 0 ? NULL : fdopen(fd, "rb+");
+    if (!arq) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+        if (fd >= 0)
+            close(fd);
+    }
+    return arq;
+}
+
+// Publica o diretório alterado por -r ou -m. Se o espaço sem uso passou do
+// limite (ver cabe_no_lugar), o archive é reescrito por inteiro no lugar disso.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int publica_alteracao(const char *archive, FILE *arq, struct Diretorio *dir) {
+    struct Arena *arena = arena_cria();
+    int *dono = donos_segmentos(arena, dir, NULL);
+    int64_t tam_dir = tamanho_diretorio(dir);
+    int64_t fim = fim_dados(dir);
+
+    int erro;
+    if (!dono || tam_dir < 0 || fim < 0)
+        erro = 1;
+    else if (cabe_no_lugar(dir, NULL, dono, tam_dir, fim))
+        erro = publica_diretorio(arq, dir);
+    else
+        erro = reescreve_archive(arena, archive, arq, dir, dono);
+
+    arena_destroi(arena);
+    return erro;
+}
+
+int remover_membros(const char *archive, const char **membros, int num_membros) {
+    if (!archive || !membros || num_membros <= 0) return 1;
+    if (archive_em_fluxo(archive)) {
+        fprintf(stderr, "Erro: %s está no formato em fluxo e não pode ser alterado\n", archive);
+        return 1;
+    }
+
+    // Abre o arquivo archive, excluindo outros escritores
+    FILE *arq = abre_travado(archive);
+    if (!arq) return 1;
+
+    // Lê o diretório
+    struct Diretorio *dir = le_diretorio(arq);
+    if (!dir) {
+        fclose(arq);
+        return 1;
+    }
+
+    // Marca cada membro solicitado
+    char *remover = calloc(dir->quantidade ? dir->quantidade : 1, 1);
+    if (!remover) {
+        destroi_diretorio(dir);
+        fclose(arq);
+        return 1;
+    }
+    int removidos = 0;
+    for (int i = 0; i < num_membros; i++) {
+        uint64_t relogio = metricas_relogio();
+        int idx = busca_membro(membros[i], dir->membros, dir->quantidade);
+        if (idx != -1 && !remover[idx]) {
+            remover[idx] = 1;
+            removidos++;
+            metricas_membro(dir->membros[idx].nome, dir->membros[idx].tam_orig,
+                            dir->membros[idx].tam_disco, relogio);
+        }
+    }
+
+    // Versões base de deltas que ficam não podem sair sozinhas
+    int erro = removidos > 0 && confere_bases(dir, remover) != 0;
+
+    // Remove os marcados (de trás para frente, para os índices valerem) e
+    // publica o diretório atualizado
+    if (!erro && removidos > 0) {
+        for (int i = dir->quantidade - 1; i >= 0; i--)
+            if (remover[i])
+                remove_membro(dir, i);
+        erro = publica_alteracao(archive, arq, dir);
+    }
+    free(remover);
+
+    // Limpeza
+    destroi_diretorio(dir);
+    fclose(arq);
+    return erro;
+}
+
+int listar_conteudo(const char *archive) {
+    if (archive_em_fluxo(archive))
+        return abre_fluxo(archive, NULL, 0, FLUXO_LISTAR);
+
+    // Abre e mapeia o archive
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0) return 1;
+
+    struct Mapa mapa;
+    if (mapeia_arquivo(fd, &mapa) != 0) {
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    // Abre o índice: só o cabeçalho é lido agora
+    struct Indice ind;
+    if (indice_abre(&ind, mapa.dados, mapa.tam) != 0) {
+        desmapeia_arquivo(&mapa);
+        return 1;
+    }
+
+    // Imprime cabeçalho
+    printf("Conteúdo do archive '%s':\n", archive);
+    printf("Ordem | Nome | Tamanho Original | Tamanho Disco | UID | Data (timestamp)\n");
+    printf("--------------------------------------------------------------------------------\n");
+
+    // Lista cada membro à medida que os registros são lidos
+    aconselha_intervalo(&mapa, 0, mapa.tam, MADV_SEQUENTIAL);
+    for (int i = 0; i < ind.quantidade; i++) {
+        struct Membro m;
+        char nome[TAM_NOME];
+        if (indice_membro(&ind, i, &m, nome) != 0) {
+            desmapeia_arquivo(&mapa);
+            return 1;
+        }
+        printf("%5d | %-12s | %15" PRIu64 " | %12" PRIu64 " | %4d | %ld\n",
+               i, m.nome, m.tam_orig, m.tam_disco, m.uid, m.data_modif);
+    }
+
+    // Limpeza
+    desmapeia_arquivo(&mapa);
+    return 0;
+}
+
+// Copia os dados dos membros [inicio, dir->quantidade) para as posições em
+// 'destino' (mesmo arquivo, intervalos sem sobreposição) e atualiza os
+// offsets. Segmentos sólidos são copiados uma vez só, pelo dono.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int copia_membros(int fd, struct Diretorio *dir, const int *dono, int inicio,
+                         const int64_t *destino) {
+    uint64_t relogio = metricas_relogio();
+    for (int i = inicio; i < dir->quantidade; i++) {
+        struct Membro *m = &dir->membros[i];
+        if (!tem_dados(m) || dono[i] != i)
+            continue;
+        if (copia_intervalo(fd, m->offset, fd, destino[i], m->tam_disco) != 0) {
+            fprintf(stderr, "Erro ao mover os dados do membro %s\n", m->nome);
+            return 1;
+        }
+    }
+    metricas_fase(FASE_COPIA, relogio);
+    for (int i = inicio; i < dir->quantidade; i++)
+        if (tem_dados(&dir->membros[i]))
+            dir->membros[i].offset = destino[i];
+    return 0;
+}
+
+// Rearruma os dados para seguirem a ordem do diretório, para que extrair tudo
+// volte a ser uma leitura sequencial. O maior prefixo cujos dados já estão em
+// ordem crescente de offset (mesmo com espaço sem uso entre eles) não é
+// tocado. O restante é copiado, em ordem, para depois do fim dos dados e uma
+// geração nova do diretório é publicada. Os dados antigos não são
+// sobrescritos (leitores das gerações anteriores ainda podem usá-los); se com
+// a cópia o espaço sem uso passaria do limite (ver cabe_no_lugar), o archive
+// é reescrito por inteiro, já na ordem nova.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int reordena_dados(const char *archive, FILE *arq, struct Diretorio *dir) {
+    struct Arena *arena = arena_cria();
+    int64_t *cauda = arena_obtem(arena, (dir->quantidade + 1) * sizeof(int64_t));
+    int *dono = donos_segmentos(arena, dir, NULL);
+    int64_t tam_dir = tamanho_diretorio(dir);
+    int64_t fim_antigo = fim_dados(dir);
+    if (!cauda || !dono || tam_dir < 0 || fim_antigo < 0) {
+        arena_destroi(arena);
+        return 1;
+    }
+
+    // O prefixo vai até o primeiro membro que começa antes do fim do anterior
+    int64_t fim_ordem = 0;
+    int prefixo = -1;
+    for (int i = 0; i < dir->quantidade && prefixo == -1; i++) {
+        struct Membro *m = &dir->membros[i];
+        if (!tem_dados(m) || dono[i] != i)
+            continue;
+        if (m->offset < fim_ordem)
+            prefixo = i;
+        else
+            fim_ordem = m->offset + (int64_t)m->tam_disco;
+    }
+
+    // Já está em ordem
+    if (prefixo == -1) {
+        arena_destroi(arena);
+        return publica_alteracao(archive, arq, dir);
+    }
+
+    // Posições da cópia em ordem, depois do fim dos dados
+    int64_t offset = alinha_offset(fim_antigo);
+    for (int i = prefixo; i < dir->quantidade; i++) {
+        if (!tem_dados(&dir->membros[i]) || dono[i] < prefixo) {
+            cauda[i] = dir->membros[i].offset;
+            continue;
+        }
+        if (dono[i] != i) {
+            cauda[i] = cauda[dono[i]];
+            continue;
+        }
+        if (dir->membros[i].tam_disco >= TAM_MIN_ALINHADO)
+            offset = alinha_offset(offset);
+        cauda[i] = offset;
+        offset += dir->membros[i].tam_disco;
+    }
+
+    // Cópia grande demais: a reescrita completa também deixa tudo em ordem
+    int erro;
+    if (!cabe_no_lugar(dir, NULL, dono, tam_dir, offset)) {
+        erro = reescreve_archive(arena, archive, arq, dir, dono);
+        arena_destroi(arena);
+        return erro;
+    }
+
+    if (fflush(arq) != 0) {
+        arena_destroi(arena);
+        return 1;
+    }
+    int fd = fileno(arq);
+    erro = copia_membros(fd, dir, dono, prefixo, cauda);
+    if (erro) {
+        if (ftruncate(fd, fim_antigo) != 0)
+            fprintf(stderr, "Erro ao descartar dados parciais do archive\n");
+    } else {
+        erro = publica_diretorio(arq, dir);
+    }
+
+    arena_destroi(arena);
+    return erro;
+}
+
+int mover_membro(const char *archive, const char *membro, const char *alvo) {
+    if (archive_em_fluxo(archive)) {
+        fprintf(stderr, "Erro: %s está no formato em fluxo e não pode ser alterado\n", archive);
+        return 1;
+    }
+    // Abre o arquivo archive, excluindo outros escritores
+    FILE *arq = abre_travado(archive);
+    if (!arq) return 1;
+
+    // Lê o diretório
+    struct Diretorio *dir = le_diretorio(arq);
+    if (!dir) {
+        fclose(arq);
+        return 1;
+    }
+
+    // Busca posições do membro e do alvo
+    int pos_membro = busca_membro(membro, dir->membros, dir->quantidade);
+    int pos_alvo = busca_membro(alvo, dir->membros, dir->quantidade);
+
+    // Verifica se ambos existem
+    if (pos_membro == -1 || pos_alvo == -1) {
+        destroi_diretorio(dir);
+        fclose(arq);
+        return 1;
+    }
+
+    // Guarda o membro a ser movido
+    struct Membro membro_movido = dir->membros[pos_membro];
+
+    // Remove o membro da posição atual
+    for (int i = pos_membro; i < dir->quantidade - 1; i++) {
+        dir->membros[i] = dir->membros[i + 1];
+    }
+    dir->quantidade--;
+
+    // Ajusta a posição do alvo se necessário
+    if (pos_membro < pos_alvo) {
+        pos_alvo--;
+    }
+
+    // Insere o membro após o alvo
+    int nova_pos = pos_alvo + 1;
+    
+    // Abre espaço para o membro
+    for (int i = dir->quantidade; i > nova_pos; i--) {
+        dir->membros[i] = dir->membros[i - 1];
     }
     
-    long tamanho = ftell(arquivo);
+    // Insere o membro na nova posição
+    dir->membros[nova_pos] = membro_movido;
+    dir->quantidade++;
+
+    // Atualiza a ordem de todos os membros
+    for (int i = 0; i < dir->quantidade; i++) {
+        dir->membros[i].ordem = i;
+    }
+
+    // Publica o diretório atualizado, rearrumando os dados na nova ordem se
+    // pedido (--reordenar)
+    int erro;
+    if (opcoes.reordenar)
+        erro = reordena_dados(archive, arq, dir);
+    else
+        erro = publica_alteracao(archive, arq, dir);
+
+    // Limpeza
+    destroi_diretorio(dir);
+    fclose(arq);
+    return erro;
+}
+// Archive aberto pela biblioteca (ver vinac_open)
+struct Vinac {
+    char caminho[1024];
+    FILE *arq;               // NULL enquanto um archive novo não foi criado
+    int criado;              // O archive não existia antes do primeiro commit
+    struct Diretorio *dir;   // Diretório na memória, com as mudanças pendentes
+    int64_t fim_gravado;     // fim_dados do diretório publicado no archive
+    int trava;               // Descritor com a trava de escritor (-1 sem trava)
+    int64_t fim;             // Fim dos dados gravados, inclusive os pendentes
+    int pendente;            // Há mudanças não confirmadas
+    int falhou;              // Uma gravação falhou no meio: só resta descartar
+    int *tabela;             // Dispersão nome -> índice no diretório (-1 = vaga)
+    int tam_tabela;          // Potência de 2; 0 se a tabela precisa ser refeita
+    int *ordenados;          // Índices em ordem alfabética (NULL se precisa ser refeito)
+    struct Segmento seg;     // Último segmento sólido lido por vinac_read
+};
+
+// Dispersão de um nome (FNV-1a de 32 bits)
+static uint32_t dispersao_nome(const char *nome) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)nome; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Coloca o membro 'indice' na tabela de dispersão
+static void tabela_insere(struct Vinac *v, int indice) {
+    uint32_t mascara = v->tam_tabela - 1;
+    uint32_t pos = dispersao_nome(v->dir->membros[indice].nome) & mascara;
+    while (v->tabela[pos] != -1)
+        pos = (pos + 1) & mascara;
+    v->tabela[pos] = indice;
+}
+
+// Refaz a tabela de dispersão com todos os membros (ocupação de até 1/2)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int tabela_refaz(struct Vinac *v) {
+    int tam = 64;
+    while (tam < 2 * (v->dir->quantidade + 1))
+        tam *= 2;
+
+    free(v->tabela);
+    v->tam_tabela = 0;
+    v->tabela = malloc(tam * sizeof(int));
+    if (!v->tabela)
+        return 1;
+
+    for (int i = 0; i < tam; i++)
+        v->tabela[i] = -1;
+    v->tam_tabela = tam;
+    for (int i = 0; i < v->dir->quantidade; i++)
+        tabela_insere(v, i);
+    return 0;
+}
+
+// Busca um membro pelo nome na tabela de dispersão (refeita se preciso)
+// RETORNO: índice do membro ou -1 se não encontrado
+static int vinac_busca(struct Vinac *v, const char *nome) {
+    if (v->tam_tabela == 0 && tabela_refaz(v) != 0)
+        return busca_membro(nome, v->dir->membros, v->dir->quantidade);
+
+    uint32_t mascara = v->tam_tabela - 1;
+    for (uint32_t pos = dispersao_nome(nome) & mascara; v->tabela[pos] != -1;
+         pos = (pos + 1) & mascara) {
+        if (strcmp(v->dir->membros[v->tabela[pos]].nome, nome) == 0)
+            return v->tabela[pos];
+    }
+    return -1;
+}
+
+// Descarta a ordem alfabética dos membros (o diretório mudou)
+static void descarta_ordem(struct Vinac *v) {
+    free(v->ordenados);
+    v->ordenados = NULL;
+}
+
+// Marca o membro 'indice' como escolhido (usada com diretorio_seleciona)
+static int escolhe_membro(int indice, void *arg) {
+    ((char *)arg)[indice] = 1;
+    return 0;
+}
 
-    //Verifica caso de erro:
-    if (tamanho < 0) {
-        fprintf(stderr, "Erro ao determinar tamanho do arquivo: %s\n", nome_arq);
-        fclose(arquivo);
+struct Vinac *vinac_open(const char *archive) {
+    if (strlen(archive) >= sizeof(((struct Vinac *)0)->caminho)) {
+        fprintf(stderr, "Erro: nome de archive longo demais: %s\n", archive);
         return NULL;
     }
-    
-    *tam = (unsigned int)tamanho;
-    
-    // Volta para o início do arquivo
-    if (fseek(arquivo, 0, SEEK_SET) != 0) {
-        fprintf(stderr, "Erro ao posicionar no início do arquivo: %s\n", nome_arq);
-        fclose(arquivo);
+    if (archive_em_fluxo(archive)) {
+        fprintf(stderr, "Erro: %s está no formato em fluxo e não pode ser aberto\n", archive);
         return NULL;
     }
-
-    // Aloca buffer do tamaho do arquivo
-    unsigned char *buffer = malloc(*tam);
-    if (!buffer) {
-        fprintf(stderr, "Erro ao alocar memória para arquivo: %s\n", nome_arq);
-        fclose(arquivo);
+    struct Vinac *v = calloc(1, sizeof(struct Vinac));
+    if (!v) {
+        fprintf(stderr, "Erro ao alocar memória\n");
         return NULL;
     }
+    strcpy(v->caminho, archive);
+    v->seg.offset = -1;
+    v->trava = -1;
+
+    // Um archive que ainda não existe (ou vazio) começa vazio
+    v->arq = fopen(archive, "rb+");
+    if (v->arq && offset_final(v->arq) == 0) {
+        fclose(v->arq);
+        v->arq = NULL;
+        v->dir = cria_diretorio();
+        v->criado = 1;
+    } else if (v->arq) {
+        v->dir = le_diretorio(v->arq);
+    } else if (errno == ENOENT) {
+        v->dir = cria_diretorio();
+        v->criado = 1;
+    } else {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+    }
 
-    // Lê o arquivo para o buffer
-    size_t bytes_lidos = fread(buffer, 1, *tam, arquivo);
-    if (bytes_lidos != *tam) {
-        fprintf(stderr, "Erro ao ler conteúdo do arquivo: %s (lido %zu de %u bytes)\n", 
-                nome_arq, bytes_lidos, *tam);
-        free(buffer);
-        fclose(arquivo);
+    v->fim_gravado = v->dir ? fim_dados(v->dir) : -1;
+    if (v->fim_gravado < 0) {
+        vinac_close(v);
         return NULL;
     }
-
-    fclose(arquivo);
-    return buffer;
+    v->fim = v->fim_gravado;
+    return v;
 }
 
-
-int escreve_arquivo(const char *nome_arq, unsigned char *buffer, unsigned int tam) {
-
-    FILE *arquivo = fopen(nome_arq, "wb");
-
-    //Verifica caso de erro:
-    if (!arquivo) {
-        fprintf(stderr, "Erro ao criar arquivo: %s\n", nome_arq);
+// Trava o archive para escrita na primeira alteração feita pelo handle; a
+// trava fica até o commit (ou o close). O archive travado precisa ser o que
+// o handle leu, ainda na mesma geração (ou, para um archive novo, continuar
+// vazio): senão as alterações seriam feitas sobre um diretório velho.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int vinac_trava(struct Vinac *v) {
+    if (v->trava >= 0)
+        return 0;
+
+    int criado;
+    int fd = trava_arquivo(v->caminho, v->criado ? &criado : NULL);
+    if (fd < 0) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", v->caminho);
         return 1;
     }
 
-    // Escreve o buffer no arquivo
-    if (fwrite(buffer, 1, tam, arquivo) != tam) {
-        fprintf(stderr, "Erro ao escrever no arquivo: %s\n", nome_arq);
-        fclose(arquivo);
+    struct stat st_trava, st_arq;
+    unsigned char vagas[TAM_RAIZ];
+    struct Raiz raiz;
+    int mesmo;
+    if (fstat(fd, &st_trava) != 0)
+        mesmo = 0;
+    else if (v->criado)
+        mesmo = st_trava.st_size == 0;
+    else
+        mesmo = fstat(fileno(v->arq), &st_arq) == 0 && st_arq.st_dev == st_trava.st_dev &&
+                st_arq.st_ino == st_trava.st_ino &&
+                pread(fd, vagas, TAM_RAIZ, 0) == (ssize_t)TAM_RAIZ &&
+                raiz_escolhe(vagas, TAM_RAIZ, st_trava.st_size, &raiz) == 0 &&
+                raiz.geracao == v->dir->raiz.geracao;
+    if (!mesmo) {
+        fprintf(stderr, "Erro: o archive %s foi alterado por outro processo depois de aberto\n",
+                v->caminho);
+        close(fd);
         return 1;
     }
 
-    fclose(arquivo);
+    v->trava = fd;
     return 0;
 }
 
+// Libera a trava de escritor do handle
+static void vinac_destrava(struct Vinac *v) {
+    if (v->trava >= 0)
+        close(v->trava);
+    v->trava = -1;
+}
 
-int inserir_membro(const char *archive, const char *membro, int comprimir) {
+// Abre o arquivo de um archive novo (criado vazio por vinac_trava), se ainda
+// não foi aberto
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int vinac_cria_arquivo(struct Vinac *v) {
+    if (v->arq)
+        return 0;
 
-    // Lê o arquivo a ser inserido
-    unsigned int tam_original;
-    unsigned char *dados = le_arquivo(membro, &tam_original);
-    if (!dados) 
+    v->arq = fopen(v->caminho, "rb+");
+    if (!v->arq) {
+        fprintf(stderr, "Erro ao criar archive: %s\n", v->caminho);
         return 1;
+    }
+    return 0;
+}
 
-    // Comprime os dados se necessário
-    unsigned char *dados_comprimidos = NULL;
-    unsigned int tam_comprimido = 0;
-    
-    if (comprimir) {
-        // Aloca espaço para os dados comprimidos (pior caso: mesmo tamanho do original)
-        dados_comprimidos = malloc(tam_original);
-        if (!dados_comprimidos) {
-            free(dados);
-            return 1;
-        }
-        
-        // Comprime os dados chamando a biblioteca LZ
-        tam_comprimido = LZ_Compress(dados, dados_comprimidos, tam_original);
-        
-        // Se a compressão não reduziu o tamanho, usa os dados originais
-        if (tam_comprimido >= tam_original) {
-            free(dados_comprimidos);
-            dados_comprimidos = NULL;
-            comprimir = 0;  // Desativa a compressão
-        }
-    }
-
-    // Extrai apenas o nome base do arquivo (sem caminho)
-    const char *nome_base = get_basename(membro);
-
-    // Estrutura para armazenar o diretório
-    struct Diretorio dir;
-    dir.quantidade = 0;
-    dir.membros = NULL;
-
-    // Verifica se o arquivo já existe
-    FILE *arq = fopen(archive, "rb");
-    if (arq) {
-        // Lê a quantidade de membros
-        if (fread(&dir.quantidade, sizeof(int), 1, arq) != 1) {
-            fclose(arq);
-            free(dados);
-            if (dados_comprimidos) free(dados_comprimidos);
-            return 1;
-        }
-
-        // Aloca espaço para os membros
-        if (dir.quantidade > 0) {
-            dir.membros = malloc(dir.quantidade * sizeof(struct Membro));
-            if (!dir.membros) {
-                fclose(arq);
-                free(dados);
-                if (dados_comprimidos) free(dados_comprimidos);
-                return 1;
-            }
+int vinac_insert(struct Vinac *v, const char **arquivos, int num_arquivos, int comprimir) {
+    if (!v || v->falhou)
+        return 1;
+    if (num_arquivos <= 0)
+        return 0;
 
-            // Lê os membros
-            if (fread(dir.membros, sizeof(struct Membro), dir.quantidade, arq) != dir.quantidade) {
-                free(dir.membros);
-                fclose(arq);
-                free(dados);
-                if (dados_comprimidos) free(dados_comprimidos);
-                return 1;
-            }
-        }
-        fclose(arq);
+    struct Arena *arena = arena_cria();
+    struct Novo *novos = arena_obtem(arena, num_arquivos * sizeof(struct Novo));
+    if (!novos) {
+        arena_destroi(arena);
+        return 1;
     }
 
-    // Verifica se já existe um membro com o mesmo nome, percorrendo o vetor de membros
-    int membro_existente = -1;
-    for (int i = 0; i < dir.quantidade; i++) {
-        if (strcmp(dir.membros[i].nome, nome_base) == 0) {
-            membro_existente = i;
-            break;
+    // Confere os arquivos antes de mexer no diretório (ver insere_membros)
+    for (int i = 0; i < num_arquivos; i++) {
+        struct stat st_membro;
+        if (stat(arquivos[i], &st_membro) != 0) {
+            fprintf(stderr, "Erro ao abrir arquivo: %s\n", arquivos[i]);
+            arena_destroi(arena);
+            return 1;
         }
-    }
-
-    // Cria um novo vetor de membros
-    int nova_quantidade;
-    struct Membro *novos_membros;
-
-    if (membro_existente == -1) {
-        // Adiciona um novo membro
-        nova_quantidade = dir.quantidade + 1;
-        novos_membros = malloc(nova_quantidade * sizeof(struct Membro));
-        if (!novos_membros) {
-            if (dir.membros) free(dir.membros);
-            free(dados);
-            if (dados_comprimidos) free(dados_comprimidos);
+        if (normaliza_nome(arquivos[i], novos[i].nome, sizeof(novos[i].nome)) != 0) {
+            fprintf(stderr, "Nome de membro inválido: %s\n", arquivos[i]);
+            arena_destroi(arena);
             return 1;
         }
+        novos[i].caminho = arquivos[i];
+        novos[i].tam = st_membro.st_size;
+        novos[i].data_modif = st_membro.st_mtim;
+        novos[i].soma_base = SOMA_DESCONHECIDA;
+        novos[i].sequencia = i;
+    }
 
-        // Copia os membros existentes
-        for (int i = 0; i < dir.quantidade; i++) {
-            novos_membros[i] = dir.membros[i];
-        }
+    // Se o mesmo nome aparece mais de uma vez, vale a última ocorrência
+    int num_novos = descarta_repetidos(arena, novos, num_arquivos);
+    if (num_novos < 0) {
+        arena_destroi(arena);
+        return 1;
+    }
 
-        // Adiciona o novo membro
-        novos_membros[dir.quantidade] = inicializa_membro(nome_base, getuid(),tam_original,
-        comprimir ? tam_comprimido : tam_original, time(NULL), dir.quantidade, 0, comprimir ? 1 : 0);
+    // Membros substituídos não podem ser a única base de um delta que fica
+    char *substituido = arena_obtem_zerado(arena, v->dir->quantidade + 1);
+    if (!substituido) {
+        arena_destroi(arena);
+        return 1;
+    }
+    for (int i = 0; i < num_novos; i++) {
+        int k = vinac_busca(v, novos[i].nome);
+        if (k != -1)
+            substituido[k] = 1;
+    }
+    if (confere_bases(v->dir, substituido) != 0) {
+        arena_destroi(arena);
+        return 1;
+    }
 
-    // Se o membro já existe, atualiza o membro existente
-    } else {
-        // Substitui o membro existente
-        nova_quantidade = dir.quantidade;
-        novos_membros = malloc(nova_quantidade * sizeof(struct Membro));
-
-        //Veifica caso  de erro:
-        if (!novos_membros) {
-            if (dir.membros) free(dir.membros);
-            free(dados);
-            if (dados_comprimidos) free(dados_comprimidos);
-            return 1;
-        }
-
-        // Copia os membros existentes
-        for (int i = 0; i < dir.quantidade; i++) {
-            if (i == membro_existente) {
-                // Atualiza o membro existente
-                novos_membros[i] = inicializa_membro(nome_base, getuid(), tam_original,
-                comprimir ? tam_comprimido : tam_original, time(NULL), i, 0, comprimir ? 1 : 0);
-            } else {
-                // Copia o membro existente
-                novos_membros[i] = dir.membros[i];
+    if (vinac_trava(v) != 0 || vinac_cria_arquivo(v) != 0) {
+        arena_destroi(arena);
+        return 1;
+    }
+
+    // Daqui em diante o diretório na memória é alterado: um erro invalida o handle
+    v->pendente = 1;
+    struct Diretorio *dir = v->dir;
+    int erro = 0;
+    for (int i = 0; i < num_novos && !erro; i++) {
+        int k = vinac_busca(v, novos[i].nome);
+        struct Membro m = inicializa_membro(novos[i].nome, getuid(), 0, 0,
+                                            novos[i].data_modif.tv_sec,
+                                            k == -1 ? dir->quantidade : k, 0, comprimir ? 1 : 0);
+        m.data_modif_ns = novos[i].data_modif.tv_nsec;
+        if (k == -1) {
+            k = adiciona_membro(dir, m);
+            if (k == -1) {
+                erro = 1;
+                break;
             }
+            // A tabela é refeita na próxima busca se ficou cheia demais
+            if (v->tam_tabela && 2 * (dir->quantidade + 1) <= v->tam_tabela)
+                tabela_insere(v, k);
+            else
+                v->tam_tabela = 0;
+            descarta_ordem(v);
+        } else {
+            // O nome é o mesmo, já guardado na área do diretório
+            m.nome = dir->membros[k].nome;
+            dir->membros[k] = m;
         }
+        novos[i].indice = k;
     }
 
-    // Calcula o tamanho do diretório
-    long tamanho_diretorio = sizeof(int) + nova_quantidade * sizeof(struct Membro);
-
-    // Calcula os offsets para cada membro
-    long offset = tamanho_diretorio;
-    for (int i = 0; i < nova_quantidade; i++) {
-        novos_membros[i].offset = offset;
-        offset += novos_membros[i].tam_disco;
+    // Membros minúsculos vão para o diretório; os demais, para depois do fim
+    // dos dados, com folga para o diretório crescer em um archive novo
+    unsigned char *area = NULL;
+    uint64_t tam_area = 0;
+    if (!erro && embute_novos(dir, dir->membros, novos, num_novos, &area, &tam_area) != 0) {
+        free(area);
+        erro = 1;
+    } else if (!erro) {
+        free(dir->embutidos);
+        dir->embutidos = area;
+        dir->tam_embutidos = tam_area;
     }
 
-    // Cria um arquivo temporário para armazenar os dados
-    char temp_file[1024];
-    snprintf(temp_file, 1024, "%s.tmp", archive);
+    if (!erro)
+        erro = grava_novos(arena, v->arq, dir->membros, novos, num_novos, v->fim, comprimir, NULL);
 
-    // Abre o arquivo temporário para escrita
-    FILE *temp = fopen(temp_file, "wb");
-    if (!temp) {
-        free(novos_membros);
-        if (dir.membros) free(dir.membros);
-        free(dados);
-        if (dados_comprimidos) free(dados_comprimidos);
-        return 1;
+    for (int i = 0; !erro && i < num_novos; i++) {
+        struct Membro *m = &dir->membros[novos[i].indice];
+        if (tem_dados(m) && m->offset + (int64_t)m->tam_disco > v->fim)
+            v->fim = m->offset + m->tam_disco;
     }
 
-    // Escreve a quantidade de membros
-    if (fwrite(&nova_quantidade, sizeof(int), 1, temp) != 1) {
-        fclose(temp);
-        remove(temp_file);
-        free(novos_membros);
-        if (dir.membros) free(dir.membros);
-        free(dados);
-        if (dados_comprimidos) free(dados_comprimidos);
-        return 1;
+    // Os dados precisam estar no arquivo para vinac_read/vinac_extract
+    if (fflush(v->arq) != 0)
+        erro = 1;
+    if (erro) {
+        fprintf(stderr, "Erro ao inserir no archive %s: mudanças não confirmadas descartadas\n",
+                v->caminho);
+        v->falhou = 1;
     }
 
-    // Escreve os membros
-    if (fwrite(novos_membros, sizeof(struct Membro), nova_quantidade, temp) != nova_quantidade) {
-        fclose(temp);
-        remove(temp_file);
-        free(novos_membros);
-        if (dir.membros) free(dir.membros);
-        free(dados);
-        if (dados_comprimidos) free(dados_comprimidos);
-        return 1;
-    }
-
-    // Abre o arquivo original para leitura
-    arq = fopen(archive, "rb");
-    if (arq) {
-        // Pula o cabeçalho do arquivo original
-        int old_quantidade;
-        if (fread(&old_quantidade, sizeof(int), 1, arq) != 1) {
-            fclose(arq);
-            fclose(temp);
-            remove(temp_file);
-            free(novos_membros);
-            if (dir.membros) free(dir.membros);
-            free(dados);
-            if (dados_comprimidos) free(dados_comprimidos);
-            return 1;
-        }
-
-        // Pula as estruturas de membros
-        if (fseek(arq, old_quantidade * sizeof(struct Membro), SEEK_CUR) != 0) {
-            fclose(arq);
-            fclose(temp);
-            remove(temp_file);
-            free(novos_membros);
-            if (dir.membros) free(dir.membros);
-            free(dados);
-            if (dados_comprimidos) free(dados_comprimidos);
-            return 1;
-        }
-
-        // Para cada membro no novo diretório
-        for (int i = 0; i < nova_quantidade; i++) {
-            // Se este é o membro que está sendo substituído ou adicionado
-            if ((membro_existente != -1 && i == membro_existente) || (membro_existente == -1 && i == nova_quantidade - 1)) {
-                
-                // Escreve os dados (comprimidos ou originais)
-                if (comprimir) {
-                    if (fwrite(dados_comprimidos, 1, tam_comprimido, temp) != tam_comprimido) {
-                        fclose(arq);
-                        fclose(temp);
-                        remove(temp_file);
-                        free(novos_membros);
-                        if (dir.membros) free(dir.membros);
-                        free(dados);
-                        free(dados_comprimidos);
-                        return 1;
-                    }
-                } else {
-                    if (fwrite(dados, 1, tam_original, temp) != tam_original) {
-                        fclose(arq);
-                        fclose(temp);
-                        remove(temp_file);
-                        free(novos_membros);
-                        if (dir.membros) free(dir.membros);
-                        free(dados);
-                        if (dados_comprimidos) free(dados_comprimidos);
-                        return 1;
-                    }
-                }
-            } else {
-                // Encontra o índice correspondente no arquivo original
-                int indice_original = -1;
-                for (int j = 0; j < old_quantidade; j++) {
-                    if (strcmp(dir.membros[j].nome, novos_membros[i].nome) == 0) {
-                        indice_original = j;
-                        break;
-                    }
-                }
+    arena_destroi(arena);
+    return erro;
+}
 
-                if (indice_original == -1) {
-                    fclose(arq);
-                    fclose(temp);
-                    remove(temp_file);
-                    free(novos_membros);
-                    if (dir.membros) free(dir.membros);
-                    free(dados);
-                    if (dados_comprimidos) free(dados_comprimidos);
-                    return 1;
-                }
+// Obtém os dados de 'm' no archive mapeado ou na área de embutidos
+// RETORNO: ponteiro para os dados ou NULL se estão fora do archive
+static const unsigned char *dados_membro(const struct Vinac *v, const struct Membro *m,
+                                         const struct Mapa *mapa) {
+    if (m->comprimido == MEMBRO_EMBUTIDO)
+        return v->dir->embutidos + m->offset;
+    if (m->offset < 0 || (uint64_t)m->offset > mapa->tam ||
+        m->tam_disco > mapa->tam - m->offset) {
+        fprintf(stderr, "Erro ao ler dados do membro %s: fora do archive\n", m->nome);
+        return NULL;
+    }
+    return mapa->dados + m->offset;
+}
 
-                // Posiciona o ponteiro no início dos dados do membro no arquivo original
-                if (fseek(arq, dir.membros[indice_original].offset, SEEK_SET) != 0) {
-                    fclose(arq);
-                    fclose(temp);
-                    remove(temp_file);
-                    free(novos_membros);
-                    if (dir.membros) free(dir.membros);
-                    free(dados);
-                    if (dados_comprimidos) free(dados_comprimidos);
-                    return 1;
-                }
+int vinac_extract(struct Vinac *v, const char **membros, int num_membros) {
+    if (!v || v->falhou)
+        return 1;
 
-                // Aloca espaço para os dados do membro
-                unsigned char *dados_membro = malloc(dir.membros[indice_original].tam_disco);
-                if (!dados_membro) {
-                    fclose(arq);
-                    fclose(temp);
-                    remove(temp_file);
-                    free(novos_membros);
-                    if (dir.membros) free(dir.membros);
-                    free(dados);
-                    if (dados_comprimidos) free(dados_comprimidos);
-                    return 1;
-                }
+    struct Diretorio *dir = v->dir;
+    struct ListaSelecao lista = { NULL, 0, 0, NULL, 0, 0 };
+    char *escolhido = calloc(dir->quantidade + 1, 1);
+    int erro = escolhido == NULL;
+
+    // Nomes exatos (mesmo com metacaracteres) são resolvidos pela tabela;
+    // diretórios e globs, pela faixa da ordem alfabética com o prefixo
+    // literal do padrão
+    for (int p = 0; !erro && membros && p < num_membros; p++) {
+        int k = vinac_busca(v, membros[p]);
+        if (k != -1) {
+            escolhido[k] = 1;
+            continue;
+        }
+        if (!v->ordenados && !(v->ordenados = diretorio_ordena(dir))) {
+            erro = 1;
+            break;
+        }
+        diretorio_seleciona(dir, v->ordenados, membros[p], escolhe_membro, escolhido);
+    }
 
-                // Lê os dados do membro
-                if (fread(dados_membro, 1, dir.membros[indice_original].tam_disco, arq) != dir.membros[indice_original].tam_disco) {
-                    free(dados_membro);
-                    fclose(arq);
-                    fclose(temp);
-                    remove(temp_file);
-                    free(novos_membros);
-                    if (dir.membros) free(dir.membros);
-                    free(dados);
-                    if (dados_comprimidos) free(dados_comprimidos);
-                    return 1;
-                }
+    // Ordena pela posição dos dados (embutidos primeiro), para ler em sequência
+    for (int i = 0; !erro && i < dir->quantidade; i++) {
+        if (membros && num_membros > 0 && !escolhido[i])
+            continue;
+        if (lista.quantidade == lista.capacidade) {
+            int nova_capacidade = lista.capacidade ? lista.capacidade * 2 : 64;
+            struct Selecao *itens = realloc(lista.itens, nova_capacidade * sizeof(struct Selecao));
+            if (!itens) {
+                erro = 1;
+                break;
+            }
+            lista.itens = itens;
+            lista.capacidade = nova_capacidade;
+        }
+        lista.itens[lista.quantidade].offset =
+            dir->membros[i].comprimido == MEMBRO_EMBUTIDO ? -1 : dir->membros[i].offset;
+        lista.itens[lista.quantidade].indice = i;
+        lista.quantidade++;
+    }
+    free(escolhido);
+    if (!erro)
+        qsort(lista.itens, lista.quantidade, sizeof(struct Selecao), compara_offset);
+
+    // Os dados (inclusive os ainda não confirmados) são lidos do mapa
+    struct Mapa mapa = { NULL, 0 };
+    if (!erro && v->arq && (fflush(v->arq) != 0 || mapeia_arquivo(fileno(v->arq), &mapa) != 0))
+        erro = 1;
+
+    struct FilaEscrita *fila = erro ? NULL : fila_cria(limita_parcela(PROFUNDIDADE_FILA * TAM_BUFFER_FILA, 0) /
+                                                       TAM_BUFFER_FILA);
+    if (fila && opcoes.verificar)
+        fila_ao_concluir(fila, mostra_primeiros_bytes);
+    struct Arena *arena = arena_cria();
+    struct Segmento seg = { -1, 0, arena_obtem(arena, TAM_BLOCO) };
+    if (!seg.dados)
+        erro = 1;
+
+    char ultimo_dir[1024] = "";
+    for (int i = 0; !erro && i < lista.quantidade; i++) {
+        const struct Membro *m = &dir->membros[lista.itens[i].indice];
+
+        // Recusa nomes que escapariam do diretório atual
+        char nome_seguro[1024];
+        if (normaliza_nome(m->nome, nome_seguro, sizeof(nome_seguro)) != 0 ||
+            strcmp(nome_seguro, m->nome) != 0) {
+            fprintf(stderr, "Nome de membro inválido: %s\n", m->nome);
+            erro = 1;
+            break;
+        }
+        if (cria_diretorios_pai(m->nome, ultimo_dir, sizeof(ultimo_dir)) != 0) {
+            erro = 1;
+            break;
+        }
 
-                // Escreve os dados do membro no arquivo temporário
-                if (fwrite(dados_membro, 1, dir.membros[indice_original].tam_disco, temp) != dir.membros[indice_original].tam_disco) {
-                    free(dados_membro);
-                    fclose(arq);
-                    fclose(temp);
-                    remove(temp_file);
-                    free(novos_membros);
-                    if (dir.membros) free(dir.membros);
-                    free(dados);
-                    if (dados_comprimidos) free(dados_comprimidos);
-                    return 1;
-                }
+        if (m->comprimido == MEMBRO_DELTA) {
+            struct Versoes versoes = { fileno(v->arq), v->dir, NULL };
+            erro = escreve_delta(&versoes, m);
+            continue;
+        }
 
-                free(dados_membro);
-            }
+        const unsigned char *dados = dados_membro(v, m, &mapa);
+        if (dados && m->comprimido == MEMBRO_SOLIDO && !(dados = trecho_solido(&seg, m, dados)))
+            fprintf(stderr, "Segmento sólido inválido no membro %s\n", m->nome);
+        if (!dados) {
+            erro = 1;
+            break;
         }
 
-        fclose(arq);
-    } else {
-        // Se o arquivo original não existe, apenas escreve os dados do novo membro
-        if (comprimir) {
-            if (fwrite(dados_comprimidos, 1, tam_comprimido, temp) != tam_comprimido) {
-                fclose(temp);
-                remove(temp_file);
-                free(novos_membros);
-                if (dir.membros) free(dir.membros);
-                free(dados);
-                free(dados_comprimidos);
-                return 1;
-            }
+        if (fila && m->tam_orig <= TAM_BUFFER_FILA) {
+            erro = enfileira_membro(fila, m, dados);
         } else {
-            if (fwrite(dados, 1, tam_original, temp) != tam_original) {
-                fclose(temp);
-                remove(temp_file);
-                free(novos_membros);
-                if (dir.membros) free(dir.membros);
-                free(dados);
-                if (dados_comprimidos) free(dados_comprimidos);
-                return 1;
-            }
+            int no_mapa = m->comprimido != MEMBRO_SOLIDO && m->comprimido != MEMBRO_EMBUTIDO;
+            erro = escreve_membro(arena, m, dados, no_mapa ? &mapa : NULL);
         }
     }
 
-    // Fecha o arquivo temporário
-    fclose(temp);
-
-    // Substitui o arquivo original pelo temporário
-    if (rename(temp_file, archive) != 0) {
-        remove(temp_file);
-        free(novos_membros);
-        if (dir.membros) free(dir.membros);
-        free(dados);
-        if (dados_comprimidos) free(dados_comprimidos);
-        return 1;
-    }
+    if (fila && fila_conclui(fila) != 0)
+        erro = 1;
 
-    // Limpeza
-    free(novos_membros);
-    if (dir.membros) free(dir.membros);
-    free(dados);
-    if (dados_comprimidos) free(dados_comprimidos);
-    
-    return 0;
+    fila_destroi(fila);
+    arena_destroi(arena);
+    free(lista.itens);
+    desmapeia_arquivo(&mapa);
+    return erro;
 }
 
+int vinac_remove(struct Vinac *v, const char **membros, int num_membros) {
+    if (!v || v->falhou || vinac_trava(v) != 0)
+        return 1;
 
-int deve_extrair(const char *nome, const char **membros, int num_membros) {
-
-    // Se não há lista específica, extrai todos os membros
-    if (!membros || num_membros <= 0) 
+    // Marca os membros pela tabela e compacta o diretório de uma vez
+    struct Diretorio *dir = v->dir;
+    char *remover = calloc(dir->quantidade + 1, 1);
+    if (!remover)
         return 1;
-    
-    for (int i = 0; i < num_membros; i++) {
-        if (membros[i] && strcmp(nome, membros[i]) == 0) {
-            return 1;
+
+    int removidos = 0;
+    for (int p = 0; p < num_membros; p++) {
+        int k = vinac_busca(v, membros[p]);
+        if (k != -1 && !remover[k]) {
+            remover[k] = 1;
+            removidos++;
         }
     }
-    
-    return 0;
+
+    // Versões base de deltas que ficam não podem sair sozinhas
+    int erro = removidos > 0 && confere_bases(dir, remover) != 0;
+
+    if (!erro && removidos > 0) {
+        int n = 0;
+        for (int i = 0; i < dir->quantidade; i++)
+            if (!remover[i])
+                dir->membros[n++] = dir->membros[i];
+        dir->quantidade = n;
+        v->tam_tabela = 0;
+        descarta_ordem(v);
+        v->pendente = 1;
+    }
+
+    free(remover);
+    return erro;
 }
 
-int extrair_membros(const char *archive, const char **membros, int num_membros) {
-    
-    // Abre o arquivo archive
-    FILE *arq = fopen(archive, "rb");
-    if (!arq) {
-        fprintf(stderr, "Erro ao abrir archive: %s\n", archive);
+int vinac_move(struct Vinac *v, const char *membro, const char *alvo) {
+    if (!v || v->falhou || vinac_trava(v) != 0)
         return 1;
-    }
 
-    // Lê o diretório
-    struct Diretorio *dir = le_diretorio(arq);
-    if (!dir) {
-        fprintf(stderr, "Erro ao ler diretório\n");
-        fclose(arq);
+    struct Diretorio *dir = v->dir;
+    int pos_membro = vinac_busca(v, membro);
+    int pos_alvo = vinac_busca(v, alvo);
+    if (pos_membro == -1 || pos_alvo == -1)
         return 1;
-    }
 
-    // Extrai cada membro
-    for (int i = 0; i < dir->quantidade; i++) {
-        struct Membro *m = &dir->membros[i];
-        
-        // Verifica se deve extrair este membro
-        int extrair = 0;
-        
-        // Se não há lista específica, extrai todos os membros
-        if (num_membros == 0) {
-            extrair = 1;
-        } else {
-            for (int j = 0; j < num_membros; j++) {
-                if (membros[j] && strcmp(m->nome, membros[j]) == 0) {
-                    extrair = 1;
-                    break;
-                }
-            }
-        }
-        
-        if (extrair) {
-            
-            // Posiciona no início dos dados do membro
-            if (fseek(arq, m->offset, SEEK_SET) != 0) {
-                fprintf(stderr, "Erro ao posicionar no offset %ld\n", m->offset);
-                destroi_diretorio(dir);
-                fclose(arq);
-                return 1;
-            }
-            
-            // Aloca buffer para os dados comprimidos
-            unsigned char *buffer = malloc(m->tam_disco);
-            if (!buffer) {
-                fprintf(stderr, "Erro ao alocar memória para extração\n");
-                destroi_diretorio(dir);
-                fclose(arq);
-                return 1;
-            }
-            
-            // Lê os dados do membro
-            size_t bytes_lidos = fread(buffer, 1, m->tam_disco, arq);
-            if (bytes_lidos != m->tam_disco) {
-                fprintf(stderr, "Erro ao ler dados do membro %s: lido %zu de %u bytes\n", 
-                        m->nome, bytes_lidos, m->tam_disco);
-                free(buffer);
-                destroi_diretorio(dir);
-                fclose(arq);
-                return 1;
-            }
-            
-            // Se o membro está comprimido, descomprime
-            unsigned char *dados_finais = buffer;
-            unsigned int tam_final = m->tam_disco;
-            
-            if (m->comprimido) {
-                
-                unsigned char *dados_descomprimidos = malloc(m->tam_orig);
-                if (!dados_descomprimidos) {
-                    fprintf(stderr, "Erro ao alocar memória para descompressão\n");
-                    free(buffer);
-                    destroi_diretorio(dir);
-                    fclose(arq);
-                    return 1;
-                }
-                
-                // Descomprime os dados
-                LZ_Uncompress(buffer, dados_descomprimidos, m->tam_disco);
-                
-                // Libera os dados comprimidos, pois não são mais necessários
-                free(buffer);
-                
-                // Usa os dados descomprimidos
-                dados_finais = dados_descomprimidos;
-                tam_final = m->tam_orig;
-            }
-            
-            // Escreve os dados no arquivo de saída
-            FILE *saida = fopen(m->nome, "wb");
-            if (!saida) {
-                fprintf(stderr, "Erro ao criar arquivo de saída: %s\n", m->nome);
-                free(dados_finais);
-                destroi_diretorio(dir);
-                fclose(arq);
-                return 1;
-            }
-            
-            size_t bytes_escritos = fwrite(dados_finais, 1, tam_final, saida);
-            if (bytes_escritos != tam_final) {
-                fprintf(stderr, "Erro ao escrever dados no arquivo %s: escrito %zu de %u bytes\n", 
-                        m->nome, bytes_escritos, tam_final);
-                fclose(saida);
-                free(dados_finais);
-                destroi_diretorio(dir);
-                fclose(arq);
-                return 1;
-            }
-            
-            fclose(saida);
-            
-            // Verifica o arquivo extraído
-            FILE *verificacao = fopen(m->nome, "rb");
-            if (verificacao) {
-                fseek(verificacao, 0, SEEK_END);
-                long tamanho_arquivo = ftell(verificacao);
-                rewind(verificacao);
-                unsigned char primeiros_bytes[10];
-                size_t bytes_lidos_verificacao = fread(primeiros_bytes, 1, sizeof(primeiros_bytes), verificacao);
-                
-                for (size_t j = 0; j < bytes_lidos_verificacao; j++) {
-                    fprintf(stderr, "%02x ", primeiros_bytes[j]);
-                }
-                fprintf(stderr, "\n");
-                
-                fclose(verificacao);
-            }
-            
-            free(dados_finais);
-        }
+    // Retira o membro e o recoloca logo após o alvo
+    struct Membro movido = dir->membros[pos_membro];
+    if (pos_membro < pos_alvo) {
+        memmove(&dir->membros[pos_membro], &dir->membros[pos_membro + 1],
+                (pos_alvo - pos_membro) * sizeof(struct Membro));
+        dir->membros[pos_alvo] = movido;
+    } else if (pos_membro > pos_alvo + 1) {
+        memmove(&dir->membros[pos_alvo + 2], &dir->membros[pos_alvo + 1],
+                (pos_membro - pos_alvo - 1) * sizeof(struct Membro));
+        dir->membros[pos_alvo + 1] = movido;
     }
 
-    // Limpeza
-    destroi_diretorio(dir);
-    fclose(arq);
+    for (int i = 0; i < dir->quantidade; i++)
+        dir->membros[i].ordem = i;
+    v->tam_tabela = 0;
+    descarta_ordem(v);
+    v->pendente = 1;
     return 0;
 }
 
-int remover_membros(const char *archive, const char **membros, int num_membros) {
-    if (!archive || !membros || num_membros <= 0) return 1;
+int vinac_list(struct Vinac *v, int (*funcao)(const struct Membro *m, void *arg), void *arg) {
+    if (!v || v->falhou)
+        return 1;
 
-    // Abre o arquivo archive
-    FILE *arq = fopen(archive, "rb+");
-    if (!arq) return 1;
+    for (int i = 0; i < v->dir->quantidade; i++)
+        if (funcao(&v->dir->membros[i], arg) != 0)
+            return 1;
+    return 0;
+}
 
-    // Lê o diretório
-    struct Diretorio *dir = le_diretorio(arq);
-    if (!dir) {
-        fclose(arq);
+int vinac_stat(struct Vinac *v, const char *nome, struct Membro *m) {
+    int k = v && !v->falhou ? vinac_busca(v, nome) : -1;
+    if (k == -1)
         return 1;
-    }
+    *m = v->dir->membros[k];
+    return 0;
+}
 
-    int removidos = 0;
-    
-    // Remove cada membro solicitado
-    for (int i = 0; i < num_membros; i++) {
-        int idx = busca_membro(membros[i], dir->membros, dir->quantidade);
-        if (idx != -1) {
-            if (remove_membro(dir, idx) == 0) {
-                removidos++;
-            }
-        }
+// Decodifica o membro 'm' do handle para 'saida' (m->tam_orig bytes). Só o
+// segmento sólido 'seg' é alterado.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int le_membro(struct Vinac *v, const struct Membro *m, unsigned char *saida,
+                     struct Segmento *seg) {
+    if (m->comprimido == MEMBRO_EMBUTIDO) {
+        memcpy(saida, v->dir->embutidos + m->offset, m->tam_orig);
+        return confere_soma(m, soma_dados(saida, m->tam_orig));
     }
 
-    // Se removeu algum membro, salva o diretório atualizado
-    if (removidos > 0) {
-        salva_diretorio(arq, dir);
+    // Deltas são reconstruídos a partir das versões base
+    if (m->comprimido == MEMBRO_DELTA) {
+        struct Versoes versoes = { v->arq ? fileno(v->arq) : -1, v->dir, NULL };
+        struct Leitor *leitor = v->arq && fflush(v->arq) == 0 ? leitor_abre(&versoes, m, 0) : NULL;
+        int erro = !leitor || leitor_preenche(leitor, saida, m->tam_orig) != m->tam_orig ||
+                   leitor->erro || confere_soma(m, soma_dados(saida, m->tam_orig)) != 0;
+        leitor_fecha(leitor);
+        if (erro)
+            fprintf(stderr, "Erro ao ler o membro %s\n", m->nome);
+        return erro;
     }
 
-    // Limpeza
-    destroi_diretorio(dir);
-    fclose(arq);
-    return 0;
+    // Os demais são lidos do arquivo, direto (sem compressão) ou para um
+    // buffer temporário
+    unsigned char *disco = m->comprimido ? malloc(m->tam_disco + 1) : saida;
+    int erro = !disco || !v->arq || fflush(v->arq) != 0;
+    if (!erro)
+        erro = pread(fileno(v->arq), disco, m->tam_disco, m->offset) != (ssize_t)m->tam_disco;
+
+    if (!erro && m->comprimido == MEMBRO_SOLIDO) {
+        // O segmento descomprimido fica guardado para o próximo membro dele
+        if (!seg->dados && !(seg->dados = malloc(TAM_BLOCO)))
+            erro = 1;
+        const unsigned char *trecho = erro ? NULL : trecho_solido(seg, m, disco);
+        if (trecho)
+            memcpy(saida, trecho, m->tam_orig);
+        else
+            erro = 1;
+    } else if (!erro && m->comprimido) {
+        erro = descomprime_buffer(disco, m->tam_disco, saida, m->tam_orig);
+    }
+    if (!erro)
+        erro = confere_soma(m, soma_dados(saida, m->tam_orig));
+
+    if (disco != saida)
+        free(disco);
+    if (erro)
+        fprintf(stderr, "Erro ao ler o membro %s\n", m->nome);
+    return erro;
 }
 
-int listar_conteudo(const char *archive) {
-    // Abre o arquivo archive
-    FILE *arq = fopen(archive, "rb");
-    if (!arq) return 1;
+unsigned char *vinac_read(struct Vinac *v, const char *nome, uint64_t *tam) {
+    if (!v || v->falhou)
+        return NULL;
 
-    // Lê o diretório
-    struct Diretorio *dir = le_diretorio(arq);
-    if (!dir) {
-        fclose(arq);
-        return 1;
+    int k = vinac_busca(v, nome);
+    if (k == -1) {
+        fprintf(stderr, "Membro não encontrado: %s\n", nome);
+        return NULL;
     }
+    const struct Membro *m = &v->dir->membros[k];
 
-    // Imprime cabeçalho
-    printf("Conteúdo do archive '%s':\n", archive);
-    printf("Ordem | Nome | Tamanho Original | Tamanho Disco | UID | Data (timestamp)\n");
-    printf("--------------------------------------------------------------------------------\n");
-
-    // Lista cada membro
-    for (int i = 0; i < dir->quantidade; i++) {
-        struct Membro *m = &dir->membros[i];
-        printf("%5d | %-12s | %15u | %12u | %4d | %ld\n",
-               i, m->nome, m->tam_orig, m->tam_disco, m->uid, m->data_modif);
+    unsigned char *saida = malloc(m->tam_orig + 1);
+    if (!saida) {
+        fprintf(stderr, "Erro ao alocar memória para o membro %s\n", nome);
+        return NULL;
     }
+    *tam = m->tam_orig;
 
-    // Limpeza
-    destroi_diretorio(dir);
-    fclose(arq);
-    return 0;
+    if (le_membro(v, m, saida, &v->seg) != 0) {
+        free(saida);
+        return NULL;
+    }
+    return saida;
 }
 
-int mover_membro(const char *archive, const char *membro, const char *alvo) {
-    // Abre o arquivo archive
-    FILE *arq = fopen(archive, "rb+");
-    if (!arq) return 1;
-
-    // Lê o diretório
-    struct Diretorio *dir = le_diretorio(arq);
-    if (!dir) {
-        fclose(arq);
+int vinac_read_into(struct Vinac *v, const struct Membro *m, unsigned char *saida) {
+    if (!v || v->falhou)
         return 1;
-    }
 
-    // Busca posições do membro e do alvo
-    int pos_membro = busca_membro(membro, dir->membros, dir->quantidade);
-    int pos_alvo = busca_membro(alvo, dir->membros, dir->quantidade);
+    // Um segmento próprio: o do handle pode estar em uso por outra thread
+    struct Segmento seg = { -1, 0, NULL };
+    int erro = le_membro(v, m, saida, &seg);
+    free(seg.dados);
+    return erro;
+}
 
-    // Verifica se ambos existem
-    if (pos_membro == -1 || pos_alvo == -1) {
-        destroi_diretorio(dir);
-        fclose(arq);
+int vinac_commit(struct Vinac *v) {
+    if (!v)
+        return 1;
+    if (v->falhou) {
+        fprintf(stderr, "Erro: o archive %s tem uma gravação interrompida; feche-o e abra de novo\n",
+                v->caminho);
         return 1;
     }
+    if (!v->pendente && !v->criado)
+        return 0;
 
-    // Guarda o membro a ser movido
-    struct Membro membro_movido = dir->membros[pos_membro];
-
-    // Remove o membro da posição atual
-    for (int i = pos_membro; i < dir->quantidade - 1; i++) {
-        dir->membros[i] = dir->membros[i + 1];
-    }
-    dir->quantidade--;
+    if (vinac_trava(v) != 0 || vinac_cria_arquivo(v) != 0)
+        return 1;
 
-    // Ajusta a posição do alvo se necessário
-    if (pos_membro < pos_alvo) {
-        pos_alvo--;
+    // A geração publicada continua valendo até a nova ser publicada
+    if (publica_diretorio(v->arq, v->dir) != 0) {
+        v->falhou = 1;
+        return 1;
     }
 
-    // Insere o membro após o alvo
-    int nova_pos = pos_alvo + 1;
-    
-    // Abre espaço para o membro
-    for (int i = dir->quantidade; i > nova_pos; i--) {
-        dir->membros[i] = dir->membros[i - 1];
-    }
-    
-    // Insere o membro na nova posição
-    dir->membros[nova_pos] = membro_movido;
-    dir->quantidade++;
+    v->fim_gravado = fim_dados(v->dir);
+    v->fim = v->fim_gravado;
+    v->pendente = 0;
+    v->criado = 0;
+    v->seg.offset = -1;
+    vinac_destrava(v);
+    return 0;
+}
 
-    // Atualiza a ordem de todos os membros
-    for (int i = 0; i < dir->quantidade; i++) {
-        dir->membros[i].ordem = i;
+int vinac_close(struct Vinac *v) {
+    if (!v)
+        return 0;
+
+    // Descarta os dados gravados depois do último commit (ou o archive
+    // inteiro, se nunca chegou a ser confirmado), ainda com a trava
+    int erro = 0;
+    if (v->criado && v->trava >= 0) {
+        if (v->arq)
+            fclose(v->arq);
+        erro = remove(v->caminho) != 0;
+    } else if (v->arq) {
+        if (v->pendente && (fflush(v->arq) != 0 || ftruncate(fileno(v->arq), v->fim_gravado) != 0))
+            erro = 1;
+        if (fclose(v->arq) != 0)
+            erro = 1;
     }
-
-    // Salva o diretório atualizado
-    salva_diretorio(arq, dir);
-
-    // Limpeza
-    destroi_diretorio(dir);
-    fclose(arq);
-    return 0;
-}
\ No newline at end of file
+    vinac_destrava(v);
+
+    if (v->dir)
+        destroi_diretorio(v->dir);
+    free(v->tabela);
+    free(v->ordenados);
+    free(v->seg.dados);
+    free(v);
+    return erro;
+}
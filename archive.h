@@ -2,13 +2,58 @@
 #define ARCHIVE_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include "varredura.h"
+#include "diretorio.h"
+
+// Opções gerais, válidas para qualquer operação
+struct Opcoes {
+    int verificar;           // Reabre cada arquivo extraído e mostra seus primeiros bytes
+    int reordenar;           // -m também rearruma os dados na ordem do diretório
+    int solido;              // -ip junta membros pequenos em segmentos sólidos
+    int threads;             // Threads da varredura de diretórios e do teste (0 = automático)
+    int embutir;             // Membros de até tantos bytes ficam no diretório (0 = nunca)
+    uint64_t limite_memoria; // Orçamento de memória em bytes (0 = sem limite)
+    int atualizar;           // -u: arquivos que não mudaram não são inseridos de novo
+    int conferir_conteudo;   // -u compara sempre a soma do conteúdo, sem confiar na data
+    int delta;               // --delta: guarda versões; maior cadeia de deltas (0 = desligado)
+    struct Filtro filtro;    // Padrões --incluir/--excluir da varredura
+};
+
+extern struct Opcoes opcoes;
+
+// Limite padrão e máximo de opcoes.embutir, em bytes
+#define LIMITE_EMBUTIDO_PADRAO 256
+#define LIMITE_EMBUTIDO_MAX 65536
+
+// Cadeia de deltas padrão e máxima de --delta (ver MEMBRO_DELTA). Extrair
+// uma versão descomprime um bloco de cada versão da cadeia.
+#define LIMITE_CADEIA_PADRAO 8
+#define LIMITE_CADEIA_MAX 64
+
+// Menor orçamento aceito por --limite-memoria. Com um orçamento, os buffers
+// de compressão, a fila e a leitura antecipada da extração, os lotes de
+// inserção e as threads da varredura são dimensionados para caber nele.
+#define LIMITE_MEMORIA_MIN (32 * 1024 * 1024)
+
+// Arquivos inseridos a cada reescrita do archive
+#define TAM_LOTE_INSERCAO 16384
 
 // Insere/acrescenta membros (-ip/ -ic)
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
 int inserir_membro(const char *archive, const char *membro, int comprimir);
 
-// Função para ler um arquivo para a memória
-unsigned char *le_arquivo(const char *nome_arq, unsigned int *tam);
+// Insere vários arquivos com uma única reescrita do archive. Se um nome se
+// repete, vale a última ocorrência.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int inserir_membros(const char *archive, const char **membros, int num_membros, int comprimir);
+
+// Insere arquivos e diretórios (-ip/ -ic). Diretórios são percorridos
+// recursivamente em paralelo, aplicando opcoes.filtro, e os arquivos
+// encontrados são inseridos em lotes de até TAM_LOTE_INSERCAO (menos, se
+// houver um orçamento de memória).
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int inserir_caminhos(const char *archive, const char **caminhos, int num_caminhos, int comprimir);
 
 // Remove membros (opção -r)
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
@@ -22,6 +67,14 @@ int deve_extrair(const char *nome, const char **membros, int num_membros);
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
 int extrair_membros(const char *archive, const char **membros, int num_membros);
 
+// Testa a integridade dos membros (opção -t; todos, se a lista está vazia):
+// cada membro é decodificado, sem ser escrito, e a soma do conteúdo é
+// comparada com a guardada. Membros grandes são divididos por blocos entre
+// opcoes.threads trabalhadoras (uma por CPU, se 0). Um membro corrompido não
+// interrompe o teste dos demais.
+// RETORNO: 0 se todos os membros estão íntegros, 1 caso contrário
+int testar_membros(const char *archive, const char **membros, int num_membros);
+
 // Lista o conteúdo (opção -c)
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
 int listar_conteudo(const char *archive);
@@ -30,12 +83,66 @@ int listar_conteudo(const char *archive);
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
 int mover_membro(const char *archive, const char *membro, const char *alvo);
 
-// Lê um arquivo e retorna os dados em um buffer
-// RETORNO: Ponteiro para o buffer ou NULL em caso de erro
-unsigned char *le_arquivo(const char *nome_arq, unsigned int *tam);
+// Acesso por handle (biblioteca libvinac). Um archive aberto com vinac_open
+// mantém o diretório na memória entre as chamadas: buscar, ler, inserir,
+// remover e mover membros não relê nem reinterpreta o diretório. Os dados
+// dos membros inseridos vão para o fim do archive assim que são gravados,
+// mas a geração nova do diretório só é publicada em vinac_commit; vinac_close
+// descarta o que não foi confirmado. Ler não trava nada: o handle continua na
+// geração que leu ao abrir. Da primeira alteração até o commit (ou o close),
+// o handle tem a trava de escritor do archive, e as alterações são recusadas
+// se outro processo publicou uma geração depois daquela. Um handle não deve
+// ser usado por mais de uma thread ao mesmo tempo.
+struct Vinac;
+
+// Abre o archive (ou prepara um novo, criado no primeiro commit ou dado gravado)
+// RETORNO: ponteiro para o handle ou NULL em caso de erro
+struct Vinac *vinac_open(const char *archive);
+
+// Insere/substitui arquivos, como inserir_membros (sem percorrer diretórios)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro. Depois de um erro no meio
+// da gravação o handle só aceita vinac_close.
+int vinac_insert(struct Vinac *v, const char **arquivos, int num_arquivos, int comprimir);
+
+// Extrai membros para o diretório atual, como extrair_membros (todos, se a
+// lista está vazia). Um nome que é de um membro seleciona só esse membro.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int vinac_extract(struct Vinac *v, const char **membros, int num_membros);
+
+// Remove membros (nomes que não existem são ignorados)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int vinac_remove(struct Vinac *v, const char **membros, int num_membros);
+
+// Move 'membro' para logo depois de 'alvo', como mover_membro
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int vinac_move(struct Vinac *v, const char *membro, const char *alvo);
+
+// Chama 'funcao' para cada membro, na ordem do diretório, até ela devolver
+// diferente de 0
+// RETORNO: 0 se percorreu todos, 1 se 'funcao' interrompeu
+int vinac_list(struct Vinac *v, int (*funcao)(const struct Membro *m, void *arg), void *arg);
+
+// Busca um membro pelo nome (tabela de dispersão, sem percorrer o diretório).
+// m->nome aponta para a área de nomes do handle e vale até vinac_close.
+// RETORNO: 0 se encontrou (preenche *m), 1 caso contrário
+int vinac_stat(struct Vinac *v, const char *nome, struct Membro *m);
+
+// Lê o conteúdo de um membro para a memória
+// RETORNO: buffer alocado com *tam bytes (liberar com free) ou NULL em caso de erro
+unsigned char *vinac_read(struct Vinac *v, const char *nome, uint64_t *tam);
+
+// Lê o conteúdo do membro 'm' (obtido com vinac_stat) para 'saida', que tem
+// m->tam_orig bytes. Não altera o handle: várias threads podem chamá-la ao
+// mesmo tempo, desde que nenhuma outra chamada use o handle enquanto isso.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int vinac_read_into(struct Vinac *v, const struct Membro *m, unsigned char *saida);
+
+// Grava o diretório com as mudanças feitas desde o último commit
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int vinac_commit(struct Vinac *v);
 
-// Escreve um buffer em um arquivo
+// Fecha o handle, descartando as mudanças não confirmadas (NULL é ignorado)
 // RETORNO: 0 em caso de sucesso, 1 em caso de erro
-int escreve_arquivo(const char *nome_arq, unsigned char *buffer, unsigned int tam);
+int vinac_close(struct Vinac *v);
 
 #endif
\ No newline at end of file
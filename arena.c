@@ -0,0 +1,100 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Classes de tamanho: a classe c guarda buffers de 2^(MENOR_CLASSE + c) bytes
+#define MENOR_CLASSE 6
+#define NUM_CLASSES 48
+
+// Cabeçalho de cada buffer, logo antes dos dados (32 bytes, o que mantém os
+// dados alinhados a 16)
+struct Buffer {
+    struct Buffer *proximo;          // Próximo na lista de todos os buffers
+    struct Buffer *proximo_livre;    // Próximo livre da mesma classe
+    size_t classe;
+    size_t reservado;                // Preenchimento (sempre 0)
+};
+
+struct Arena {
+    struct Buffer *todos;            // Todos os buffers alocados
+    struct Buffer *livres[NUM_CLASSES];
+};
+
+// Calcula a classe que atende um pedido de 'tam' bytes
+// RETORNO: índice da classe ou -1 se o tamanho é grande demais
+static int classe_de(size_t tam) {
+    int classe = 0;
+    while (classe < NUM_CLASSES && ((size_t)1 << (MENOR_CLASSE + classe)) < tam)
+        classe++;
+    return classe < NUM_CLASSES ? classe : -1;
+}
+
+struct Arena *arena_cria(void) {
+    return calloc(1, sizeof(struct Arena));
+}
+
+void *arena_obtem(struct Arena *arena, size_t tam) {
+    int classe = classe_de(tam);
+    if (!arena || classe < 0)
+        return NULL;
+
+    // Reaproveita um buffer devolvido da mesma classe
+    struct Buffer *b = arena->livres[classe];
+    if (b) {
+        arena->livres[classe] = b->proximo_livre;
+        return b + 1;
+    }
+
+    size_t capacidade = (size_t)1 << (MENOR_CLASSE + classe);
+    b = malloc(sizeof(struct Buffer) + capacidade);
+    if (!b)
+        return NULL;
+
+    b->classe = classe;
+    b->reservado = 0;
+    b->proximo_livre = NULL;
+    b->proximo = arena->todos;
+    arena->todos = b;
+    return b + 1;
+}
+
+void *arena_obtem_zerado(struct Arena *arena, size_t tam) {
+    void *buffer = arena_obtem(arena, tam);
+    if (buffer)
+        memset(buffer, 0, tam);
+    return buffer;
+}
+
+void arena_devolve(struct Arena *arena, void *buffer) {
+    if (!arena || !buffer)
+        return;
+
+    struct Buffer *b = (struct Buffer *)buffer - 1;
+    b->proximo_livre = arena->livres[b->classe];
+    arena->livres[b->classe] = b;
+}
+
+void arena_recicla(struct Arena *arena) {
+    if (!arena)
+        return;
+
+    for (int c = 0; c < NUM_CLASSES; c++)
+        arena->livres[c] = NULL;
+    for (struct Buffer *b = arena->todos; b; b = b->proximo) {
+        b->proximo_livre = arena->livres[b->classe];
+        arena->livres[b->classe] = b;
+    }
+}
+
+void arena_destroi(struct Arena *arena) {
+    if (!arena)
+        return;
+
+    struct Buffer *b = arena->todos;
+    while (b) {
+        struct Buffer *proximo = b->proximo;
+        free(b);
+        b = proximo;
+    }
+    free(arena);
+}
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Arena de uma operação: buffers temporários agrupados em classes de tamanho
+// (potências de 2). Um buffer devolvido volta para a lista da sua classe e é
+// reaproveitado pelo próximo pedido do mesmo tamanho, sem novo malloc nem
+// novas faltas de página. Todos os buffers, devolvidos ou não, são liberados
+// de uma vez ao destruir a arena.
+struct Arena;
+
+// Cria uma arena vazia
+// RETORNO: ponteiro para a arena ou NULL em caso de erro
+struct Arena *arena_cria(void);
+
+// Obtém um buffer de pelo menos 'tam' bytes (alinhado a 16)
+// RETORNO: ponteiro para o buffer ou NULL em caso de erro
+void *arena_obtem(struct Arena *arena, size_t tam);
+
+// Como arena_obtem, com os 'tam' primeiros bytes zerados
+// RETORNO: ponteiro para o buffer ou NULL em caso de erro
+void *arena_obtem_zerado(struct Arena *arena, size_t tam);
+
+// Devolve um buffer para ser reaproveitado (NULL é ignorado). O buffer não
+// pode mais ser usado por quem o devolveu.
+void arena_devolve(struct Arena *arena, void *buffer);
+
+// Devolve de uma vez todos os buffers obtidos (ao fim de uma etapa que se
+// repete, como um lote). A memória continua com a arena, para a próxima etapa.
+void arena_recicla(struct Arena *arena);
+
+// Libera todos os buffers e a própria arena (NULL é ignorado)
+void arena_destroi(struct Arena *arena);
+
+#endif
@@ -0,0 +1,193 @@
+#!/bin/sh
+# Bateria de desempenho do vinac em nível de archive (make bench-archive).
+#
+# Monta archives sintéticos em duas séries e mede cada operação:
+#   membros: N arquivos pequenos (10 a 1M membros)
+#   tamanho: um membro de S bytes (1 KB a vários GB)
+# Operações: -ip em lote (todos de uma vez), -ip de um membro em um archive
+# já cheio, -x de tudo, -x de um membro, -t (teste de integridade), -r, -m e
+# -d (listagem).
+#
+# Os tempos vão para RESULTADOS (série, parâmetro, operação, segundos), um
+# gráfico em texto mostra como cada operação cresce e, se LINHA_BASE existe,
+# cada tempo é comparado com o dela. "make bench-archive-base" guarda os
+# resultados atuais como a nova linha de base.
+#
+# Variáveis:
+#   VINAC       executável (padrão: login/vinac)
+#   ESCALA      rapida (padrão) ou completa (até 1M membros e 4 GB)
+#   MEMBROS     lista de quantidades de membros (substitui a da escala)
+#   TAMANHOS    lista de tamanhos em KB (substitui a da escala)
+#   RESULTADOS  arquivo de resultados (padrão: bench/resultados.tsv)
+#   LINHA_BASE  arquivo para comparar (padrão: bench/linha_base.tsv)
+#   TOLERANCIA  variação, em %, a partir da qual a diferença é marcada (25)
+#   REPETICOES  execuções das operações que não alteram o archive (-x, -t, -d);
+#               vale a menor (padrão: 3)
+#   DIR_BENCH   diretório temporário (padrão: $TMPDIR ou /tmp)
+
+set -e
+
+VINAC=${VINAC:-login/vinac}
+ESCALA=${ESCALA:-rapida}
+RESULTADOS=${RESULTADOS:-bench/resultados.tsv}
+LINHA_BASE=${LINHA_BASE:-bench/linha_base.tsv}
+TOLERANCIA=${TOLERANCIA:-25}
+REPETICOES=${REPETICOES:-3}
+
+case "$ESCALA" in
+    rapida)
+        MEMBROS=${MEMBROS:-"10 100 1000 10000"}
+        TAMANHOS=${TAMANHOS:-"1 64 4096 65536"} ;;
+    completa)
+        MEMBROS=${MEMBROS:-"10 100 1000 10000 100000 1000000"}
+        TAMANHOS=${TAMANHOS:-"1 64 4096 65536 1048576 4194304"} ;;
+    *)
+        echo "Erro: Escala desconhecida: $ESCALA (rapida ou completa)" >&2
+        exit 1 ;;
+esac
+
+if [ ! -x "$VINAC" ]; then
+    echo "Erro: Executável não encontrado: $VINAC" >&2
+    exit 1
+fi
+VINAC=$(cd "$(dirname "$VINAC")" && pwd)/$(basename "$VINAC")
+
+DIR=$(mktemp -d "${DIR_BENCH:-${TMPDIR:-/tmp}}/vinac-bench.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT INT TERM
+
+SAIDA=$DIR/resultados.tsv
+: > "$SAIDA"
+
+# Relógio em nanossegundos
+agora() {
+    date +%s%N
+}
+
+# Executa o comando 'vezes' vezes e registra o menor tempo:
+# mede <vezes> <serie> <parametro> <operacao> <comando...>
+mede() {
+    vezes=$1 serie=$2 parametro=$3 operacao=$4
+    shift 4
+    menor=
+    while [ "$vezes" -gt 0 ]; do
+        inicio=$(agora)
+        if ! "$@" > /dev/null 2>"$DIR/erro"; then
+            echo "Erro em $serie $parametro $operacao:" >&2
+            cat "$DIR/erro" >&2
+            exit 1
+        fi
+        fim=$(agora)
+        if [ -z "$menor" ] || [ $((fim - inicio)) -lt "$menor" ]; then
+            menor=$((fim - inicio))
+        fi
+        vezes=$((vezes - 1))
+    done
+    segundos=$(awk -v d="$menor" 'BEGIN { printf "%.6f", d / 1e9 }')
+    printf '%s\t%s\t%s\t%s\n' "$serie" "$parametro" "$operacao" "$segundos" >> "$SAIDA"
+    printf '  %-8s %10s  %-10s %12s s\n' "$serie" "$parametro" "$operacao" "$segundos"
+}
+
+# Mede todas as operações sobre um archive: opera <serie> <parametro> <entrada> <membro>
+# 'entrada' é o que vai para o -ip em lote e 'membro', um dos membros dele.
+opera() {
+    serie=$1 parametro=$2 entrada=$3 membro=$4
+    arq=$DIR/archive.vc
+    rm -f "$arq"
+
+    mede 1 "$serie" "$parametro" ip_lote "$VINAC" -ip "$arq" "$entrada"
+
+    echo "membro novo" > "$DIR/novo"
+    (cd "$DIR" && mede 1 "$serie" "$parametro" ip_unico "$VINAC" -ip "$arq" novo)
+
+    rm -rf "$DIR/x" && mkdir "$DIR/x"
+    (cd "$DIR/x" && mede "$REPETICOES" "$serie" "$parametro" x_todos "$VINAC" -x "$arq")
+    rm -rf "$DIR/x" && mkdir "$DIR/x"
+    (cd "$DIR/x" && mede "$REPETICOES" "$serie" "$parametro" x_um "$VINAC" -x "$arq" "$membro")
+    rm -rf "$DIR/x"
+
+    mede "$REPETICOES" "$serie" "$parametro" t "$VINAC" -t "$arq"
+    mede "$REPETICOES" "$serie" "$parametro" d "$VINAC" -d "$arq"
+    mede 1 "$serie" "$parametro" m "$VINAC" -m "$arq" novo "$membro"
+    mede 1 "$serie" "$parametro" r "$VINAC" -r "$arq" "$membro"
+    rm -f "$arq"
+}
+
+echo "Série membros (arquivos pequenos)"
+for n in $MEMBROS; do
+    rm -rf "$DIR/m" && mkdir "$DIR/m"
+    # Um arquivo por linha: m/a0000000, m/a0000001, ...
+    (cd "$DIR/m" && seq -f "conteudo do membro %g" 1 "$n" | split -l 1 -a 7 -d - a)
+    (cd "$DIR" && opera membros "$n" m m/a0000000)
+    rm -rf "$DIR/m"
+done
+
+echo "Série tamanho (um membro, KB)"
+for kb in $TAMANHOS; do
+    # Dados aleatórios: a compressão não encolhe nada e o tempo de LZ fica
+    # proporcional ao tamanho, o que isola o custo de E/S do archive
+    head -c $((kb * 1024)) /dev/urandom > "$DIR/grande"
+    (cd "$DIR" && opera tamanho "$kb" grande grande)
+    rm -f "$DIR/grande"
+done
+
+mkdir -p "$(dirname "$RESULTADOS")"
+cp "$SAIDA" "$RESULTADOS"
+echo "Resultados em $RESULTADOS"
+
+# Gráfico: para cada série e operação, uma barra por parâmetro (escala
+# logarítmica do tempo) e o expoente de crescimento em relação ao ponto
+# anterior (1 = linear, 2 = quadrático)
+echo
+echo "Crescimento (barra: log do tempo; expoente: log(t2/t1) / log(p2/p1))"
+awk -F '\t' '
+    {
+        chave = $1 "\t" $3
+        if (!(chave in visto)) { visto[chave] = 1; ordem[++num] = chave }
+        n = ++pontos[chave]
+        param[chave, n] = $2
+        tempo[chave, n] = $4
+    }
+    END {
+        for (k = 1; k <= num; k++) {
+            chave = ordem[k]
+            split(chave, partes, "\t")
+            printf "\n%s %s\n", partes[1], partes[2]
+            for (i = 1; i <= pontos[chave]; i++) {
+                t = tempo[chave, i]
+                barra = t > 0 ? int((log(t) / log(10) + 4) * 8) : 0
+                if (barra < 1) barra = 1
+                linha = ""
+                for (j = 0; j < barra; j++) linha = linha "#"
+                expoente = ""
+                if (i > 1 && tempo[chave, i - 1] > 0 && t > 0 && param[chave, i] != param[chave, i - 1])
+                    expoente = sprintf("  x^%.2f", log(t / tempo[chave, i - 1]) / log(param[chave, i] / param[chave, i - 1]))
+                printf "  %10s %10.4f s %s%s\n", param[chave, i], t, linha, expoente
+            }
+        }
+    }' "$RESULTADOS"
+
+# Comparação com a linha de base
+if [ -f "$LINHA_BASE" ]; then
+    echo
+    echo "Comparação com $LINHA_BASE (tolerância ${TOLERANCIA}%)"
+    awk -F '\t' -v tol="$TOLERANCIA" '
+        NR == FNR { base[$1 "\t" $2 "\t" $3] = $4; next }
+        {
+            chave = $1 "\t" $2 "\t" $3
+            if (!(chave in base)) {
+                printf "  %-8s %10s  %-10s %12s s  (sem base)\n", $1, $2, $3, $4
+                next
+            }
+            b = base[chave]
+            variacao = b > 0 ? ($4 - b) / b * 100 : 0
+            marca = ""
+            # Tempos muito curtos variam demais para serem comparados
+            if ($4 > 0.01 || b > 0.01) {
+                if (variacao > tol) { marca = "  PIOR"; piores++ }
+                else if (variacao < -tol) marca = "  MELHOR"
+            }
+            printf "  %-8s %10s  %-10s %12s s  base %10s s  %+7.1f%%%s\n", $1, $2, $3, $4, b, variacao, marca
+        }
+        END { if (piores) printf "%d medições pioraram mais de %s%%\n", piores, tol }
+    ' "$LINHA_BASE" "$RESULTADOS"
+fi
@@ -0,0 +1,160 @@
+#!/bin/sh
+# Teste de estresse do isolamento entre escritores e leitores (make estresse).
+#
+# ESCRITORES processos alteram o mesmo archive ao mesmo tempo (-ip de membros
+# novos, -r de membros antigos e --reordenar -m), enquanto LEITORES processos
+# extraem tudo (-x) e testam a integridade (-t) sem parar. Cada leitor precisa
+# ver sempre um archive inteiro: todos os membros fixos presentes e o conteúdo
+# de cada membro extraído igual ao gerado para ele. As reescritas completas
+# (quando o espaço sem uso passa do limite) também entram na mistura.
+#
+# O conteúdo de cada membro é aleatório (não comprime) e o nome termina com a
+# soma (cksum) e o tamanho dele (ex.: e1_7_123456789_3000), para os leitores
+# conferirem sem saber o que os escritores fizeram.
+#
+# Variáveis:
+#   VINAC       executável (padrão: login/vinac)
+#   ESCRITORES  processos escritores (padrão: 2)
+#   LEITORES    processos leitores (padrão: 6)
+#   RODADAS     alterações de cada escritor (padrão: 40)
+#   DIR_BENCH   diretório temporário (padrão: $TMPDIR ou /tmp)
+
+set -e
+
+VINAC=${VINAC:-login/vinac}
+ESCRITORES=${ESCRITORES:-2}
+LEITORES=${LEITORES:-6}
+RODADAS=${RODADAS:-40}
+
+if [ ! -x "$VINAC" ]; then
+    echo "Erro: Executável não encontrado: $VINAC" >&2
+    exit 1
+fi
+VINAC=$(cd "$(dirname "$VINAC")" && pwd)/$(basename "$VINAC")
+
+DIR=$(mktemp -d "${DIR_BENCH:-${TMPDIR:-/tmp}}/vinac-estresse.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT INT TERM
+ARQ="$DIR/archive.vc"
+FIM="$DIR/fim"
+
+# gera PREFIXO TAM: cria um arquivo aleatório com TAM bytes e imprime o nome
+# dado a ele (PREFIXO_SOMA_TAM)
+gera() {
+    head -c "$2" /dev/urandom > novo
+    nome="$1_$(cksum < novo | cut -d ' ' -f 1)_$2"
+    mv novo "$nome"
+    echo "$nome"
+}
+
+# confere NOME: verifica o conteúdo de um membro extraído
+confere() {
+    resto=${1%_*}
+    [ "$(wc -c < "$1")" -eq "${1##*_}" ] &&
+        [ "$(cksum < "$1" | cut -d ' ' -f 1)" = "${resto##*_}" ]
+}
+
+# Membros fixos, que nenhum escritor remove: pequenos (embutidos), médios e
+# grandes (alinhados ao bloco)
+mkdir "$DIR/fixos"
+cd "$DIR/fixos"
+FIXO_1=$(gera fixo_1 40)
+FIXOS="$FIXO_1 $(gera fixo_2 3000) $(gera fixo_3 70000) $(gera fixo_4 300000)"
+"$VINAC" --embutir=64 -ip "$ARQ" $FIXOS > /dev/null
+cd "$DIR"
+
+escritor() {
+    mkdir "$DIR/escritor$1"
+    cd "$DIR/escritor$1"
+    k=1
+    while [ "$k" -le "$RODADAS" ]; do
+        case $((k % 4)) in
+            0) tam=40 ;;
+            1) tam=3000 ;;
+            2) tam=70000 ;;
+            *) tam=300000 ;;
+        esac
+        nome=$(gera "e$1_$k" "$tam")
+        "$VINAC" --embutir=64 -ip "$ARQ" "$nome" > /dev/null || return 1
+
+        # Remove o membro de três rodadas atrás e, de vez em quando, muda um
+        # membro fixo de lugar rearrumando os dados
+        if [ "$k" -gt 3 ]; then
+            antigo=$(ls | grep "^e$1_$((k - 3))_")
+            "$VINAC" -r "$ARQ" "$antigo" || return 1
+            rm -f "$antigo"
+        fi
+        if [ $((k % 5)) -eq 0 ]; then
+            "$VINAC" --reordenar -m "$ARQ" "$FIXO_1" "$nome" || return 1
+        fi
+        k=$((k + 1))
+    done
+}
+
+leitor() {
+    mkdir "$DIR/leitor$1"
+    rodada=0
+    while [ ! -e "$FIM" ]; do
+        rodada=$((rodada + 1))
+        saida="$DIR/leitor$1/$rodada"
+        mkdir "$saida"
+        cd "$saida"
+        if ! "$VINAC" -x "$ARQ" > /dev/null; then
+            echo "Erro: leitor $1, rodada $rodada: -x falhou" >&2
+            return 1
+        fi
+        for nome in $FIXOS; do
+            if [ ! -e "$nome" ]; then
+                echo "Erro: leitor $1, rodada $rodada: $nome sumiu" >&2
+                return 1
+            fi
+        done
+        for nome in *; do
+            if ! confere "$nome"; then
+                echo "Erro: leitor $1, rodada $rodada: conteúdo errado em $nome" >&2
+                return 1
+            fi
+        done
+        cd "$DIR"
+        rm -rf "$saida"
+        if ! "$VINAC" -t "$ARQ" > /dev/null; then
+            echo "Erro: leitor $1, rodada $rodada: -t falhou" >&2
+            return 1
+        fi
+    done
+    echo "$rodada" > "$DIR/rodadas$1"
+}
+
+echo "Estresse: $ESCRITORES escritores ($RODADAS rodadas cada), $LEITORES leitores"
+
+leitores=""
+i=1
+while [ "$i" -le "$LEITORES" ]; do
+    leitor "$i" &
+    leitores="$leitores $!"
+    i=$((i + 1))
+done
+
+escritores=""
+i=1
+while [ "$i" -le "$ESCRITORES" ]; do
+    escritor "$i" &
+    escritores="$escritores $!"
+    i=$((i + 1))
+done
+
+falhas=0
+for pid in $escritores; do
+    wait "$pid" || falhas=$((falhas + 1))
+done
+touch "$FIM"
+for pid in $leitores; do
+    wait "$pid" || falhas=$((falhas + 1))
+done
+
+leituras=$(cat "$DIR"/rodadas* 2>/dev/null | awk '{ s += $1 } END { print s + 0 }')
+echo "Leituras completas: $leituras; tamanho final do archive: $(wc -c < "$ARQ") bytes"
+if [ "$falhas" -ne 0 ]; then
+    echo "Erro: $falhas processos falharam" >&2
+    exit 1
+fi
+echo "OK"
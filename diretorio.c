@@ -1,9 +1,27 @@
 #include "diretorio.h"
+#include "metricas.h"
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define CAPACIDADE_INICIAL 10
 
+// Os nomes dos membros de um diretório ficam em blocos encadeados, cada um
+// preenchido em sequência; nada é liberado antes do diretório (um membro
+// removido deixa o nome no bloco)
+#define TAM_BLOCO_NOMES (64 * 1024)
+
+struct BlocoNomes {
+    struct BlocoNomes *anterior;
+    size_t usado;
+    size_t tam;
+    char dados[];
+};
+
 struct Diretorio *cria_diretorio() {
 
     //Aloca memória para o diretório:
@@ -21,20 +39,60 @@ struct Diretorio *cria_diretorio() {
     ///Inicializa os campos:
     dir->quantidade = 0;
     dir->capacidade = CAPACIDADE_INICIAL;
+    dir->embutidos = NULL;
+    dir->tam_embutidos = 0;
+    memset(&dir->raiz, 0, sizeof(dir->raiz));
+    dir->nomes = NULL;
     return dir;
 }
 
-struct Membro inicializa_membro(const char *nome, uid_t uid, unsigned int tam_orig,
-                         unsigned int tam_disco, time_t data_modif, int ordem,
-                         long offset, int comprimido) {
+const char *diretorio_guarda_nome(struct Diretorio *dir, const char *nome) {
+    size_t tam = strlen(nome) + 1;
+    struct BlocoNomes *bloco = dir->nomes;
+
+    if (!bloco || bloco->tam - bloco->usado < tam) {
+        size_t tam_bloco = tam > TAM_BLOCO_NOMES ? tam : TAM_BLOCO_NOMES;
+        bloco = malloc(sizeof(struct BlocoNomes) + tam_bloco);
+        if (!bloco)
+            return NULL;
+        bloco->anterior = dir->nomes;
+        bloco->usado = 0;
+        bloco->tam = tam_bloco;
+        dir->nomes = bloco;
+    }
+
+    char *copia = bloco->dados + bloco->usado;
+    memcpy(copia, nome, tam);
+    bloco->usado += tam;
+    return copia;
+}
+
+uint64_t diretorio_tam_nomes(const struct Diretorio *dir) {
+    uint64_t tam = 0;
+    for (const struct BlocoNomes *bloco = dir->nomes; bloco; bloco = bloco->anterior)
+        tam += sizeof(struct BlocoNomes) + bloco->tam;
+    return tam;
+}
+
+// Libera a área de nomes
+static void libera_nomes(struct Diretorio *dir) {
+    while (dir->nomes) {
+        struct BlocoNomes *anterior = dir->nomes->anterior;
+        free(dir->nomes);
+        dir->nomes = anterior;
+    }
+}
+
+struct Membro inicializa_membro(const char *nome, uid_t uid, uint64_t tam_orig,
+                         uint64_t tam_disco, time_t data_modif, int ordem,
+                         int64_t offset, int comprimido) {
     struct Membro membro;
 
     //Zera a estrutura para evitar lixo na memória:
     memset(&membro, 0, sizeof(struct Membro));
 
     //Inicializa os campos da Struct Membro:
-    strncpy(membro.nome, nome, sizeof(membro.nome) - 1);
-    membro.nome[sizeof(membro.nome) - 1] = '\0';  // Garante terminação
+    membro.nome = nome;
     membro.uid = uid;
     membro.tam_orig = tam_orig;
     membro.tam_disco = tam_disco;
@@ -51,6 +109,8 @@ void destroi_diretorio(struct Diretorio *dir) {
     
     //Libera a memória alocada:
     free(dir->membros);
+    free(dir->embutidos);
+    libera_nomes(dir);
     free(dir);
 }
 
@@ -60,8 +120,8 @@ int adiciona_membro(struct Diretorio *dir, struct Membro membro) {
     // Verifica se precisa redimensionar
     if (dir->quantidade >= dir->capacidade) {
 
-        //Dobra a capacidade do vetor de membros:
-        int nova_capacidade = dir->capacidade * 2;
+        //Dobra a capacidade do vetor de membros (um diretório lido vazio tem 0):
+        int nova_capacidade = dir->capacidade ? dir->capacidade * 2 : CAPACIDADE_INICIAL;
         struct Membro *novo_vetor = realloc(dir->membros, nova_capacidade * sizeof(struct Membro));
 
         //Verifica caso de erro:
@@ -73,7 +133,10 @@ int adiciona_membro(struct Diretorio *dir, struct Membro membro) {
         dir->capacidade = nova_capacidade;
     }
 
-    // Adiciona o novo membro
+    // Adiciona o novo membro, com o nome na área do diretório
+    membro.nome = diretorio_guarda_nome(dir, membro.nome);
+    if (!membro.nome)
+        return -1;
     dir->membros[dir->quantidade] = membro;
     dir->quantidade++;
     
@@ -95,21 +158,179 @@ int remove_membro(struct Diretorio *dir, int indice) {
     return 0;
 }
 
-struct Diretorio *le_diretorio(FILE *arq) {
+// Converte um registro gravado na entrada completa do membro (sem o nome)
+static void registro_para_membro(const struct Registro *reg, struct Membro *membro) {
+    membro->uid = reg->uid;
+    membro->tam_orig = reg->tam_orig;
+    membro->tam_disco = reg->tam_disco;
+    membro->data_modif = reg->data_modif;
+    membro->ordem = reg->ordem;
+    membro->offset = reg->offset;
+    membro->comprimido = reg->comprimido;
+    membro->pos_segmento = reg->pos_segmento;
+    membro->data_modif_ns = reg->data_modif_ns;
+    membro->soma = reg->soma;
+    membro->soma_base = reg->soma_base;
+}
+
+// Número de pontos de reinício para 'quantidade' nomes
+static uint64_t num_reinicios(int quantidade) {
+    return ((uint64_t)quantidade + INTERVALO_REINICIO - 1) / INTERVALO_REINICIO;
+}
+
+// Bytes entre o cabeçalho e a área de nomes (registros, ordenados e reinícios)
+static uint64_t tamanho_tabelas(int quantidade) {
+    return (uint64_t)quantidade * (sizeof(struct Registro) + sizeof(uint32_t)) +
+           num_reinicios(quantidade) * sizeof(uint32_t);
+}
+
+// Confere se o diretório descrito pelo cabeçalho cabe em um archive de 'tam' bytes
+// RETORNO: 1 se é válido, 0 caso contrário
+static int cabecalho_valido(const struct Cabecalho *cab, uint64_t tam) {
+    if (cab->quantidade < 0)
+        return 0;
+
+    uint64_t resto = tam - sizeof(struct Cabecalho);
+    if ((uint64_t)cab->quantidade > resto / sizeof(struct Registro))
+        return 0;
+
+    uint64_t tabelas = tamanho_tabelas(cab->quantidade);
+    if (tabelas > resto)
+        return 0;
+
+    if (cab->tam_nomes > resto - tabelas)
+        return 0;
+
+    return cab->tam_embutidos <= resto - tabelas - cab->tam_nomes;
+}
+
+// Nome do membro e sua posição no diretório, para ordenar
+struct NomeOrdenado {
+    const char *nome;
+    uint32_t indice;
+};
+
+static int compara_nome_ordenado(const void *a, const void *b) {
+    return strcmp(((const struct NomeOrdenado *)a)->nome, ((const struct NomeOrdenado *)b)->nome);
+}
+
+// Ordena os nomes do diretório
+// RETORNO: vetor alocado com dir->quantidade nomes ou NULL em caso de erro
+static struct NomeOrdenado *ordena_nomes(const struct Diretorio *dir) {
+    struct NomeOrdenado *ordem = malloc((dir->quantidade + 1) * sizeof(struct NomeOrdenado));
+    if (!ordem)
+        return NULL;
 
-    // Posiciona no início do arquivo
+    for (int i = 0; i < dir->quantidade; i++) {
+        ordem[i].nome = dir->membros[i].nome;
+        ordem[i].indice = i;
+    }
+
+    qsort(ordem, dir->quantidade, sizeof(struct NomeOrdenado), compara_nome_ordenado);
+    return ordem;
+}
+
+// Bytes em comum no início de dois nomes
+static size_t prefixo_comum(const char *a, const char *b) {
+    size_t n = 0;
+    while (a[n] && a[n] == b[n])
+        n++;
+    return n;
+}
+
+// Prefixo compartilhado com o nome anterior na codificação (0 nos reinícios)
+static size_t prefixo_codificado(const struct NomeOrdenado *ordem, int k) {
+    if (k % INTERVALO_REINICIO == 0)
+        return 0;
+    return prefixo_comum(ordem[k - 1].nome, ordem[k].nome);
+}
+
+// Bytes dos nomes codificados de um vetor já ordenado
+static uint64_t tamanho_nomes(const struct NomeOrdenado *ordem, int quantidade) {
+    uint64_t tam = 0;
+    for (int k = 0; k < quantidade; k++)
+        tam += sizeof(struct NomeCodificado) + strlen(ordem[k].nome) - prefixo_codificado(ordem, k);
+    return tam;
+}
+
+// Abre o índice de uma imagem do diretório (a partir do cabeçalho)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int indice_abre_imagem(struct Indice *ind, const unsigned char *imagem, size_t tam) {
+
+    // A imagem precisa ter pelo menos o cabeçalho
+    if (!imagem || tam < sizeof(struct Cabecalho)) {
+        fprintf(stderr, "Erro ao ler quantidade de membros\n");
+        return 1;
+    }
+
+    const struct Cabecalho *cab = (const struct Cabecalho *)imagem;
+    if (!cabecalho_valido(cab, tam)) {
+        fprintf(stderr, "Quantidade inválida de membros: %d\n", cab->quantidade);
+        return 1;
+    }
+
+    // Registros, tabelas e nomes são usados direto da imagem, sem cópia
+    ind->quantidade = cab->quantidade;
+    ind->registros = (const struct Registro *)(imagem + sizeof(struct Cabecalho));
+    ind->ordenados = (const uint32_t *)(ind->registros + cab->quantidade);
+    ind->reinicios = ind->ordenados + cab->quantidade;
+    ind->nomes = (const unsigned char *)(ind->reinicios + num_reinicios(cab->quantidade));
+    ind->tam_nomes = cab->tam_nomes;
+    ind->embutidos = ind->nomes + cab->tam_nomes;
+    ind->tam_embutidos = cab->tam_embutidos;
+    return 0;
+}
+
+// Explica por que nenhuma vaga da raiz (os 'tam' primeiros bytes do arquivo)
+// serve: sem a assinatura o arquivo não está neste formato, com ela a raiz
+// está corrompida
+static void relata_raiz(const unsigned char *vagas, size_t tam) {
+    for (size_t v = 0; (v + 1) * sizeof(struct Raiz) <= tam; v++) {
+        if (memcmp(vagas + v * sizeof(struct Raiz) + offsetof(struct Raiz, magica), MAGICA_RAIZ,
+                   sizeof(((struct Raiz *)0)->magica)) == 0) {
+            fprintf(stderr, "Erro: a raiz do archive está corrompida\n");
+            return;
+        }
+    }
+    fprintf(stderr, "Erro: o arquivo não é um archive do vinac neste formato (sem a assinatura %s).\n"
+                    "Archives da versão original, com o diretório no início do arquivo, não são\n"
+                    "lidos nem alterados por esta versão: extraia-os com a versão que os criou.\n",
+            MAGICA_RAIZ);
+}
+
+// Lê a geração atual do diretório (le_diretorio sem a medição)
+// RETORNO: ponteiro para o diretório lido ou NULL em caso de erro
+static struct Diretorio *le_gravado(FILE *arq) {
+
+    // Escolhe a raiz e posiciona no diretório da geração
+    unsigned char vagas[TAM_RAIZ];
+    struct Raiz raiz;
+    long tam_arquivo = offset_final(arq);
     rewind(arq);
+    size_t lidos = tam_arquivo < 0 ? 0 : fread(vagas, 1, TAM_RAIZ, arq);
+    if (tam_arquivo < 0 || ferror(arq)) {
+        fprintf(stderr, "Erro ao ler a raiz do archive\n");
+        return NULL;
+    }
+    if (raiz_escolhe(vagas, lidos, tam_arquivo, &raiz) != 0) {
+        relata_raiz(vagas, lidos);
+        return NULL;
+    }
+    if (fseek(arq, raiz.offset, SEEK_SET) != 0) {
+        fprintf(stderr, "Erro ao ler a raiz do archive\n");
+        return NULL;
+    }
     
-    // Lê a quantidade de membros
-    int quantidade;
-    if (fread(&quantidade, sizeof(int), 1, arq) != 1) {
+    // Lê o cabeçalho com a quantidade de membros
+    struct Cabecalho cab;
+    if (fread(&cab, sizeof(struct Cabecalho), 1, arq) != 1) {
         fprintf(stderr, "Erro ao ler quantidade de membros\n");
         return NULL;
     }
+    int quantidade = cab.quantidade;
     
-    
-    // Verifica se a quantidade é válida (limite arbitrário) de 100 membros)
-    if (quantidade < 0 || quantidade > 1000) {  
+    // Verifica se o diretório cabe na geração
+    if (!cabecalho_valido(&cab, raiz.tam)) {
         fprintf(stderr, "Quantidade inválida de membros: %d\n", quantidade);
         return NULL;
     }
@@ -122,6 +343,11 @@ struct Diretorio *le_diretorio(FILE *arq) {
     }
     
     dir->quantidade = quantidade;
+    dir->capacidade = quantidade;
+    dir->embutidos = NULL;
+    dir->tam_embutidos = 0;
+    dir->raiz = raiz;
+    dir->nomes = NULL;
     
     // Se não há membros, retorna o diretório vazio
     if (quantidade == 0) {
@@ -129,18 +355,70 @@ struct Diretorio *le_diretorio(FILE *arq) {
         return dir;
     }
     
-    // Aloca espaço para os membros
+    // Lê o diretório gravado inteiro (registros, tabelas, nomes e embutidos)
+    uint64_t tam_gravado = tamanho_tabelas(quantidade) + cab.tam_nomes + cab.tam_embutidos;
+    unsigned char *gravado = malloc(sizeof(struct Cabecalho) + tam_gravado);
     dir->membros = malloc(quantidade * sizeof(struct Membro));
-    if (!dir->membros) {
+    dir->embutidos = malloc(cab.tam_embutidos + 1);
+    if (!dir->membros || !gravado || !dir->embutidos) {
         fprintf(stderr, "Erro ao alocar membros\n");
+        free(gravado);
+        free(dir->membros);
+        free(dir->embutidos);
         free(dir);
         return NULL;
     }
-    
-    // Lê os membros
-    if (fread(dir->membros, sizeof(struct Membro), quantidade, arq) != quantidade) {
+
+    memcpy(gravado, &cab, sizeof(struct Cabecalho));
+    int erro = fread(gravado + sizeof(struct Cabecalho), 1, tam_gravado, arq) != tam_gravado;
+
+    // Monta os membros, decodificando os nomes em ordem alfabética
+    struct Indice ind;
+    if (!erro)
+        erro = indice_abre_imagem(&ind, gravado, sizeof(struct Cabecalho) + tam_gravado);
+
+    struct CursorNome cur;
+    if (!erro)
+        erro = cursor_posiciona(&cur, &ind, 0);
+
+    for (int k = 0; k < quantidade && !erro; k++) {
+        uint32_t i = ind.ordenados[k];
+        if (i >= (uint32_t)quantidade) {
+            erro = 1;
+            break;
+        }
+
+        registro_para_membro(&ind.registros[i], &dir->membros[i]);
+        dir->membros[i].nome = diretorio_guarda_nome(dir, cur.nome);
+        if (!dir->membros[i].nome) {
+            erro = 1;
+            break;
+        }
+
+        // Os dados dos embutidos precisam estar dentro da área
+        struct Membro *m = &dir->membros[i];
+        if (m->comprimido == MEMBRO_EMBUTIDO &&
+            (m->offset < 0 || (uint64_t)m->offset > ind.tam_embutidos ||
+             m->tam_disco > ind.tam_embutidos - m->offset)) {
+            erro = 1;
+            break;
+        }
+
+        if (k + 1 < quantidade)
+            erro = cursor_proximo(&cur);
+    }
+
+    if (!erro) {
+        memcpy(dir->embutidos, ind.embutidos, ind.tam_embutidos);
+        dir->tam_embutidos = ind.tam_embutidos;
+    }
+    free(gravado);
+
+    if (erro) {
         fprintf(stderr, "Erro ao ler membros\n");
         free(dir->membros);
+        free(dir->embutidos);
+        libera_nomes(dir);
         free(dir);
         return NULL;
     }
@@ -148,28 +426,512 @@ struct Diretorio *le_diretorio(FILE *arq) {
     return dir;
 }
 
-int salva_diretorio(FILE *arq, struct Diretorio *dir) {
-    
-    // Posiciona no início do arquivo
-    if (fseek(arq, 0, SEEK_SET) != 0) {
-        fprintf(stderr, "Erro ao posicionar no início do arquivo\n");
+struct Diretorio *le_diretorio(FILE *arq) {
+    uint64_t relogio = metricas_relogio();
+    struct Diretorio *dir = le_gravado(arq);
+    metricas_fase(FASE_DIRETORIO, relogio);
+    return dir;
+}
+
+int64_t tamanho_diretorio(const struct Diretorio *dir) {
+    struct NomeOrdenado *ordem = ordena_nomes(dir);
+    if (!ordem)
+        return -1;
+
+    int64_t tam = sizeof(struct Cabecalho) + tamanho_tabelas(dir->quantidade) +
+                  tamanho_nomes(ordem, dir->quantidade);
+    for (int i = 0; i < dir->quantidade; i++)
+        if (dir->membros[i].comprimido == MEMBRO_EMBUTIDO)
+            tam += dir->membros[i].tam_disco;
+
+    free(ordem);
+    return tam;
+}
+
+// Refaz a área de embutidos só com os dados dos membros presentes, na ordem
+// do diretório, e atualiza os offsets deles
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int compacta_embutidos(struct Diretorio *dir) {
+    uint64_t tam = 0;
+    for (int i = 0; i < dir->quantidade; i++)
+        if (dir->membros[i].comprimido == MEMBRO_EMBUTIDO)
+            tam += dir->membros[i].tam_disco;
+
+    unsigned char *area = malloc(tam + 1);
+    if (!area)
         return 1;
+
+    uint64_t pos = 0;
+    for (int i = 0; i < dir->quantidade; i++) {
+        struct Membro *m = &dir->membros[i];
+        if (m->comprimido != MEMBRO_EMBUTIDO)
+            continue;
+        memcpy(area + pos, dir->embutidos + m->offset, m->tam_disco);
+        m->offset = pos;
+        pos += m->tam_disco;
     }
+
+    free(dir->embutidos);
+    dir->embutidos = area;
+    dir->tam_embutidos = tam;
+    return 0;
+}
+
+// Grava o diretório na posição atual do arquivo (salva_diretorio sem a medição)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int grava_diretorio(FILE *arq, struct Diretorio *dir) {
+    if (compacta_embutidos(dir) != 0) {
+        fprintf(stderr, "Erro ao alocar diretório\n");
+        return 1;
+    }
+
+    // Ordena os nomes e calcula a posição alfabética de cada membro
+    struct NomeOrdenado *ordem = ordena_nomes(dir);
+    uint32_t *posicao = malloc((dir->quantidade + 1) * sizeof(uint32_t));
+    if (!ordem || !posicao) {
+        fprintf(stderr, "Erro ao alocar diretório\n");
+        free(ordem);
+        free(posicao);
+        return 1;
+    }
+    for (int k = 0; k < dir->quantidade; k++)
+        posicao[ordem[k].indice] = k;
+
+    int erro = 0;
     
-    // Escreve a quantidade de membros
-    if (fwrite(&dir->quantidade, sizeof(int), 1, arq) != 1) {
+    // Escreve o cabeçalho com a quantidade de membros
+    struct Cabecalho cab = { dir->quantidade, 0, tamanho_nomes(ordem, dir->quantidade),
+                             dir->tam_embutidos };
+    if (fwrite(&cab, sizeof(struct Cabecalho), 1, arq) != 1) {
         fprintf(stderr, "Erro ao escrever quantidade de membros\n");
-        return 1;
+        erro = 1;
     }
     
-    // Escreve cada membro
-    for (int i = 0; i < dir->quantidade; i++) {        
-        if (fwrite(&dir->membros[i], sizeof(struct Membro), 1, arq) != 1) {
+    // Escreve o registro de cada membro
+    for (int i = 0; i < dir->quantidade && !erro; i++) {        
+        struct Membro *m = &dir->membros[i];
+        struct Registro reg;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.offset = m->offset;
+        reg.tam_orig = m->tam_orig;
+        reg.tam_disco = m->tam_disco;
+        reg.data_modif = m->data_modif;
+        reg.uid = m->uid;
+        reg.ordem = m->ordem;
+        reg.posicao = posicao[i];
+        reg.nome_tam = strlen(m->nome);
+        reg.comprimido = m->comprimido;
+        reg.pos_segmento = m->pos_segmento;
+        reg.data_modif_ns = m->data_modif_ns;
+        reg.soma = m->soma;
+        reg.soma_base = m->soma_base;
+
+        if (fwrite(&reg, sizeof(struct Registro), 1, arq) != 1) {
             fprintf(stderr, "Erro ao escrever membro %d\n", i);
+            erro = 1;
+        }
+    }
+
+    // Escreve a tabela de ordem alfabética
+    for (int k = 0; k < dir->quantidade && !erro; k++) {
+        if (fwrite(&ordem[k].indice, sizeof(uint32_t), 1, arq) != 1)
+            erro = 1;
+    }
+
+    // Escreve os pontos de reinício
+    uint32_t byte = 0;
+    for (int k = 0; k < dir->quantidade && !erro; k++) {
+        if (k % INTERVALO_REINICIO == 0 && fwrite(&byte, sizeof(uint32_t), 1, arq) != 1)
+            erro = 1;
+        byte += sizeof(struct NomeCodificado) + strlen(ordem[k].nome) - prefixo_codificado(ordem, k);
+    }
+
+    // Escreve os nomes codificados por prefixo
+    for (int k = 0; k < dir->quantidade && !erro; k++) {
+        struct NomeCodificado cod;
+        cod.prefixo = prefixo_codificado(ordem, k);
+        cod.sufixo = strlen(ordem[k].nome) - cod.prefixo;
+
+        if (fwrite(&cod, sizeof(struct NomeCodificado), 1, arq) != 1 ||
+            fwrite(ordem[k].nome + cod.prefixo, 1, cod.sufixo, arq) != cod.sufixo) {
+            fprintf(stderr, "Erro ao escrever membro %d\n", ordem[k].indice);
+            erro = 1;
+        }
+    }
+
+    // Escreve a área de embutidos
+    if (!erro && dir->tam_embutidos > 0 &&
+        fwrite(dir->embutidos, 1, dir->tam_embutidos, arq) != dir->tam_embutidos) {
+        fprintf(stderr, "Erro ao escrever membros embutidos\n");
+        erro = 1;
+    }
+
+    free(ordem);
+    free(posicao);
+    return erro;
+}
+
+int salva_diretorio(FILE *arq, struct Diretorio *dir) {
+    uint64_t relogio = metricas_relogio();
+    int erro = grava_diretorio(arq, dir);
+    metricas_fase(FASE_DIRETORIO, relogio);
+    return erro;
+}
+
+int64_t fim_dados(const struct Diretorio *dir) {
+    int64_t fim = dir->raiz.fim > TAM_RAIZ ? (int64_t)dir->raiz.fim : (int64_t)TAM_RAIZ;
+
+    for (int i = 0; i < dir->quantidade; i++) {
+        if (dir->membros[i].comprimido == MEMBRO_EMBUTIDO)
+            continue;
+        int64_t fim_membro = dir->membros[i].offset + (int64_t)dir->membros[i].tam_disco;
+        if (fim_membro > fim)
+            fim = fim_membro;
+    }
+
+    return fim;
+}
+
+// Soma de verificação de uma raiz (FNV-1a de 64 bits dos campos antes de 'soma')
+static uint64_t soma_raiz(const struct Raiz *raiz) {
+    const unsigned char *dados = (const unsigned char *)raiz;
+    uint64_t soma = 14695981039346656037ULL;
+    for (size_t i = 0; i < offsetof(struct Raiz, soma); i++) {
+        soma ^= dados[i];
+        soma *= 1099511628211ULL;
+    }
+    return soma;
+}
+
+// Escreve todos os 'tam' bytes em 'offset'
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int escreve_em(int fd, const void *dados, size_t tam, off_t offset) {
+    const unsigned char *p = dados;
+    while (tam > 0) {
+        ssize_t n = pwrite(fd, p, tam, offset);
+        if (n <= 0)
+            return 1;
+        p += n;
+        tam -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int raiz_escolhe(const unsigned char *dados, size_t tam, uint64_t tam_archive, struct Raiz *raiz) {
+    int escolhida = 0;
+    for (size_t v = 0; (v + 1) * sizeof(struct Raiz) <= tam; v++) {
+
+        // Copia antes de conferir: a vaga pode estar sendo regravada. Os
+        // leitores não travam nada e confiam só nesta conferência, que não
+        // pode transbordar (offset + tam)
+        struct Raiz vaga;
+        memcpy(&vaga, dados + v * sizeof(struct Raiz), sizeof(vaga));
+        if (memcmp(vaga.magica, MAGICA_RAIZ, sizeof(vaga.magica)) != 0 ||
+            vaga.soma != soma_raiz(&vaga) || vaga.geracao == 0 ||
+            vaga.offset < TAM_RAIZ || vaga.tam < sizeof(struct Cabecalho) ||
+            vaga.fim > tam_archive || vaga.tam > vaga.fim || vaga.offset > vaga.fim - vaga.tam)
+            continue;
+
+        if (!escolhida || vaga.geracao > raiz->geracao)
+            *raiz = vaga;
+        escolhida = 1;
+    }
+    return !escolhida;
+}
+
+int publica_diretorio(FILE *arq, struct Diretorio *dir) {
+
+    // Os registros são lidos direto do mapa: a geração fica alinhada a 8 bytes
+    int64_t fim = fim_dados(dir);
+    if (fim < 0 || fflush(arq) != 0)
+        return 1;
+
+    struct Raiz raiz;
+    memset(&raiz, 0, sizeof(raiz));
+    raiz.geracao = dir->raiz.geracao + 1;
+    raiz.offset = (fim + 7) / 8 * 8;
+
+    // A imagem do diretório vai direto para depois do fim, pelo buffer de
+    // 'arq', sem uma cópia dela inteira na memória (a gravação é medida por
+    // salva_diretorio). Se algo falha, sobram só bytes depois do fim.
+    off_t depois;
+    if (fseeko(arq, raiz.offset, SEEK_SET) != 0 || salva_diretorio(arq, dir) != 0 ||
+        fflush(arq) != 0 || (depois = ftello(arq)) < 0) {
+        fprintf(stderr, "Erro ao publicar o diretório\n");
+        return 1;
+    }
+    raiz.tam = depois - raiz.offset;
+    raiz.fim = depois;
+    memcpy(raiz.magica, MAGICA_RAIZ, sizeof(raiz.magica));
+    raiz.soma = soma_raiz(&raiz);
+
+    uint64_t relogio = metricas_relogio();
+    int fd = fileno(arq);
+
+    // 1) Dados e diretório no disco; 2) raiz na vaga que não está em uso;
+    // 3) descarta o que sobrou depois do fim (de uma gravação interrompida)
+    struct stat st;
+    int erro = fdatasync(fd) != 0 ||
+               escreve_em(fd, &raiz, sizeof(raiz), (raiz.geracao % 2) * sizeof(struct Raiz)) ||
+               fdatasync(fd) != 0 || fstat(fd, &st) != 0 ||
+               (st.st_size > (off_t)raiz.fim && ftruncate(fd, raiz.fim) != 0);
+
+    if (erro)
+        fprintf(stderr, "Erro ao publicar o diretório\n");
+    else
+        dir->raiz = raiz;
+
+    metricas_fase(FASE_DIRETORIO, relogio);
+    return erro;
+}
+
+int indice_abre(struct Indice *ind, const unsigned char *mapa, size_t tam) {
+    struct Raiz raiz;
+    if (!mapa) {
+        fprintf(stderr, "Erro ao ler a raiz do archive\n");
+        return 1;
+    }
+    if (raiz_escolhe(mapa, tam < TAM_RAIZ ? tam : TAM_RAIZ, tam, &raiz) != 0) {
+        relata_raiz(mapa, tam < TAM_RAIZ ? tam : TAM_RAIZ);
+        return 1;
+    }
+    return indice_abre_imagem(ind, mapa + raiz.offset, raiz.tam);
+}
+
+// Decodifica o próximo nome a partir de cur->byte, sobre o nome atual
+// RETORNO: 0 em caso de sucesso, 1 se a codificação é inválida
+static int decodifica_nome(struct CursorNome *cur) {
+    const struct Indice *ind = cur->ind;
+    struct NomeCodificado cod;
+
+    if (cur->byte + sizeof(struct NomeCodificado) > ind->tam_nomes)
+        return 1;
+    memcpy(&cod, ind->nomes + cur->byte, sizeof(struct NomeCodificado));
+
+    if (cod.prefixo > strlen(cur->nome) || (size_t)cod.prefixo + cod.sufixo >= sizeof(cur->nome) ||
+        cur->byte + sizeof(struct NomeCodificado) + cod.sufixo > ind->tam_nomes)
+        return 1;
+
+    memcpy(cur->nome + cod.prefixo, ind->nomes + cur->byte + sizeof(struct NomeCodificado), cod.sufixo);
+    cur->nome[cod.prefixo + cod.sufixo] = '\0';
+    cur->byte += sizeof(struct NomeCodificado) + cod.sufixo;
+    return 0;
+}
+
+int cursor_posiciona(struct CursorNome *cur, const struct Indice *ind, int pos) {
+    if (pos < 0 || pos >= ind->quantidade)
+        return 1;
+
+    // Começa no ponto de reinício do bloco e decodifica até a posição
+    int reinicio = pos / INTERVALO_REINICIO;
+    cur->ind = ind;
+    cur->byte = ind->reinicios[reinicio];
+    cur->nome[0] = '\0';
+
+    for (cur->pos = reinicio * INTERVALO_REINICIO; ; cur->pos++) {
+        if (decodifica_nome(cur) != 0)
+            return 1;
+        if (cur->pos == pos)
+            return 0;
+    }
+}
+
+int cursor_proximo(struct CursorNome *cur) {
+    if (cur->pos + 1 >= cur->ind->quantidade)
+        return 1;
+
+    // No início de um bloco o nome vem completo (prefixo 0)
+    cur->pos++;
+    if (cur->pos % INTERVALO_REINICIO == 0)
+        cur->nome[0] = '\0';
+
+    return decodifica_nome(cur);
+}
+
+// Compara o nome completo de um ponto de reinício com 'nome'
+// RETORNO: <0, 0 ou >0, como strcmp
+static int compara_reinicio(const struct Indice *ind, int reinicio, const char *nome) {
+    struct NomeCodificado cod;
+    uint64_t byte = ind->reinicios[reinicio];
+
+    if (byte + sizeof(struct NomeCodificado) > ind->tam_nomes)
+        return 1;
+    memcpy(&cod, ind->nomes + byte, sizeof(struct NomeCodificado));
+    if (byte + sizeof(struct NomeCodificado) + cod.sufixo > ind->tam_nomes)
+        return 1;
+
+    const unsigned char *texto = ind->nomes + byte + sizeof(struct NomeCodificado);
+    size_t tam = strlen(nome);
+    int r = memcmp(texto, nome, cod.sufixo < tam ? cod.sufixo : tam);
+    if (r != 0)
+        return r;
+    return (cod.sufixo > tam) - (cod.sufixo < tam);
+}
+
+int cursor_busca(struct CursorNome *cur, const struct Indice *ind, const char *prefixo) {
+    if (ind->quantidade == 0)
+        return 1;
+
+    // Busca binária pelo último reinício menor que o prefixo
+    int ini = 0;
+    int fim = (int)num_reinicios(ind->quantidade) - 1;
+    int bloco = 0;
+    while (ini <= fim) {
+        int meio = ini + (fim - ini) / 2;
+        if (compara_reinicio(ind, meio, prefixo) < 0) {
+            bloco = meio;
+            ini = meio + 1;
+        } else {
+            fim = meio - 1;
+        }
+    }
+
+    // Dentro do bloco (e talvez no início do próximo), avança até o primeiro >= prefixo
+    if (cursor_posiciona(cur, ind, bloco * INTERVALO_REINICIO) != 0)
+        return 1;
+
+    while (strcmp(cur->nome, prefixo) < 0) {
+        if (cursor_proximo(cur) != 0)
             return 1;
+    }
+
+    return 0;
+}
+
+int indice_busca(const struct Indice *ind, const char *nome) {
+    struct CursorNome cur;
+
+    if (cursor_busca(&cur, ind, nome) != 0 || strcmp(cur.nome, nome) != 0)
+        return -1;
+
+    uint32_t i = ind->ordenados[cur.pos];
+    return i < (uint32_t)ind->quantidade ? (int)i : -1;
+}
+
+int indice_membro(const struct Indice *ind, int i, struct Membro *membro, char *nome) {
+    if (i < 0 || i >= ind->quantidade)
+        return 1;
+
+    const struct Registro *reg = &ind->registros[i];
+    struct CursorNome cur;
+
+    if (cursor_posiciona(&cur, ind, reg->posicao) != 0) {
+        fprintf(stderr, "Registro inválido no diretório: %d\n", i);
+        return 1;
+    }
+
+    registro_para_membro(reg, membro);
+    strcpy(nome, cur.nome);
+    membro->nome = nome;
+    return 0;
+}
+
+// Tamanho do prefixo literal de um padrão (até o primeiro caractere de glob)
+static size_t prefixo_literal(const char *padrao) {
+    return strcspn(padrao, "*?[\\");
+}
+
+int casa_padrao(const char *nome, const char *padrao) {
+
+    // Glob: '*' também atravessa '/'. O próprio nome, mesmo com
+    // metacaracteres ("f[1].txt"), também corresponde
+    if (padrao[prefixo_literal(padrao)] != '\0')
+        return strcmp(nome, padrao) == 0 || fnmatch(padrao, nome, 0) == 0;
+
+    // Nome exato ou diretório que contém o membro
+    size_t tam = strlen(padrao);
+    while (tam > 1 && padrao[tam - 1] == '/')
+        tam--;
+
+    return strncmp(nome, padrao, tam) == 0 && (nome[tam] == '\0' || nome[tam] == '/');
+}
+
+int indice_seleciona(const struct Indice *ind, const char *padrao,
+                     int (*funcao)(int indice, void *arg), void *arg) {
+    // Um membro com exatamente esse nome vale mais que o padrão: caminhos com
+    // '[' ou '*' são nomes comuns
+    int exato = indice_busca(ind, padrao);
+    if (exato != -1)
+        return funcao(exato, arg) != 0;
+
+    char prefixo[1024];
+    size_t tam = prefixo_literal(padrao);
+    if (tam >= sizeof(prefixo))
+        tam = sizeof(prefixo) - 1;
+    memcpy(prefixo, padrao, tam);
+    prefixo[tam] = '\0';
+
+    // Percorre só a faixa de nomes que começam com o prefixo literal
+    struct CursorNome cur;
+    if (cursor_busca(&cur, ind, prefixo) != 0)
+        return 0;
+
+    do {
+        if (strncmp(cur.nome, prefixo, tam) != 0)
+            break;
+
+        if (casa_padrao(cur.nome, padrao)) {
+            uint32_t i = ind->ordenados[cur.pos];
+            if (i >= (uint32_t)ind->quantidade || funcao((int)i, arg) != 0)
+                return 1;
         }
+    } while (cursor_proximo(&cur) == 0);
+
+    return 0;
+}
+
+int *diretorio_ordena(const struct Diretorio *dir) {
+    struct NomeOrdenado *ordem = ordena_nomes(dir);
+    int *ordenados = malloc((dir->quantidade + 1) * sizeof(int));
+    if (ordem && ordenados) {
+        for (int k = 0; k < dir->quantidade; k++)
+            ordenados[k] = ordem[k].indice;
+    } else {
+        free(ordenados);
+        ordenados = NULL;
     }
-    
+    free(ordem);
+    return ordenados;
+}
+
+int diretorio_seleciona(const struct Diretorio *dir, const int *ordenados, const char *padrao,
+                        int (*funcao)(int indice, void *arg), void *arg) {
+    // Primeiro o nome exato, como em indice_seleciona (busca binária)
+    int ini = 0, fim = dir->quantidade;
+    while (ini < fim) {
+        int meio = ini + (fim - ini) / 2;
+        if (strcmp(dir->membros[ordenados[meio]].nome, padrao) < 0)
+            ini = meio + 1;
+        else
+            fim = meio;
+    }
+    if (ini < dir->quantidade && strcmp(dir->membros[ordenados[ini]].nome, padrao) == 0)
+        return funcao(ordenados[ini], arg) != 0;
+
+    size_t tam = prefixo_literal(padrao);
+
+    // Primeiro nome que não é menor que o prefixo literal (busca binária)
+    ini = 0;
+    fim = dir->quantidade;
+    while (ini < fim) {
+        int meio = ini + (fim - ini) / 2;
+        if (strncmp(dir->membros[ordenados[meio]].nome, padrao, tam) < 0)
+            ini = meio + 1;
+        else
+            fim = meio;
+    }
+
+    // Percorre só a faixa de nomes que começam com o prefixo literal
+    for (int k = ini; k < dir->quantidade; k++) {
+        const char *nome = dir->membros[ordenados[k]].nome;
+        if (strncmp(nome, padrao, tam) != 0)
+            break;
+        if (casa_padrao(nome, padrao) && funcao(ordenados[k], arg) != 0)
+            return 1;
+    }
+
     return 0;
 }
 
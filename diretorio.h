@@ -2,59 +2,307 @@
 #define DIRETORIO_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <time.h>
 
-// Estrutura que representa um membro do archive
+// Tamanho máximo de um nome de membro (com o '\0')
+#define TAM_NOME 1024
+
+// Estrutura que representa um membro do archive. O nome não fica na
+// estrutura: nos membros de um diretório na memória ele está na área de
+// nomes do diretório (ver diretorio_guarda_nome), nos demais em um buffer de
+// quem montou o membro.
 struct Membro {
-    char nome[1024];         // Nome do arquivo (até 1024 bytes)
+    const char *nome;        // Nome do arquivo (até TAM_NOME bytes com o '\0')
     uid_t uid;               // User ID
-    unsigned int tam_orig;   // Tamanho original do arquivo
-    unsigned int tam_disco;  // Tamanho no disco do archive
-    time_t data_modif;       // Data da última modificação
+    uint64_t tam_orig;       // Tamanho original do arquivo
+    uint64_t tam_disco;      // Tamanho no disco do archive
+    time_t data_modif;       // Data da última modificação do arquivo de origem
+    uint32_t data_modif_ns;  // Nanossegundos de data_modif
     int ordem;               // Ordem de inserção
-    long offset;             // Posição dos dados no archive
-    int comprimido;          // 1 se comprimido, 0 se não
+    int64_t offset;          // Posição dos dados no archive
+    int comprimido;          // 1 se comprimido (em blocos), 0 se não, MEMBRO_SOLIDO/EMBUTIDO/DELTA
+    uint32_t pos_segmento;   // Posição dentro do segmento sólido descomprimido (bloco, se delta)
+    uint64_t soma;           // Soma do conteúdo (soma.h) ou SOMA_DESCONHECIDA
+    uint64_t soma_base;      // Soma do conteúdo da versão base (só MEMBRO_DELTA)
+};
+
+// Membros comprimidos são gravados como uma sequência de blocos independentes,
+// cada um com até TAM_BLOCO bytes originais, precedido deste cabeçalho.
+// Se tam_disco == tam_orig o bloco foi guardado sem compressão. Um bloco com
+// tam_disco == 0 (e tam_orig > 0) é um trecho de tam_orig zeros, sem dados:
+// assim ficam os buracos de arquivos esparsos e os pedaços só de zeros, que
+// a extração recria como buracos.
+#define TAM_BLOCO (1024 * 1024)
+
+struct Bloco {
+    uint32_t tam_orig;       // Bytes originais do bloco
+    uint32_t tam_disco;      // Bytes do bloco no archive (sem este cabeçalho)
+};
+
+// Modo sólido: membros pequenos são concatenados e comprimidos juntos em um
+// segmento de um único bloco (até TAM_BLOCO bytes originais), de modo que as
+// repetições entre arquivos diferentes também são aproveitadas. Os membros do
+// segmento têm 'comprimido' == MEMBRO_SOLIDO e compartilham offset e
+// tam_disco (os do segmento); cada um ocupa tam_orig bytes a partir de
+// pos_segmento no segmento descomprimido.
+#define MEMBRO_SOLIDO 2
+
+// Formato do archive:
+//   struct Raiz[2] | dados e gerações do diretório...
+// O diretório nunca é regravado no lugar: cada alteração acrescenta os dados
+// novos e uma geração nova do diretório depois de tudo o que já foi
+// publicado, e só então a publica na vaga da raiz que não está em uso (ver
+// struct Raiz). Uma geração do diretório é:
+//   struct Cabecalho | struct Registro[quantidade] | uint32_t ordenados[quantidade]
+//   | uint32_t reinicios[(quantidade + 15) / 16] | nomes codificados
+//   | área de embutidos
+// Os nomes ficam em ordem alfabética com codificação por prefixo: cada nome
+// guarda só quantos bytes compartilha com o anterior e o restante. A cada
+// INTERVALO_REINICIO nomes há um ponto de reinício (nome completo), cuja
+// posição fica em reinicios[], o que permite busca binária. ordenados[k] é o
+// registro do k-ésimo nome em ordem alfabética.
+#define INTERVALO_REINICIO 16
+
+// Membros minúsculos (até opcoes.embutir bytes) ficam embutidos no próprio
+// diretório, sem compressão, na área de embutidos logo após os nomes. Para
+// eles 'offset' é relativo ao início dessa área. Listar e extrair esses
+// membros não exige nenhuma leitura além da do diretório.
+#define MEMBRO_EMBUTIDO 3
+
+// Versões delta (--delta): ao substituir um membro grande, a versão anterior
+// continua no archive com o nome "nome;N" e a nova é gravada em blocos de
+// 'pos_segmento' bytes originais (TAM_BLOCO se 0; o último pode ser menor),
+// cada um comprimido com LZ_CompressDelta tendo como história os
+// 'pos_segmento' bytes de mesma posição da versão base. A base é o membro
+// (comprimido, sem compressão ou delta) cujo 'soma' é igual a 'soma_base' do
+// delta; ela pode ser, por sua vez, um delta.
+#define MEMBRO_DELTA 4
+
+struct Cabecalho {
+    int quantidade;          // Número de membros
+    int reservado;           // Preenchimento (sempre 0)
+    uint64_t tam_nomes;      // Bytes da área de nomes codificados
+    uint64_t tam_embutidos;  // Bytes da área de membros embutidos
+};
+
+// Registro de um membro no diretório gravado
+struct Registro {
+    int64_t offset;          // Posição dos dados no archive
+    uint64_t tam_orig;       // Tamanho original do arquivo
+    uint64_t tam_disco;      // Tamanho no disco do archive
+    int64_t data_modif;      // Data da última modificação
+    uint32_t uid;            // User ID
+    int32_t ordem;           // Ordem de inserção
+    uint32_t posicao;        // Posição do nome na ordem alfabética
+    uint16_t nome_tam;       // Tamanho do nome (sem o '\0')
+    uint16_t comprimido;     // 1 se comprimido (em blocos), 0 se não, MEMBRO_SOLIDO/EMBUTIDO/DELTA
+    uint32_t pos_segmento;   // Posição dentro do segmento sólido (bloco, se delta)
+    uint32_t data_modif_ns;  // Nanossegundos de data_modif
+    uint64_t soma;           // Soma do conteúdo (soma.h), 0 se desconhecida
+    uint64_t soma_base;      // Soma do conteúdo da versão base (só MEMBRO_DELTA)
 };
 
+// Cabeçalho de cada nome codificado, seguido de 'sufixo' bytes
+struct NomeCodificado {
+    uint16_t prefixo;        // Bytes em comum com o nome anterior (0 nos reinícios)
+    uint16_t sufixo;         // Bytes restantes do nome
+};
+
+// Raiz do archive: duas vagas no início do arquivo, cada uma apontando para
+// uma geração do diretório; vale a vaga íntegra de maior 'geracao'. Um
+// escritor (só um por vez, com flock) grava os dados e a geração nova depois
+// de 'fim', espera que cheguem ao disco e então grava a raiz da geração na
+// outra vaga. Leitores não travam nada: copiam a raiz ao abrir e continuam
+// lendo aquela geração, cujos dados nunca são sobrescritos (o espaço de
+// gerações antigas só é recuperado pela reescrita completa, que cria outro
+// arquivo e o troca por rename). Uma queda no meio deixa só bytes depois de
+// 'fim', ignorados e sobrescritos pelo próximo escritor.
+#define MAGICA_RAIZ "VINACRZ1"
+
+struct Raiz {
+    uint64_t geracao;        // Número da geração (0 = vaga nunca usada)
+    uint64_t offset;         // Posição do diretório da geração
+    uint64_t tam;            // Tamanho do diretório
+    uint64_t fim;            // Fim de tudo o que já foi publicado (dados e diretórios)
+    uint64_t soma;           // Soma de verificação (FNV-1a) dos campos acima
+    char magica[8];
+};
+
+// Onde começam os dados de um archive
+#define TAM_RAIZ (2 * sizeof(struct Raiz))
+
 // Estrutura do diretório
 struct Diretorio {
     struct Membro *membros;  // Vetor de membros
     int quantidade;          // Número atual de membros
     int capacidade;          // Tamanho alocado
+    unsigned char *embutidos; // Dados dos membros embutidos (pode ser NULL)
+    uint64_t tam_embutidos;
+    struct Raiz raiz;        // Geração de onde foi lido (zerada em um archive novo)
+    struct BlocoNomes *nomes; // Área dos nomes dos membros (NULL em cópias que
+                              // usam os nomes de outro diretório)
+};
+
+// Diretório lido sob demanda de um archive mapeado em memória. Só o cabeçalho
+// é interpretado na abertura; registros e nomes são lidos (e paginados pelo
+// kernel) apenas quando usados. Válido enquanto o mapa existir.
+struct Indice {
+    const struct Registro *registros;
+    const uint32_t *ordenados;
+    const uint32_t *reinicios;
+    const unsigned char *nomes;
+    uint64_t tam_nomes;
+    const unsigned char *embutidos;
+    uint64_t tam_embutidos;
+    int quantidade;
+};
+
+// Percorre os nomes do índice em ordem alfabética
+struct CursorNome {
+    const struct Indice *ind;
+    int pos;                 // Posição alfabética do nome atual
+    uint64_t byte;           // Onde começa o próximo nome codificado
+    char nome[TAM_NOME];     // Nome atual, decodificado
+};
+
+// Formato em fluxo (archive "-"), escrito e lido em uma única passada, sem seek:
+//   MAGICA_FLUXO | membros... | struct MembroFluxo vazio | trailer
+// Cada membro é um struct MembroFluxo seguido do nome e dos dados em blocos
+// (struct Bloco + dados), terminados por um bloco com tam_orig == 0. O fim
+// dos membros é um struct MembroFluxo com nome_tam == 0.
+// O trailer repete o diretório para quem pode fazer seek; quem lê em fluxo
+// pode ignorá-lo:
+//   struct Registro[quantidade] | nomes (sem '\0') | struct FimFluxo
+// Nos registros, 'offset' é a posição do struct MembroFluxo no fluxo.
+#define MAGICA_FLUXO "VINACFL1"
+#define TAM_MAGICA_FLUXO 8
+
+struct MembroFluxo {
+    int64_t data_modif;      // Data da última modificação
+    uint32_t uid;            // User ID
+    uint16_t nome_tam;       // Tamanho do nome (sem o '\0'); 0 marca o fim
+    uint16_t reservado;      // Preenchimento (sempre 0)
+};
+
+struct FimFluxo {
+    uint64_t quantidade;     // Número de registros do trailer
+    uint64_t tam_trailer;    // Bytes do trailer antes deste struct
+    char magica[TAM_MAGICA_FLUXO];
 };
 
-//Inicializa os campos da struct Membro
-struct Membro inicializa_membro(const char *nome, uid_t uid, unsigned int tam_orig,
-                         unsigned int tam_disco, time_t data_modif, int ordem,
-                         long offset, int comprimido);
+//Inicializa os campos da struct Membro ('nome' não é copiado)
+struct Membro inicializa_membro(const char *nome, uid_t uid, uint64_t tam_orig,
+                         uint64_t tam_disco, time_t data_modif, int ordem,
+                         int64_t offset, int comprimido);
 
 // Cria diretório vazio com capacidade inicial
 // RETORNO: ponteiro para o diretório alocado ou NULL em caso de erro
 struct Diretorio *cria_diretorio();
 
-// Lê o diretório do arquivo
+// Lê a geração atual do diretório do arquivo
 // RETORNO: um ponteiro para o diretório lido, ou NULL em caso de erro 
 struct Diretorio *le_diretorio(FILE *archive);
 
 // Libera a memória alocada
 void destroi_diretorio(struct Diretorio *dir);
 
-// Adiciona membro no diretório
+// Adiciona membro no diretório (o nome é copiado para a área do diretório)
 // RETORNO: índice do novo membro ou -1 em caso de erro
 int adiciona_membro(struct Diretorio *dir, struct Membro membro);
 
+// Copia um nome para a área de nomes do diretório, que só é liberada com ele
+// RETORNO: ponteiro para a cópia ou NULL em caso de erro
+const char *diretorio_guarda_nome(struct Diretorio *dir, const char *nome);
+
+// Bytes ocupados pela área de nomes do diretório
+uint64_t diretorio_tam_nomes(const struct Diretorio *dir);
+
 // Remove membro por índice
 // RETORNO: 0 em caso de sucesso ou -1 em caso de erro
 int remove_membro(struct Diretorio *dir, int indice);
 
-// Lê o diretório do arquivo archive
-// RETORNO: ponteiro para o diretório preenchido ou NULL em caso de erro
-struct Diretorio *le_diretorio(FILE *archive);
-
-// Salva diretório
+// Grava a imagem do diretório na posição atual de 'archive'. A área de
+// embutidos é compactada: só os dados de membros ainda presentes são
+// gravados, e os offsets deles são atualizados.
 int salva_diretorio(FILE *archive, struct Diretorio *dir);
 
+// Calcula quantos bytes o diretório ocupa no archive (com os embutidos)
+// RETORNO: tamanho do diretório gravado
+int64_t tamanho_diretorio(const struct Diretorio *dir);
+
+// Calcula onde termina a parte do archive em uso: os dados referenciados
+// pelo diretório e tudo o que a geração de onde ele foi lido já publicou.
+// Dados e gerações novos vão depois daí.
+// RETORNO: offset do fim dos dados ou -1 em caso de erro
+int64_t fim_dados(const struct Diretorio *dir);
+
+// Publica uma geração nova do diretório: a imagem é gravada depois de
+// fim_dados, vai para o disco e só então a raiz que aponta para ela é gravada
+// na vaga livre. A imagem passa pelo buffer de 'arq' (aberto para escrita),
+// sem ser montada inteira na memória; a raiz é escrita direto no descritor.
+// Atualiza dir->raiz.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int publica_diretorio(FILE *arq, struct Diretorio *dir);
+
+// Escolhe a raiz válida da geração mais nova nos 'tam' bytes de 'dados' (o
+// início do archive, inteiro ou não), desde que a geração caiba em 'tam_archive'
+// RETORNO: 0 em caso de sucesso, 1 se não há raiz válida
+int raiz_escolhe(const unsigned char *dados, size_t tam, uint64_t tam_archive, struct Raiz *raiz);
+
+// Abre o índice da geração atual de um archive mapeado em memória (sem ler
+// os registros). A raiz é copiada na abertura: o índice continua valendo
+// para aquela geração mesmo que escritores publiquem outras.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int indice_abre(struct Indice *ind, const unsigned char *mapa, size_t tam);
+
+// Monta a entrada completa do membro 'i' a partir do índice. O nome é
+// decodificado em 'nome' (TAM_NOME bytes), para onde membro->nome aponta.
+// RETORNO: 0 em caso de sucesso, 1 se o registro é inválido
+int indice_membro(const struct Indice *ind, int i, struct Membro *membro, char *nome);
+
+// Busca um membro pelo nome no índice (busca binária nos reinícios)
+// RETORNO: índice do membro ou -1 se não encontrado
+int indice_busca(const struct Indice *ind, const char *nome);
+
+// Posiciona o cursor no nome de posição alfabética 'pos'
+// RETORNO: 0 em caso de sucesso, 1 se a posição é inválida
+int cursor_posiciona(struct CursorNome *cur, const struct Indice *ind, int pos);
+
+// Posiciona o cursor no primeiro nome maior ou igual a 'prefixo'
+// RETORNO: 0 em caso de sucesso, 1 se não há nome assim
+int cursor_busca(struct CursorNome *cur, const struct Indice *ind, const char *prefixo);
+
+// Avança o cursor para o próximo nome
+// RETORNO: 0 em caso de sucesso, 1 no fim do índice ou em erro
+int cursor_proximo(struct CursorNome *cur);
+
+// Verifica se um nome corresponde a um padrão de extração: o próprio nome
+// (mesmo com metacaracteres), um diretório que o contém ("a/b" ou "a/b/") ou
+// um glob ("*.conf")
+// RETORNO: 1 se corresponde, 0 caso contrário
+int casa_padrao(const char *nome, const char *padrao);
+
+// Chama 'funcao' para cada membro que corresponde ao padrão. Se há um membro
+// com exatamente esse nome, só ele é escolhido, mesmo que o padrão tenha
+// metacaracteres; senão, só a faixa do índice com o prefixo literal do padrão
+// é percorrida.
+// RETORNO: 0 em caso de sucesso, 1 se 'funcao' ou a leitura falhou
+int indice_seleciona(const struct Indice *ind, const char *padrao,
+                     int (*funcao)(int indice, void *arg), void *arg);
+
+// Ordena os membros de um diretório na memória pelo nome
+// RETORNO: vetor alocado com os índices dos membros em ordem alfabética ou
+// NULL em caso de erro
+int *diretorio_ordena(const struct Diretorio *dir);
+
+// Como indice_seleciona, para um diretório na memória; 'ordenados' vem de
+// diretorio_ordena
+// RETORNO: 0 em caso de sucesso, 1 se 'funcao' falhou
+int diretorio_seleciona(const struct Diretorio *dir, const int *ordenados, const char *padrao,
+                        int (*funcao)(int indice, void *arg), void *arg);
+
 // Calcula offset (posição em bytes) onde os dados no novo membro devem ser escritos
 // RETORNO: offset (posição) onde novos dados serão escritos ou -1 em caso de erro
 long offset_final(FILE *archive);
@@ -0,0 +1,453 @@
+#define _GNU_SOURCE
+#include "fila.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define TEM_IO_URING 1
+#endif
+#endif
+
+#ifdef TEM_IO_URING
+
+// Operações da cadeia de cada arquivo (codificadas no user_data)
+#define OP_ABRE 0
+#define OP_ESCREVE 1
+#define OP_FECHA 2
+#define OPS_POR_ARQUIVO 3
+
+// Um arquivo em voo
+struct Vaga {
+    char nome[1024];         // Caminho do arquivo (precisa viver até a conclusão)
+    unsigned char *buffer;   // Buffer registrado desta vaga
+    size_t tam;              // Bytes que devem ser escritos
+    int erro;                // Primeiro erro recebido (errno), 0 se nenhum
+};
+
+struct FilaEscrita {
+    int fd;                  // Descritor do io_uring
+    unsigned profundidade;   // Número de vagas
+    unsigned ocupadas;       // Vagas usadas no lote atual
+
+    // Anel de submissão
+    void *sq_mapa;
+    size_t sq_tam;
+    unsigned *sq_cauda, *sq_mascara, *sq_vetor;
+    struct io_uring_sqe *sqes;
+    size_t sqes_tam;
+    unsigned pendentes;      // SQEs preenchidos e ainda não submetidos
+
+    // Anel de conclusão
+    void *cq_mapa;
+    size_t cq_tam;
+    unsigned *cq_cabeca, *cq_cauda, *cq_mascara;
+    struct io_uring_cqe *cqes;
+
+    struct Vaga *vagas;
+    unsigned char *buffers;  // Área única com os buffers de todas as vagas
+    void (*ao_concluir)(const char *nome);
+};
+
+static int uring_setup(unsigned entradas, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entradas, p);
+}
+
+static int uring_enter(int fd, unsigned submeter, unsigned esperar, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submeter, esperar, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+// Confere se o kernel implementa as operações usadas pela fila
+// RETORNO: 1 se todas são suportadas, 0 caso contrário
+static int suporta_operacoes(int fd) {
+    size_t tam = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, tam);
+    if (!probe)
+        return 0;
+
+    int ok = 0;
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        int ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE };
+        ok = 1;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+                ok = 0;
+        }
+    }
+
+    free(probe);
+    return ok;
+}
+
+// Mapeia os anéis compartilhados com o kernel
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int mapeia_aneis(struct FilaEscrita *f, struct io_uring_params *p) {
+    f->sq_tam = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    f->cq_tam = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+    // Kernels recentes usam um único mapa para os dois anéis
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (f->cq_tam > f->sq_tam)
+            f->sq_tam = f->cq_tam;
+        f->cq_tam = f->sq_tam;
+    }
+
+    f->sq_mapa = mmap(NULL, f->sq_tam, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      f->fd, IORING_OFF_SQ_RING);
+    if (f->sq_mapa == MAP_FAILED) {
+        f->sq_mapa = NULL;
+        return 1;
+    }
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        f->cq_mapa = f->sq_mapa;
+    } else {
+        f->cq_mapa = mmap(NULL, f->cq_tam, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          f->fd, IORING_OFF_CQ_RING);
+        if (f->cq_mapa == MAP_FAILED) {
+            f->cq_mapa = NULL;
+            return 1;
+        }
+    }
+
+    f->sqes_tam = p->sq_entries * sizeof(struct io_uring_sqe);
+    f->sqes = mmap(NULL, f->sqes_tam, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   f->fd, IORING_OFF_SQES);
+    if (f->sqes == MAP_FAILED) {
+        f->sqes = NULL;
+        return 1;
+    }
+
+    unsigned char *sq = f->sq_mapa;
+    f->sq_cauda = (unsigned *)(sq + p->sq_off.tail);
+    f->sq_mascara = (unsigned *)(sq + p->sq_off.ring_mask);
+    f->sq_vetor = (unsigned *)(sq + p->sq_off.array);
+
+    unsigned char *cq = f->cq_mapa;
+    f->cq_cabeca = (unsigned *)(cq + p->cq_off.head);
+    f->cq_cauda = (unsigned *)(cq + p->cq_off.tail);
+    f->cq_mascara = (unsigned *)(cq + p->cq_off.ring_mask);
+    f->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    return 0;
+}
+
+// Registra os buffers das vagas e uma tabela esparsa de descritores diretos
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int registra_recursos(struct FilaEscrita *f) {
+    struct iovec *iov = malloc(f->profundidade * sizeof(struct iovec));
+    int *fds = malloc(f->profundidade * sizeof(int));
+    if (!iov || !fds) {
+        free(iov);
+        free(fds);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < f->profundidade; i++) {
+        iov[i].iov_base = f->vagas[i].buffer;
+        iov[i].iov_len = TAM_BUFFER_FILA;
+        fds[i] = -1;
+    }
+
+    int erro = uring_register(f->fd, IORING_REGISTER_BUFFERS, iov, f->profundidade) != 0 ||
+               uring_register(f->fd, IORING_REGISTER_FILES, fds, f->profundidade) != 0;
+
+    free(iov);
+    free(fds);
+    return erro;
+}
+
+// Reserva o próximo SQE livre do anel de submissão
+static struct io_uring_sqe *proximo_sqe(struct FilaEscrita *f) {
+    unsigned cauda = *f->sq_cauda + f->pendentes;
+    unsigned indice = cauda & *f->sq_mascara;
+    struct io_uring_sqe *sqe = &f->sqes[indice];
+
+    memset(sqe, 0, sizeof(*sqe));
+    f->sq_vetor[indice] = indice;
+    f->pendentes++;
+    return sqe;
+}
+
+// Abre "." num descritor direto e o fecha, como a cadeia de cada arquivo.
+// Os opcodes existem desde o Linux 5.6, mas openat e close só usam a tabela
+// registrada a partir do 5.15: antes disso o openat ignora o slot, devolve um
+// descritor comum e o write seguinte falharia.
+// RETORNO: 1 se o kernel abre e fecha descritores diretos, 0 caso contrário
+static int suporta_diretos(struct FilaEscrita *f) {
+    struct io_uring_sqe *sqe = proximo_sqe(f);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long)".";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = OP_ABRE;
+
+    sqe = proximo_sqe(f);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    sqe->user_data = OP_FECHA;
+
+    __atomic_store_n(f->sq_cauda, *f->sq_cauda + f->pendentes, __ATOMIC_RELEASE);
+    unsigned submeter = f->pendentes;
+    f->pendentes = 0;
+
+    int ok = 1;
+    unsigned recebidas = 0;
+    while (recebidas < 2) {
+        int r = uring_enter(f->fd, submeter, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        submeter -= (unsigned)r < submeter ? (unsigned)r : submeter;
+
+        unsigned cabeca = *f->cq_cabeca;
+        unsigned cauda = __atomic_load_n(f->cq_cauda, __ATOMIC_ACQUIRE);
+        while (cabeca != cauda) {
+            struct io_uring_cqe *cqe = &f->cqes[cabeca & *f->cq_mascara];
+
+            // Um descritor comum (slot ignorado) é fechado aqui mesmo
+            if (cqe->res != 0)
+                ok = 0;
+            if (cqe->user_data == OP_ABRE && cqe->res > 0)
+                close(cqe->res);
+
+            cabeca++;
+            recebidas++;
+        }
+        __atomic_store_n(f->cq_cabeca, cabeca, __ATOMIC_RELEASE);
+    }
+
+    return ok;
+}
+
+struct FilaEscrita *fila_cria(unsigned profundidade) {
+    if (profundidade == 0)
+        return NULL;
+
+    struct FilaEscrita *f = calloc(1, sizeof(struct FilaEscrita));
+    if (!f)
+        return NULL;
+
+    f->fd = -1;
+    f->profundidade = profundidade;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    f->fd = uring_setup(profundidade * OPS_POR_ARQUIVO, &p);
+
+    // Sem io_uring (kernel antigo, seccomp...): o chamador usa o caminho síncrono
+    if (f->fd < 0 || !suporta_operacoes(f->fd) || mapeia_aneis(f, &p) != 0) {
+        fila_destroi(f);
+        return NULL;
+    }
+
+    f->vagas = calloc(profundidade, sizeof(struct Vaga));
+    f->buffers = mmap(NULL, (size_t)profundidade * TAM_BUFFER_FILA, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!f->vagas || f->buffers == MAP_FAILED) {
+        if (f->buffers == MAP_FAILED)
+            f->buffers = NULL;
+        fila_destroi(f);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < profundidade; i++)
+        f->vagas[i].buffer = f->buffers + (size_t)i * TAM_BUFFER_FILA;
+
+    if (registra_recursos(f) != 0 || !suporta_diretos(f)) {
+        fila_destroi(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+void fila_ao_concluir(struct FilaEscrita *fila, void (*funcao)(const char *nome)) {
+    fila->ao_concluir = funcao;
+}
+
+unsigned char *fila_buffer(struct FilaEscrita *fila) {
+    if (fila->ocupadas == fila->profundidade && fila_conclui(fila) != 0)
+        return NULL;
+
+    return fila->vagas[fila->ocupadas].buffer;
+}
+
+int fila_escreve(struct FilaEscrita *fila, const char *nome, const unsigned char *dados, size_t tam) {
+    // Escritas de io_uring têm tamanho de 32 bits
+    if (tam > 0xffffffffu)
+        return 1;
+
+    if (fila->ocupadas == fila->profundidade && fila_conclui(fila) != 0)
+        return 1;
+
+    unsigned v = fila->ocupadas++;
+    struct Vaga *vaga = &fila->vagas[v];
+
+    strncpy(vaga->nome, nome, sizeof(vaga->nome) - 1);
+    vaga->nome[sizeof(vaga->nome) - 1] = '\0';
+    vaga->tam = tam;
+    vaga->erro = 0;
+
+    // openat direto para o slot v da tabela registrada
+    struct io_uring_sqe *sqe = proximo_sqe(fila);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long)vaga->nome;
+    sqe->len = 0666;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = v + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (unsigned long long)v * OPS_POR_ARQUIVO + OP_ABRE;
+
+    // write usando o descritor direto (e o buffer registrado, se for o caso)
+    sqe = proximo_sqe(fila);
+    sqe->opcode = (dados == vaga->buffer) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = v;
+    sqe->addr = (unsigned long)dados;
+    sqe->len = tam;
+    sqe->off = 0;
+    sqe->buf_index = v;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->user_data = (unsigned long long)v * OPS_POR_ARQUIVO + OP_ESCREVE;
+
+    // close do descritor direto
+    sqe = proximo_sqe(fila);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = v + 1;
+    sqe->user_data = (unsigned long long)v * OPS_POR_ARQUIVO + OP_FECHA;
+
+    return 0;
+}
+
+int fila_conclui(struct FilaEscrita *fila) {
+    unsigned esperadas = fila->pendentes;
+    if (esperadas == 0) {
+        fila->ocupadas = 0;
+        return 0;
+    }
+
+    // Publica os SQEs e submete o lote inteiro numa chamada
+    __atomic_store_n(fila->sq_cauda, *fila->sq_cauda + fila->pendentes, __ATOMIC_RELEASE);
+
+    unsigned submeter = fila->pendentes;
+    unsigned recebidas = 0;
+    fila->pendentes = 0;
+
+    while (recebidas < esperadas) {
+        int r = uring_enter(fila->fd, submeter, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Erro no io_uring: %s\n", strerror(errno));
+            fila->ocupadas = 0;
+            return 1;
+        }
+        submeter -= (unsigned)r < submeter ? (unsigned)r : submeter;
+
+        // Consome as conclusões disponíveis
+        unsigned cabeca = *fila->cq_cabeca;
+        unsigned cauda = __atomic_load_n(fila->cq_cauda, __ATOMIC_ACQUIRE);
+        while (cabeca != cauda) {
+            struct io_uring_cqe *cqe = &fila->cqes[cabeca & *fila->cq_mascara];
+            struct Vaga *vaga = &fila->vagas[cqe->user_data / OPS_POR_ARQUIVO];
+            unsigned op = cqe->user_data % OPS_POR_ARQUIVO;
+
+            if (vaga->erro == 0) {
+                if (cqe->res < 0)
+                    vaga->erro = -cqe->res;
+                else if (op == OP_ESCREVE && (size_t)cqe->res != vaga->tam)
+                    vaga->erro = EIO;
+            }
+
+            cabeca++;
+            recebidas++;
+        }
+        __atomic_store_n(fila->cq_cabeca, cabeca, __ATOMIC_RELEASE);
+    }
+
+    // Relata o resultado de cada arquivo do lote
+    int erro = 0;
+    for (unsigned i = 0; i < fila->ocupadas; i++) {
+        struct Vaga *vaga = &fila->vagas[i];
+        if (vaga->erro) {
+            fprintf(stderr, "Erro ao escrever dados no arquivo %s: %s\n",
+                    vaga->nome, strerror(vaga->erro));
+            erro = 1;
+        } else if (fila->ao_concluir) {
+            fila->ao_concluir(vaga->nome);
+        }
+    }
+
+    fila->ocupadas = 0;
+    return erro;
+}
+
+void fila_destroi(struct FilaEscrita *fila) {
+    if (!fila)
+        return;
+
+    // Fechar o io_uring também libera buffers e descritores registrados
+    if (fila->sqes)
+        munmap(fila->sqes, fila->sqes_tam);
+    if (fila->cq_mapa && fila->cq_mapa != fila->sq_mapa)
+        munmap(fila->cq_mapa, fila->cq_tam);
+    if (fila->sq_mapa)
+        munmap(fila->sq_mapa, fila->sq_tam);
+    if (fila->fd >= 0)
+        close(fila->fd);
+    if (fila->buffers)
+        munmap(fila->buffers, (size_t)fila->profundidade * TAM_BUFFER_FILA);
+
+    free(fila->vagas);
+    free(fila);
+}
+
+#else
+
+// Sem cabeçalhos de io_uring: a fila nunca é criada e tudo é síncrono
+struct FilaEscrita *fila_cria(unsigned profundidade) {
+    (void)profundidade;
+    return NULL;
+}
+
+void fila_ao_concluir(struct FilaEscrita *fila, void (*funcao)(const char *nome)) {
+    (void)fila; (void)funcao;
+}
+
+unsigned char *fila_buffer(struct FilaEscrita *fila) {
+    (void)fila;
+    return NULL;
+}
+
+int fila_escreve(struct FilaEscrita *fila, const char *nome, const unsigned char *dados, size_t tam) {
+    (void)fila; (void)nome; (void)dados; (void)tam;
+    return 1;
+}
+
+int fila_conclui(struct FilaEscrita *fila) {
+    (void)fila;
+    return 0;
+}
+
+void fila_destroi(struct FilaEscrita *fila) {
+    (void)fila;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef FILA_H
+#define FILA_H
+
+#include <stddef.h>
+
+// Fila de escrita assíncrona de arquivos pequenos, baseada em io_uring.
+// Cada arquivo vira uma cadeia openat -> write -> close submetida ao kernel
+// junto com as demais do lote, com descritores e buffers registrados.
+struct FilaEscrita;
+
+// Quantidade de arquivos em voo por lote
+#define PROFUNDIDADE_FILA 64
+
+// Tamanho de cada buffer registrado; arquivos maiores não passam pela fila
+#define TAM_BUFFER_FILA (64 * 1024)
+
+// Cria a fila com 'profundidade' vagas.
+// RETORNO: ponteiro para a fila, ou NULL se o kernel não oferece io_uring
+// (ou as operações necessárias, inclusive openat e close em descritores
+// diretos, do Linux 5.15); nesse caso o chamador usa E/S síncrona.
+struct FilaEscrita *fila_cria(unsigned profundidade);
+
+// Define uma função chamada com o nome de cada arquivo escrito com sucesso,
+// depois que o lote dele é concluído (pode ser NULL)
+void fila_ao_concluir(struct FilaEscrita *fila, void (*funcao)(const char *nome));
+
+// Devolve o buffer registrado da próxima vaga, com TAM_BUFFER_FILA bytes.
+// Se todas as vagas estão ocupadas, conclui o lote atual antes.
+// RETORNO: ponteiro para o buffer ou NULL se a conclusão do lote falhou
+unsigned char *fila_buffer(struct FilaEscrita *fila);
+
+// Enfileira a criação de 'nome' com 'tam' bytes de 'dados'. Os dados precisam
+// continuar válidos até o lote ser concluído. Se 'dados' é o buffer devolvido
+// por fila_buffer, a escrita usa o buffer registrado.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int fila_escreve(struct FilaEscrita *fila, const char *nome, const unsigned char *dados, size_t tam);
+
+// Submete o que estiver pendente e espera todas as operações terminarem
+// RETORNO: 0 se todos os arquivos foram escritos, 1 se algum falhou
+int fila_conclui(struct FilaEscrita *fila);
+
+// Libera a fila (não conclui o lote pendente)
+void fila_destroi(struct FilaEscrita *fila);
+
+#endif
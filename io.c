@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+
+off_t alinha_offset(off_t offset) {
+    return (offset + ALINHAMENTO_BLOCO - 1) / ALINHAMENTO_BLOCO * ALINHAMENTO_BLOCO;
+}
+
+int trava_arquivo(const char *caminho, int *criado) {
+    for (;;) {
+        if (criado)
+            *criado = 0;
+        int fd = open(caminho, O_RDWR | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && criado) {
+            fd = open(caminho, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            *criado = fd >= 0;
+            if (fd < 0 && errno == EEXIST)
+                continue;
+        }
+        if (fd < 0)
+            return -1;
+
+        // O arquivo travado precisa ser o que ainda está no caminho
+        struct stat st_fd, st_caminho;
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st_fd) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (stat(caminho, &st_caminho) == 0 && st_caminho.st_dev == st_fd.st_dev &&
+            st_caminho.st_ino == st_fd.st_ino)
+            return fd;
+
+        close(fd);
+    }
+}
+
+// Tenta clonar a parte alinhada do intervalo (reflink). Só funciona em sistemas
+// de arquivos com suporte (XFS, btrfs...) e com os dois offsets alinhados.
+// RETORNO: quantidade de bytes clonados (0 se não foi possível clonar)
+static off_t clona_intervalo(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam) {
+#ifdef FICLONERANGE
+    if (off_orig % ALINHAMENTO_BLOCO != 0 || off_dest % ALINHAMENTO_BLOCO != 0)
+        return 0;
+
+    // Só a parte múltipla do bloco pode ser clonada; o resto é copiado
+    off_t tam_clone = tam / ALINHAMENTO_BLOCO * ALINHAMENTO_BLOCO;
+    if (tam_clone == 0)
+        return 0;
+
+    struct file_clone_range intervalo;
+    intervalo.src_fd = fd_orig;
+    intervalo.src_offset = off_orig;
+    intervalo.src_length = tam_clone;
+    intervalo.dest_offset = off_dest;
+
+    if (ioctl(fd_dest, FICLONERANGE, &intervalo) != 0)
+        return 0;
+
+    return tam_clone;
+#else
+    (void)fd_orig; (void)off_orig; (void)fd_dest; (void)off_dest; (void)tam;
+    return 0;
+#endif
+}
+
+// Cópia dentro do kernel com copy_file_range
+// RETORNO: bytes copiados, ou -1 se a chamada não é suportada para esses arquivos
+static off_t copia_kernel(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam) {
+    off_t copiados = 0;
+
+    while (copiados < tam) {
+        loff_t de = off_orig + copiados;
+        loff_t para = off_dest + copiados;
+        ssize_t n = copy_file_range(fd_orig, &de, fd_dest, &para, tam - copiados, 0);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // Nada foi copiado ainda: deixa o chamador tentar outro método
+            if (copiados == 0 && (errno == ENOSYS || errno == EXDEV ||
+                                  errno == EINVAL || errno == EOPNOTSUPP))
+                return -1;
+            return copiados;
+        }
+
+        // Fim inesperado do arquivo de origem
+        if (n == 0)
+            break;
+
+        copiados += n;
+    }
+
+    return copiados;
+}
+
+// Cópia com sendfile (escreve na posição corrente de fd_dest)
+// RETORNO: bytes copiados, ou -1 se a chamada não é suportada
+static off_t copia_sendfile(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam) {
+    if (lseek(fd_dest, off_dest, SEEK_SET) < 0)
+        return -1;
+
+    off_t copiados = 0;
+    off_t pos = off_orig;
+
+    while (copiados < tam) {
+        ssize_t n = sendfile(fd_dest, fd_orig, &pos, tam - copiados);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (copiados == 0 && (errno == ENOSYS || errno == EINVAL))
+                return -1;
+            return copiados;
+        }
+        if (n == 0)
+            break;
+
+        copiados += n;
+    }
+
+    return copiados;
+}
+
+// Último recurso: pread/pwrite com buffer de tamanho fixo
+// RETORNO: bytes copiados
+static off_t copia_buffer(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam) {
+    unsigned char *buffer = malloc(TAM_BUFFER_COPIA);
+    if (!buffer)
+        return 0;
+
+    off_t copiados = 0;
+    while (copiados < tam) {
+        size_t pedaco = TAM_BUFFER_COPIA;
+        if ((off_t)pedaco > tam - copiados)
+            pedaco = tam - copiados;
+
+        ssize_t lidos = pread(fd_orig, buffer, pedaco, off_orig + copiados);
+        if (lidos < 0 && errno == EINTR)
+            continue;
+        if (lidos <= 0)
+            break;
+
+        // Escreve tudo que foi lido, tratando escritas parciais
+        ssize_t escritos = 0;
+        while (escritos < lidos) {
+            ssize_t n = pwrite(fd_dest, buffer + escritos, lidos - escritos,
+                               off_dest + copiados + escritos);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                free(buffer);
+                return copiados + escritos;
+            }
+            escritos += n;
+        }
+
+        copiados += lidos;
+    }
+
+    free(buffer);
+    return copiados;
+}
+
+int copia_intervalo(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam) {
+    if (tam <= 0)
+        return 0;
+
+    // Primeiro tenta o reflink da parte alinhada
+    off_t feito = clona_intervalo(fd_orig, off_orig, fd_dest, off_dest, tam);
+
+    while (feito < tam) {
+        off_t resto = tam - feito;
+
+        off_t n = copia_kernel(fd_orig, off_orig + feito, fd_dest, off_dest + feito, resto);
+        if (n < 0)
+            n = copia_sendfile(fd_orig, off_orig + feito, fd_dest, off_dest + feito, resto);
+        if (n < 0)
+            n = copia_buffer(fd_orig, off_orig + feito, fd_dest, off_dest + feito, resto);
+
+        // Nenhum método conseguiu avançar
+        if (n <= 0) {
+            fprintf(stderr, "Erro ao copiar %lld bytes do offset %lld\n",
+                    (long long)resto, (long long)(off_orig + feito));
+            return 1;
+        }
+
+        feito += n;
+    }
+
+    return 0;
+}
+
+int mapeia_arquivo(int fd, struct Mapa *mapa) {
+    mapa->dados = NULL;
+    mapa->tam = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Erro ao obter tamanho do arquivo\n");
+        return 1;
+    }
+
+    // Arquivo vazio: não há o que mapear
+    if (st.st_size == 0)
+        return 0;
+
+    void *dados = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (dados == MAP_FAILED) {
+        fprintf(stderr, "Erro ao mapear arquivo\n");
+        return 1;
+    }
+
+    mapa->dados = dados;
+    mapa->tam = st.st_size;
+    return 0;
+}
+
+void aconselha_intervalo(const struct Mapa *mapa, off_t offset, size_t tam, int conselho) {
+    if (!mapa->dados || tam == 0 || (size_t)offset >= mapa->tam)
+        return;
+
+    // madvise exige endereço alinhado à página
+    long pagina = sysconf(_SC_PAGESIZE);
+    off_t inicio = offset / pagina * pagina;
+    size_t fim = offset + tam;
+    if (fim > mapa->tam)
+        fim = mapa->tam;
+
+    madvise(mapa->dados + inicio, fim - inicio, conselho);
+}
+
+void desmapeia_arquivo(struct Mapa *mapa) {
+    if (mapa->dados)
+        munmap(mapa->dados, mapa->tam);
+
+    mapa->dados = NULL;
+    mapa->tam = 0;
+}
+
+int entrada_abre(struct Entrada *ent, const char *nome, size_t tam_pedaco) {
+    ent->pos = 0;
+    ent->buffer = NULL;
+    ent->tam_buffer = tam_pedaco;
+    ent->erro = 0;
+    ent->mapa.dados = NULL;
+    ent->mapa.tam = 0;
+    ent->regiao_inicio = 0;
+    ent->regiao_fim = 0;
+    ent->regiao_buraco = 0;
+
+    ent->fd = open(nome, O_RDONLY);
+    if (ent->fd < 0) {
+        fprintf(stderr, "Erro ao abrir arquivo: %s\n", nome);
+        return 1;
+    }
+
+    // Arquivos regulares não vazios são mapeados; o resto é lido com read()
+    struct stat st;
+    if (fstat(ent->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        mapeia_arquivo(ent->fd, &ent->mapa) == 0 && ent->mapa.dados) {
+        aconselha_intervalo(&ent->mapa, 0, ent->mapa.tam, MADV_SEQUENTIAL);
+        return 0;
+    }
+
+    ent->mapa.dados = NULL;
+    ent->mapa.tam = 0;
+    ent->buffer = malloc(tam_pedaco);
+    if (!ent->buffer) {
+        close(ent->fd);
+        ent->fd = -1;
+        return 1;
+    }
+
+    return 0;
+}
+
+size_t entrada_le(struct Entrada *ent, const unsigned char **dados) {
+
+    // Mapeada: o pedaço é uma janela do mapa
+    if (ent->mapa.dados) {
+        // O pedaço anterior já foi consumido
+        if (ent->pos > 0) {
+            size_t anterior = ent->pos >= ent->tam_buffer ? ent->tam_buffer : ent->pos;
+            aconselha_intervalo(&ent->mapa, ent->pos - anterior, anterior, MADV_DONTNEED);
+        }
+
+        if (ent->pos >= ent->mapa.tam)
+            return 0;
+
+        size_t tam = ent->mapa.tam - ent->pos;
+        if (tam > ent->tam_buffer)
+            tam = ent->tam_buffer;
+
+        *dados = ent->mapa.dados + ent->pos;
+        ent->pos += tam;
+        return tam;
+    }
+
+    // Sem mapa: enche o buffer, repetindo leituras curtas (pipes)
+    size_t lidos = 0;
+    while (lidos < ent->tam_buffer) {
+        ssize_t n = read(ent->fd, ent->buffer + lidos, ent->tam_buffer - lidos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "Erro ao ler arquivo de entrada\n");
+            ent->erro = 1;
+            break;
+        }
+        if (n == 0)
+            break;
+        lidos += n;
+    }
+
+    *dados = ent->buffer;
+    ent->pos += lidos;
+    return lidos;
+}
+
+int entrada_buraco(struct Entrada *ent, uint64_t inicio, size_t tam) {
+    if (!ent->mapa.dados || tam == 0)
+        return 0;
+
+    // Fora da última região: a que começa em 'inicio' é buraco até o
+    // próximo dado, ou dado até o próximo buraco
+    if (inicio < ent->regiao_inicio || inicio >= ent->regiao_fim) {
+        off_t dado = lseek(ent->fd, inicio, SEEK_DATA);
+        if (dado < 0 && errno == ENXIO)
+            dado = ent->mapa.tam;
+        ent->regiao_inicio = inicio;
+        if (dado < 0) {
+            // Sem suporte no sistema de arquivos: tudo é dado
+            ent->regiao_inicio = 0;
+            ent->regiao_fim = ent->mapa.tam;
+            ent->regiao_buraco = 0;
+        } else if ((uint64_t)dado > inicio) {
+            ent->regiao_fim = dado;
+            ent->regiao_buraco = 1;
+        } else {
+            off_t buraco = lseek(ent->fd, inicio, SEEK_HOLE);
+            ent->regiao_fim = buraco > dado ? (uint64_t)buraco : ent->mapa.tam;
+            ent->regiao_buraco = 0;
+        }
+    }
+
+    return ent->regiao_buraco && inicio + tam <= ent->regiao_fim;
+}
+
+int entrada_reinicia(struct Entrada *ent) {
+    if (!ent->mapa.dados)
+        return 1;
+
+    ent->pos = 0;
+    return 0;
+}
+
+void entrada_fecha(struct Entrada *ent) {
+    desmapeia_arquivo(&ent->mapa);
+    free(ent->buffer);
+    ent->buffer = NULL;
+    if (ent->fd >= 0)
+        close(ent->fd);
+    ent->fd = -1;
+}
+
+struct Antecipador {
+    const struct Mapa *mapa;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t trava;
+    pthread_cond_t sinal;
+    off_t offset;            // Pedido pendente
+    size_t tam;
+    int tem_pedido;          // 1 se há um pedido ainda não atendido
+    int encerrar;            // 1 quando a thread deve terminar
+};
+
+// Laço da thread: espera um pedido e toca uma vez cada página do intervalo,
+// abandonando-o se um pedido mais novo chegar
+static void *antecipa(void *arg) {
+    struct Antecipador *ant = arg;
+    long pagina = sysconf(_SC_PAGESIZE);
+    volatile unsigned char soma = 0;
+
+    pthread_mutex_lock(&ant->trava);
+    for (;;) {
+        while (!ant->tem_pedido && !ant->encerrar)
+            pthread_cond_wait(&ant->sinal, &ant->trava);
+        if (ant->encerrar)
+            break;
+
+        off_t inicio = ant->offset;
+        size_t fim = ant->offset + ant->tam;
+        ant->tem_pedido = 0;
+        pthread_mutex_unlock(&ant->trava);
+
+        for (size_t pos = inicio; pos < fim; pos += pagina) {
+            if (__atomic_load_n(&ant->tem_pedido, __ATOMIC_RELAXED) ||
+                __atomic_load_n(&ant->encerrar, __ATOMIC_RELAXED))
+                break;
+            soma += ant->mapa->dados[pos];
+        }
+
+        pthread_mutex_lock(&ant->trava);
+    }
+    pthread_mutex_unlock(&ant->trava);
+
+    return NULL;
+}
+
+struct Antecipador *antecipador_cria(const struct Mapa *mapa, int fd) {
+    struct Antecipador *ant = calloc(1, sizeof(struct Antecipador));
+    if (!ant)
+        return NULL;
+
+    ant->mapa = mapa;
+    ant->fd = fd;
+    pthread_mutex_init(&ant->trava, NULL);
+    pthread_cond_init(&ant->sinal, NULL);
+
+    if (pthread_create(&ant->thread, NULL, antecipa, ant) != 0) {
+        pthread_mutex_destroy(&ant->trava);
+        pthread_cond_destroy(&ant->sinal);
+        free(ant);
+        return NULL;
+    }
+
+    return ant;
+}
+
+void antecipador_pede(struct Antecipador *ant, off_t offset, size_t tam) {
+    if (!ant || !ant->mapa->dados || (size_t)offset >= ant->mapa->tam)
+        return;
+
+    if (tam > LIMITE_ANTECIPACAO)
+        tam = LIMITE_ANTECIPACAO;
+    if (tam > ant->mapa->tam - offset)
+        tam = ant->mapa->tam - offset;
+
+    // O kernel já começa a ler de forma assíncrona; a thread garante a
+    // sobreposição mesmo onde o conselho é ignorado (NFS, FUSE...)
+    posix_fadvise(ant->fd, offset, tam, POSIX_FADV_WILLNEED);
+
+    pthread_mutex_lock(&ant->trava);
+    ant->offset = offset;
+    ant->tam = tam;
+    __atomic_store_n(&ant->tem_pedido, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&ant->sinal);
+    pthread_mutex_unlock(&ant->trava);
+}
+
+void antecipador_destroi(struct Antecipador *ant) {
+    if (!ant)
+        return;
+
+    pthread_mutex_lock(&ant->trava);
+    __atomic_store_n(&ant->encerrar, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&ant->sinal);
+    pthread_mutex_unlock(&ant->trava);
+
+    pthread_join(ant->thread, NULL);
+    pthread_mutex_destroy(&ant->trava);
+    pthread_cond_destroy(&ant->sinal);
+    free(ant);
+}
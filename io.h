@@ -0,0 +1,110 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Alinhamento usado para membros grandes dentro do archive. Com os dados
+// alinhados ao bloco do sistema de arquivos, a cópia pode virar reflink.
+#define ALINHAMENTO_BLOCO 4096
+
+// Membros a partir deste tamanho (em disco) têm o offset alinhado
+#define TAM_MIN_ALINHADO (64 * 1024)
+
+// Tamanho do buffer usado quando a cópia precisa passar pelo espaço de usuário
+#define TAM_BUFFER_COPIA (1024 * 1024)
+
+// Copia 'tam' bytes de fd_orig (a partir de off_orig) para fd_dest (a partir
+// de off_dest). Tenta, em ordem: reflink (FICLONERANGE), copy_file_range,
+// sendfile e, por último, pread/pwrite com um buffer de tamanho fixo.
+// Não altera a posição corrente de fd_orig.
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int copia_intervalo(int fd_orig, off_t off_orig, int fd_dest, off_t off_dest, off_t tam);
+
+// Arredonda um offset para cima até o próximo múltiplo de ALINHAMENTO_BLOCO
+// RETORNO: offset alinhado
+off_t alinha_offset(off_t offset);
+
+// Abre 'caminho' para leitura e escrita com uma trava exclusiva (flock), que
+// exclui os outros escritores; leitores não travam nada. Se outro escritor
+// trocou o arquivo (rename) enquanto a trava era esperada, trava o novo. Com
+// 'criado' != NULL, um arquivo que não existe é criado vazio (e *criado = 1).
+// A trava é liberada com close.
+// RETORNO: descritor travado ou -1 em caso de erro
+int trava_arquivo(const char *caminho, int *criado);
+
+// Arquivo mapeado em memória, somente leitura
+struct Mapa {
+    unsigned char *dados;    // Início do mapeamento (NULL se o arquivo está vazio)
+    size_t tam;              // Tamanho mapeado
+};
+
+// Mapeia o arquivo inteiro aberto em fd (PROT_READ, MAP_PRIVATE)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int mapeia_arquivo(int fd, struct Mapa *mapa);
+
+// Repassa um conselho de acesso (MADV_*) para um intervalo do mapa.
+// O intervalo é expandido para os limites de página.
+void aconselha_intervalo(const struct Mapa *mapa, off_t offset, size_t tam, int conselho);
+
+// Desfaz o mapeamento
+void desmapeia_arquivo(struct Mapa *mapa);
+
+// Arquivo de entrada lido em pedaços. Arquivos regulares são mapeados e os
+// pedaços apontam direto para o mapa (sem cópia); pipes e arquivos especiais
+// são lidos com read() para um buffer de tamanho fixo.
+struct Entrada {
+    int fd;
+    struct Mapa mapa;        // mapa.dados != NULL se a entrada está mapeada
+    uint64_t pos;            // Próxima posição a ser lida
+    unsigned char *buffer;   // Buffer de leitura (só sem mapa)
+    size_t tam_buffer;
+    int erro;                // 1 se alguma leitura falhou
+    uint64_t regiao_inicio;  // Última região consultada por entrada_buraco
+    uint64_t regiao_fim;
+    int regiao_buraco;       // 1 se a região é um buraco, 0 se tem dados
+};
+
+// Abre 'nome' para leitura em pedaços de até 'tam_pedaco' bytes
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int entrada_abre(struct Entrada *ent, const char *nome, size_t tam_pedaco);
+
+// Diz se os 'tam' bytes a partir de 'inicio' são todos buraco do arquivo
+// (SEEK_DATA/SEEK_HOLE), sem ler nem tocar nas páginas. A região encontrada
+// fica guardada: há uma consulta ao kernel por região, não por pedaço.
+// Entradas lidas com read() (pipes) não têm buracos.
+// RETORNO: 1 se o trecho é todo buraco, 0 caso contrário
+int entrada_buraco(struct Entrada *ent, uint64_t inicio, size_t tam);
+
+// Obtém o próximo pedaço (até o tamanho dado em entrada_abre). O ponteiro é
+// válido até a próxima chamada. As páginas do pedaço anterior são liberadas.
+// RETORNO: bytes disponíveis em *dados; 0 no fim da entrada ou em erro
+size_t entrada_le(struct Entrada *ent, const unsigned char **dados);
+
+// Volta ao início da entrada
+// RETORNO: 0 em caso de sucesso, 1 se a entrada não permite (pipe)
+int entrada_reinicia(struct Entrada *ent);
+
+// Fecha a entrada
+void entrada_fecha(struct Entrada *ent);
+
+// Quanto do próximo membro é lido antecipadamente, em bytes
+#define LIMITE_ANTECIPACAO (8 * 1024 * 1024)
+
+// Leitura antecipada em segundo plano: enquanto um membro é descomprimido e
+// escrito, uma thread traz para a memória as páginas do próximo
+struct Antecipador;
+
+// Cria o antecipador para o arquivo 'fd' mapeado em 'mapa'
+// RETORNO: ponteiro para o antecipador ou NULL em caso de erro
+struct Antecipador *antecipador_cria(const struct Mapa *mapa, int fd);
+
+// Pede a leitura antecipada de um intervalo (substitui o pedido anterior).
+// Não bloqueia: avisa o kernel (posix_fadvise) e acorda a thread.
+void antecipador_pede(struct Antecipador *ant, off_t offset, size_t tam);
+
+// Encerra a thread e libera o antecipador
+void antecipador_destroi(struct Antecipador *ant);
+
+#endif
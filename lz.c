@@ -51,6 +51,12 @@
 * With this compression scheme, the worst case compression result is
 * (257/256)*insize + 1.
 *
+* Modified for vinac: LZ_CompressDelta() and LZ_UncompressDelta() code a
+* block against a preloaded history (delta versions), and LZ_Uncompress()
+* shares its loop with LZ_UncompressDelta(). Both decoders are given the
+* size of the output buffer and report corrupted input instead of writing
+* outside of it.
+*
 *-------------------------------------------------------------------------
 * Copyright (c) 2003-2006 Marcus Geelnard
 *
@@ -88,6 +94,19 @@
    you. */
 #define LZ_MAX_OFFSET 100000
 
+/* Maximum number of hash chain candidates tried per position by
+   LZ_CompressDelta(), and the match length from which the chain is not
+   searched at all. */
+#define LZ_DELTA_MAX_CHAIN 32
+#define LZ_DELTA_GOOD_LENGTH 32
+
+/* Size (in bits) of the history table of LZ_CompressDelta(), and the
+   distance between the history positions it holds. Every position of the
+   data is looked up, so a copy found in the history is never more than
+   LZ_DELTA_HIST_STEP bytes late. */
+#define LZ_DELTA_HASH_BITS 18
+#define LZ_DELTA_HIST_STEP 8
+
 
 
 /*************************************************************************
@@ -174,6 +193,132 @@ static int _LZ_ReadVarSize( unsigned int * x, unsigned char * buf )
 
 
 
+/*************************************************************************
+* _LZ_Hash4() - Return a 16-bit hash of the four bytes at buf.
+*************************************************************************/
+
+static unsigned int _LZ_Hash4( unsigned char * buf )
+{
+    unsigned int x;
+
+    x = ((unsigned int) buf[0]) | (((unsigned int) buf[1]) << 8) |
+        (((unsigned int) buf[2]) << 16) | (((unsigned int) buf[3]) << 24);
+    return (x * 2654435761u) >> 16;
+}
+
+
+/*************************************************************************
+* _LZ_Hash16() - Return a hash of the sixteen bytes at buf, with
+* LZ_DELTA_HASH_BITS bits.
+*************************************************************************/
+
+static unsigned int _LZ_Hash16( unsigned char * buf )
+{
+    unsigned int x, i;
+
+    x = 0;
+    for( i = 0; i < 16; ++ i )
+    {
+        x = (x + buf[ i ]) * 2654435761u;
+    }
+    return x >> (32 - LZ_DELTA_HASH_BITS);
+}
+
+
+/*************************************************************************
+* _LZ_Uncompress() - Uncompress a block of data, writing it to out from
+* position outpos on (the bytes before it are the history) and never past
+* position outend. Corrupted input (a truncated code, a copy from before
+* the start of out or past outend) is detected instead of followed.
+* Returns the position after the last byte written, or -1 on error.
+*************************************************************************/
+
+static int _LZ_Uncompress( unsigned char *in, unsigned char *out,
+    unsigned int insize, unsigned int outpos, unsigned int outend )
+{
+    unsigned char marker, symbol;
+    unsigned int  i, k, inpos, length, offset;
+
+    /* Do we have anything to uncompress? */
+    if( insize < 1 )
+    {
+        return outpos;
+    }
+
+    /* Get marker symbol from input stream */
+    marker = in[ 0 ];
+    inpos = 1;
+
+    /* Main decompression loop */
+    while( inpos < insize )
+    {
+        symbol = in[ inpos ++ ];
+        if( symbol == marker )
+        {
+            /* We had a marker byte */
+            if( inpos >= insize )
+            {
+                return -1;
+            }
+            if( in[ inpos ] == 0 )
+            {
+                /* It was a single occurrence of the marker byte */
+                if( outpos >= outend )
+                {
+                    return -1;
+                }
+                out[ outpos ++ ] = marker;
+                ++ inpos;
+            }
+            else
+            {
+                /* Extract true length and offset (at most five bytes
+                   each, all of them inside the input) */
+                for( k = 0; k < 2; ++ k )
+                {
+                    i = 0;
+                    while( inpos + i < insize && i < 5 &&
+                           ( in[ inpos + i ] & 0x80 ) )
+                    {
+                        ++ i;
+                    }
+                    if( inpos + i >= insize || i == 5 )
+                    {
+                        return -1;
+                    }
+                    inpos += _LZ_ReadVarSize( k ? &offset : &length,
+                                              &in[ inpos ] );
+                }
+                if( offset < 1 || offset > outpos ||
+                    length > outend - outpos )
+                {
+                    return -1;
+                }
+
+                /* Copy corresponding data from history window */
+                for( i = 0; i < length; ++ i )
+                {
+                    out[ outpos ] = out[ outpos - offset ];
+                    ++ outpos;
+                }
+            }
+        }
+        else
+        {
+            /* No marker, plain copy */
+            if( outpos >= outend )
+            {
+                return -1;
+            }
+            out[ outpos ++ ] = symbol;
+        }
+    }
+
+    return outpos;
+}
+
+
+
 /*************************************************************************
 *                            PUBLIC FUNCTIONS                            *
 *************************************************************************/
@@ -405,7 +550,8 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
         bestlength = 3;
         bestoffset = 0;
         index = jumptable[ inpos ];
-        while( (index != 0xffffffff) && ((inpos - index) < LZ_MAX_OFFSET) )
+        while( (index != 0xffffffff) && ((inpos - index) < LZ_MAX_OFFSET) &&
+               (bestlength < bytesleft) )
         {
             /* Get pointer to candidate string */
             ptr2 = &in[ index ];
@@ -413,9 +559,12 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
             /* Quickly determine if this is a candidate (for speed) */
             if( ptr2[ bestlength ] == ptr1[ bestlength ] )
             {
-                /* Determine maximum length for this offset */
+                /* The match may run into the current position (the decoder
+                   copies byte by byte), so a run of a repeated byte or
+                   pattern is found whole at the nearest offset instead of
+                   being searched for along the whole chain */
                 offset = inpos - index;
-                maxlength = (bytesleft < offset ? bytesleft : offset);
+                maxlength = bytesleft;
 
                 /* Count maximum length match at this offset */
                 length = _LZ_StringCompare( ptr1, ptr2, 2, maxlength );
@@ -481,60 +630,267 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
 /*************************************************************************
 * LZ_Uncompress() - Uncompress a block of data using an LZ77 decoder.
 *  in      - Input (compressed) buffer.
-*  out     - Output (uncompressed) buffer. This buffer must be large
-*            enough to hold the uncompressed data.
+*  out     - Output (uncompressed) buffer.
 *  insize  - Number of input bytes.
+*  outsize - Size of the output buffer.
+* The function returns the size of the uncompressed data, or -1 if the
+* input is corrupted (it would not fit in outsize bytes, or is not a valid
+* code).
 *************************************************************************/
 
-void LZ_Uncompress( unsigned char *in, unsigned char *out,
-    unsigned int insize )
+int LZ_Uncompress( unsigned char *in, unsigned char *out,
+    unsigned int insize, unsigned int outsize )
+{
+    return _LZ_Uncompress( in, out, insize, 0, outsize );
+}
+
+
+/*************************************************************************
+* LZ_CompressDelta() - Compress a block of data using an LZ77 coder, with
+* a preloaded history (for instance, the previous version of the same
+* data). The history itself is not stored: the decoder must be given the
+* same history (see LZ_UncompressDelta()).
+*  in       - Input buffer: histsize bytes of history, immediately
+*             followed by the insize bytes to be compressed.
+*  histsize - Number of history bytes.
+*  out      - Output (compressed) buffer. This buffer must be 0.4% larger
+*             than insize, plus one byte.
+*  insize   - Number of input bytes (after the history).
+*  work     - Pointer to a temporary buffer (internal working buffer),
+*             which must be able to hold LZ_DELTA_WORKSIZE(histsize,
+*             insize) unsigned integers.
+* Unlike LZ_CompressFast(), matches may be anywhere in the history and
+* in the data before the current position (there is no LZ_MAX_OFFSET).
+* Candidates come from a jump table indexed by a hash of four bytes, and
+* at most LZ_DELTA_MAX_CHAIN of them are tried per position. The offset of
+* the previous match and of the previous long match and the same position
+* in the history are tried first, which quickly finds the unchanged parts
+* of a new version. A second table, indexed by a hash of sixteen bytes,
+* points into the history: it finds the old copy of the data again after
+* an insertion or deletion, where nearby repeats of short strings would
+* fill the jump table chain.
+* The function returns the size of the compressed data.
+*************************************************************************/
+
+int LZ_CompressDelta( unsigned char *in, unsigned int histsize,
+    unsigned char *out, unsigned int insize, unsigned int *work )
 {
     unsigned char marker, symbol;
-    unsigned int  i, inpos, outpos, length, offset;
+    unsigned int  inpos, outpos, bytesleft, i, index, hash, total, steps;
+    unsigned int  offset, bestoffset, lastoffset, longoffset, candidates[ 4 ];
+    unsigned int  maxlength, length, bestlength;
+    unsigned int  histogram[ 256 ], *lastindex, *histindex, *jumptable;
+    unsigned char *ptr1, *ptr2;
 
-    /* Do we have anything to uncompress? */
+    /* Do we have anything to compress? */
     if( insize < 1 )
     {
-        return;
+        return 0;
     }
 
-    /* Get marker symbol from input stream */
-    marker = in[ 0 ];
-    inpos = 1;
+    /* Assign arrays to the working area */
+    lastindex = work;
+    histindex = &work[ 65536 ];
+    jumptable = &histindex[ 1 << LZ_DELTA_HASH_BITS ];
+    total = histsize + insize;
 
-    /* Main decompression loop */
-    outpos = 0;
+    /* Build the jump table over history and data: jumptable[i] points to
+       the nearest previous position with the same hash of four bytes */
+    for( i = 0; i < 65536; ++ i )
+    {
+        lastindex[ i ] = 0xffffffff;
+    }
+    for( i = 0; i + 3 < total; ++ i )
+    {
+        hash = _LZ_Hash4( &in[ i ] );
+        jumptable[ i ] = lastindex[ hash ];
+        lastindex[ hash ] = i;
+    }
+    for( ; i < total; ++ i )
+    {
+        jumptable[ i ] = 0xffffffff;
+    }
+
+    /* Build the history table: histindex[h] is the last sampled position
+       in the history with the hash h of sixteen bytes */
+    for( i = 0; i < (1 << LZ_DELTA_HASH_BITS); ++ i )
+    {
+        histindex[ i ] = 0xffffffff;
+    }
+    for( i = 0; i + 16 <= histsize; i += LZ_DELTA_HIST_STEP )
+    {
+        histindex[ _LZ_Hash16( &in[ i ] ) ] = i;
+    }
+
+    /* Create histogram (of the data only: the history is not coded) */
+    for( i = 0; i < 256; ++ i )
+    {
+        histogram[ i ] = 0;
+    }
+    for( i = histsize; i < total; ++ i )
+    {
+        ++ histogram[ in[ i ] ];
+    }
+
+    /* Find the least common byte, and use it as the marker symbol */
+    marker = 0;
+    for( i = 1; i < 256; ++ i )
+    {
+        if( histogram[ i ] < histogram[ marker ] )
+        {
+            marker = i;
+        }
+    }
+
+    /* Remember the marker symbol for the decoder */
+    out[ 0 ] = marker;
+
+    /* Start of compression */
+    inpos = histsize;
+    outpos = 1;
+    lastoffset = 0;
+    longoffset = 0;
+
+    /* Main compression loop */
+    bytesleft = insize;
     do
     {
-        symbol = in[ inpos ++ ];
-        if( symbol == marker )
+        /* Get pointer to current position */
+        ptr1 = &in[ inpos ];
+        bestlength = 3;
+        bestoffset = 0;
+
+        /* Try the offsets of the previous match and of the previous long
+           match, the same position in the history and the history table */
+        candidates[ 0 ] = lastoffset;
+        candidates[ 1 ] = longoffset;
+        candidates[ 2 ] = histsize;
+        candidates[ 3 ] = 0;
+        if( bytesleft >= 16 )
         {
-            /* We had a marker byte */
-            if( in[ inpos ] == 0 )
+            index = histindex[ _LZ_Hash16( ptr1 ) ];
+            if( index != 0xffffffff )
             {
-                /* It was a single occurrence of the marker byte */
-                out[ outpos ++ ] = marker;
-                ++ inpos;
+                candidates[ 3 ] = inpos - index;
             }
-            else
+        }
+        for( i = 0; i < 4; ++ i )
+        {
+            offset = candidates[ i ];
+            if( (offset == 0) || (offset > inpos) )
+            {
+                continue;
+            }
+            maxlength = (bytesleft < offset ? bytesleft : offset);
+            length = _LZ_StringCompare( ptr1, ptr1 - offset, 0, maxlength );
+            if( length > bestlength )
             {
-                /* Extract true length and offset */
-                inpos += _LZ_ReadVarSize( &length, &in[ inpos ] );
-                inpos += _LZ_ReadVarSize( &offset, &in[ inpos ] );
+                bestlength = length;
+                bestoffset = offset;
+            }
+        }
 
-                /* Copy corresponding data from history window */
-                for( i = 0; i < length; ++ i )
+        /* Search the jump table, unless a long match was already found */
+        index = jumptable[ inpos ];
+        steps = 0;
+        while( (index != 0xffffffff) && (steps < LZ_DELTA_MAX_CHAIN) &&
+               (bestlength < LZ_DELTA_GOOD_LENGTH) && (bestlength < bytesleft) )
+        {
+            /* Get pointer to candidate string */
+            ptr2 = &in[ index ];
+
+            /* Quickly determine if this is a candidate (for speed) */
+            if( ptr2[ bestlength ] == ptr1[ bestlength ] )
+            {
+                /* Determine maximum length for this offset */
+                offset = inpos - index;
+                maxlength = (bytesleft < offset ? bytesleft : offset);
+
+                /* Count maximum length match at this offset */
+                length = _LZ_StringCompare( ptr1, ptr2, 0, maxlength );
+
+                /* Better match than any previous match? */
+                if( length > bestlength )
                 {
-                    out[ outpos ] = out[ outpos - offset ];
-                    ++ outpos;
+                    bestlength = length;
+                    bestoffset = offset;
                 }
             }
+
+            /* Get next possible index from jump table */
+            index = jumptable[ index ];
+            ++ steps;
+        }
+
+        /* Was there a good enough match? */
+        if( (bestlength >= 8) ||
+            ((bestlength == 4) && (bestoffset <= 0x0000007f)) ||
+            ((bestlength == 5) && (bestoffset <= 0x00003fff)) ||
+            ((bestlength == 6) && (bestoffset <= 0x001fffff)) ||
+            ((bestlength == 7) && (bestoffset <= 0x0fffffff)) )
+        {
+            out[ outpos ++ ] = (unsigned char) marker;
+            outpos += _LZ_WriteVarSize( bestlength, &out[ outpos ] );
+            outpos += _LZ_WriteVarSize( bestoffset, &out[ outpos ] );
+            inpos += bestlength;
+            bytesleft -= bestlength;
+            lastoffset = bestoffset;
+            if( bestlength >= LZ_DELTA_GOOD_LENGTH )
+            {
+                longoffset = bestoffset;
+            }
         }
         else
         {
-            /* No marker, plain copy */
+            /* Output single byte (or two bytes if marker byte) */
+            symbol = in[ inpos ++ ];
             out[ outpos ++ ] = symbol;
+            if( symbol == marker )
+            {
+                out[ outpos ++ ] = 0;
+            }
+            -- bytesleft;
         }
     }
-    while( inpos < insize );
+    while( bytesleft > 3 );
+
+    /* Dump remaining bytes, if any */
+    while( inpos < total )
+    {
+        if( in[ inpos ] == marker )
+        {
+            out[ outpos ++ ] = marker;
+            out[ outpos ++ ] = 0;
+        }
+        else
+        {
+            out[ outpos ++ ] = in[ inpos ];
+        }
+        ++ inpos;
+    }
+
+    return outpos;
+}
+
+
+/*************************************************************************
+* LZ_UncompressDelta() - Uncompress a block of data coded with
+* LZ_CompressDelta().
+*  in       - Input (compressed) buffer.
+*  out      - Output buffer: it must start with the same histsize bytes of
+*             history given to the coder, and have room after them for the
+*             uncompressed data, which is written at out+histsize.
+*  insize   - Number of input bytes.
+*  histsize - Number of history bytes at the start of out.
+*  outsize  - Room for uncompressed data after the history.
+* The function returns the size of the uncompressed data (not counting the
+* history), or -1 if the input is corrupted.
+*************************************************************************/
+
+int LZ_UncompressDelta( unsigned char *in, unsigned char *out,
+    unsigned int insize, unsigned int histsize, unsigned int outsize )
+{
+    int outpos = _LZ_Uncompress( in, out, insize, histsize,
+                                 histsize + outsize );
+    return outpos < 0 ? -1 : outpos - (int) histsize;
 }
@@ -37,6 +37,14 @@ extern "C" {
 #endif
 
 
+/*************************************************************************
+* Constants
+*************************************************************************/
+
+/* Size, in unsigned integers, of the work buffer of LZ_CompressDelta() */
+#define LZ_DELTA_WORKSIZE( histsize, insize ) ((histsize) + (insize) + 327680)
+
+
 /*************************************************************************
 * Function prototypes
 *************************************************************************/
@@ -45,8 +53,14 @@ int LZ_Compress( unsigned char *in, unsigned char *out,
                  unsigned int insize );
 int LZ_CompressFast( unsigned char *in, unsigned char *out,
                      unsigned int insize, unsigned int *work );
-void LZ_Uncompress( unsigned char *in, unsigned char *out,
-                    unsigned int insize );
+int LZ_Uncompress( unsigned char *in, unsigned char *out,
+                   unsigned int insize, unsigned int outsize );
+int LZ_CompressDelta( unsigned char *in, unsigned int histsize,
+                      unsigned char *out, unsigned int insize,
+                      unsigned int *work );
+int LZ_UncompressDelta( unsigned char *in, unsigned char *out,
+                        unsigned int insize, unsigned int histsize,
+                        unsigned int outsize );
 
 
 #ifdef __cplusplus
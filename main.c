@@ -1,61 +1,186 @@
 #include "archive.h"
+#include "metricas.h"
+#include "servidor.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+// Lê um tamanho em bytes, com sufixo K, M ou G opcional
+// RETORNO: 0 em caso de sucesso, 1 se o texto não é um tamanho válido
+static int le_tamanho(const char *texto, uint64_t *tam) {
+    char *fim;
+    unsigned long long valor = strtoull(texto, &fim, 10);
+    int deslocamento = *fim == 'K' ? 10 : *fim == 'M' ? 20 : *fim == 'G' ? 30 : 0;
+    if (deslocamento)
+        fim++;
+    if (fim == texto || *fim || texto[0] == '-' || valor > (UINT64_MAX >> deslocamento))
+        return 1;
+    *tam = (uint64_t)valor << deslocamento;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
+
+    // Padrões de --incluir/--excluir (no máximo um por argumento)
+    const char **incluir = malloc(argc * sizeof(char *));
+    const char **excluir = malloc(argc * sizeof(char *));
+    if (!incluir || !excluir) {
+        fprintf(stderr, "Erro ao alocar memória\n");
+        return 1;
+    }
+    opcoes.filtro.incluir = incluir;
+    opcoes.filtro.excluir = excluir;
+
+    // --estatisticas: 1 em texto, 2 em JSON
+    int estatisticas = 0;
+
+    // --cache (servidor)
+    uint64_t tam_cache = TAM_CACHE_PADRAO;
+
+    // Opções gerais (--... e -v) vêm antes da operação; removidas de argv
+    while (argc > 1 && (strncmp(argv[1], "--", 2) == 0 || strcmp(argv[1], "-v") == 0)) {
+        if (strcmp(argv[1], "--verificar") == 0) {
+            opcoes.verificar = 1;
+        } else if (strcmp(argv[1], "--solido") == 0) {
+            opcoes.solido = 1;
+        } else if (strcmp(argv[1], "--reordenar") == 0) {
+            opcoes.reordenar = 1;
+        } else if (strcmp(argv[1], "--conferir-conteudo") == 0) {
+            opcoes.conferir_conteudo = 1;
+        } else if (strcmp(argv[1], "--delta") == 0) {
+            opcoes.delta = LIMITE_CADEIA_PADRAO;
+        } else if (strncmp(argv[1], "--delta=", 8) == 0) {
+            char *fim;
+            long limite = strtol(argv[1] + 8, &fim, 10);
+            if (fim == argv[1] + 8 || *fim || limite < 1 || limite > LIMITE_CADEIA_MAX) {
+                fprintf(stderr, "Erro: Limite de cadeia de deltas inválido (1 a %d): %s\n",
+                        LIMITE_CADEIA_MAX, argv[1] + 8);
+                return 1;
+            }
+            opcoes.delta = limite;
+        } else if (strncmp(argv[1], "--incluir=", 10) == 0) {
+            incluir[opcoes.filtro.num_incluir++] = argv[1] + 10;
+        } else if (strncmp(argv[1], "--excluir=", 10) == 0) {
+            excluir[opcoes.filtro.num_excluir++] = argv[1] + 10;
+        } else if (strncmp(argv[1], "--threads=", 10) == 0) {
+            opcoes.threads = atoi(argv[1] + 10);
+            if (opcoes.threads <= 0) {
+                fprintf(stderr, "Erro: Número de threads inválido: %s\n", argv[1] + 10);
+                return 1;
+            }
+        } else if (strncmp(argv[1], "--embutir=", 10) == 0) {
+            char *fim;
+            long limite = strtol(argv[1] + 10, &fim, 10);
+            if (fim == argv[1] + 10 || *fim || limite < 0 || limite > LIMITE_EMBUTIDO_MAX) {
+                fprintf(stderr, "Erro: Limite de embutidos inválido: %s\n", argv[1] + 10);
+                return 1;
+            }
+            opcoes.embutir = limite;
+        } else if (strncmp(argv[1], "--limite-memoria=", 17) == 0) {
+            if (le_tamanho(argv[1] + 17, &opcoes.limite_memoria) != 0 ||
+                opcoes.limite_memoria < LIMITE_MEMORIA_MIN) {
+                fprintf(stderr, "Erro: Limite de memória inválido (mínimo %dM): %s\n",
+                        LIMITE_MEMORIA_MIN >> 20, argv[1] + 17);
+                return 1;
+            }
+        } else if (strncmp(argv[1], "--cache=", 8) == 0) {
+            if (le_tamanho(argv[1] + 8, &tam_cache) != 0) {
+                fprintf(stderr, "Erro: Tamanho de cache inválido: %s\n", argv[1] + 8);
+                return 1;
+            }
+        } else if (strcmp(argv[1], "--estatisticas") == 0 || strcmp(argv[1], "-v") == 0) {
+            estatisticas = 1;
+        } else if (strcmp(argv[1], "--estatisticas=json") == 0) {
+            estatisticas = 2;
+        } else {
+            fprintf(stderr, "Erro: Opção desconhecida: %s\n", argv[1]);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc < 3) {
-        fprintf(stderr, "Uso: %s <opção> <arquivo> [membros...]\n", argv[0]);
+        fprintf(stderr, "Uso: %s [--verificar] [--solido] [--reordenar] [--conferir-conteudo] [--delta[=N]] [--incluir=PADRÃO] [--excluir=PADRÃO] [--threads=N]"
+                        " [--embutir=BYTES] [--limite-memoria=TAM[K|M|G]] [-v|--estatisticas[=json]]"
+                        " [--cache=TAM[K|M|G]] <opção> <arquivo> [membros...]\n"
+                        "     %s -s <socket>  |  %s -g|-gd <socket> <archive> <membro>\n",
+                argv[0], argv[0], argv[0]);
         return 1;
     }
 
     const char *opcao = argv[1];
     const char *arquivo = argv[2];
+    int resultado;
 
-    if (strcmp(opcao, "-ip") == 0 || strcmp(opcao, "-ic") == 0) {
-        // Inserir membros com compressão
+    if (strcmp(opcao, "-ip") == 0 || strcmp(opcao, "-ic") == 0 || strcmp(opcao, "-u") == 0) {
+        // Inserir membros com compressão (-u: só os que mudaram)
         if (argc < 4) {
             fprintf(stderr, "Erro: Faltando nome do membro para inserir\n");
             return 1;
         }
         
-        // Insere cada membro especificado com compressão
-        for (int i = 3; i < argc; i++) {
-            int resultado = inserir_membro(arquivo, argv[i], 1); // Com compressão
-            if (resultado != 0) {
-                fprintf(stderr, "Erro ao inserir membro: %s\n", argv[i]);
-                return resultado;
-            }
-        }
-        return 0;
+        // Insere os membros especificados com compressão; diretórios são
+        // percorridos recursivamente
+        opcoes.atualizar = strcmp(opcao, "-u") == 0;
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
+        resultado = inserir_caminhos(arquivo, (const char **)&argv[3], argc - 3, 1);
     } else if (strcmp(opcao, "-x") == 0) {
         // Extrair membros
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
         if (argc == 3) {
             // Extrair todos os membros
-            return extrair_membros(arquivo, NULL, 0);
+            resultado = extrair_membros(arquivo, NULL, 0);
         } else {
             // Extrair membros específicos
-            return extrair_membros(arquivo, (const char **)&argv[3], argc - 3);
+            resultado = extrair_membros(arquivo, (const char **)&argv[3], argc - 3);
         }
+    } else if (strcmp(opcao, "-t") == 0) {
+        // Testar a integridade dos membros (todos, se nenhum é indicado)
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
+        resultado = testar_membros(arquivo, argc == 3 ? NULL : (const char **)&argv[3], argc - 3);
     } else if (strcmp(opcao, "-d") == 0) {
         // Listar diretório
-        return listar_conteudo(arquivo);
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
+        resultado = listar_conteudo(arquivo);
     } else if (strcmp(opcao, "-r") == 0) {
         // Remover membro
         if (argc < 4) {
             fprintf(stderr, "Erro: Faltando nome do membro para remover\n");
             return 1;
         }
-        return remover_membros(arquivo, (const char **)&argv[3], argc - 3);
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
+        resultado = remover_membros(arquivo, (const char **)&argv[3], argc - 3);
     } else if (strcmp(opcao, "-m") == 0) {
         // Mover membro
         if (argc < 5) {
             fprintf(stderr, "Uso: %s -m <arquivo> <membro> <alvo>\n", argv[0]);
             return 1;
         }
-        return mover_membro(arquivo, argv[3], argv[4]);
+        if (estatisticas)
+            metricas_inicia(opcao, estatisticas == 2);
+        resultado = mover_membro(arquivo, argv[3], argv[4]);
+    } else if (strcmp(opcao, "-s") == 0) {
+        // Servidor de extração no socket 'arquivo' (--threads trabalhadoras)
+        return servidor_executa(arquivo, tam_cache, opcoes.threads);
+    } else if (strcmp(opcao, "-g") == 0 || strcmp(opcao, "-gd") == 0) {
+        // Lê um membro pelo servidor (por descritor com -gd)
+        if (argc < 5) {
+            fprintf(stderr, "Uso: %s %s <socket> <archive> <membro>\n", argv[0], opcao);
+            return 1;
+        }
+        return cliente_le(arquivo, argv[3], argv[4], strcmp(opcao, "-gd") == 0);
     } else {
         fprintf(stderr, "Erro: Opção desconhecida: %s\n", opcao);
         return 1;
     }
+
+    metricas_finaliza(resultado);
+    return resultado;
 }
\ No newline at end of file
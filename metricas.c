@@ -0,0 +1,163 @@
+#include "metricas.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char *nomes_fases[NUM_FASES] = {
+    "leitura", "compressao", "descompressao", "escrita", "copia", "diretorio"
+};
+
+// Contadores de E/S do processo (/proc/self/io)
+struct ContadoresES {
+    uint64_t chamadas_leitura;   // syscr
+    uint64_t chamadas_escrita;   // syscw
+    int valido;
+};
+
+// Estado da coleta (uma operação por execução)
+static struct {
+    int ligado;
+    int json;
+    const char *operacao;
+    uint64_t inicio;
+    uint64_t fases[NUM_FASES];
+    uint64_t bytes_entrada;
+    uint64_t bytes_saida;
+    uint64_t membros;
+    struct ContadoresES es_inicial;
+} met;
+
+// Lê os contadores de chamadas de leitura e escrita do processo
+// RETORNO: contadores (valido == 0 se /proc não está disponível)
+static struct ContadoresES le_contadores(void) {
+    struct ContadoresES c = { 0, 0, 0 };
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f)
+        return c;
+
+    char linha[128];
+    int achados = 0;
+    while (fgets(linha, sizeof(linha), f)) {
+        if (sscanf(linha, "syscr: %" SCNu64, &c.chamadas_leitura) == 1 ||
+            sscanf(linha, "syscw: %" SCNu64, &c.chamadas_escrita) == 1)
+            achados++;
+    }
+    fclose(f);
+    c.valido = achados == 2;
+    return c;
+}
+
+// Escreve 'texto' como string JSON (com aspas e escapes)
+static void escreve_json(const char *texto) {
+    fputc('"', stderr);
+    for (const unsigned char *p = (const unsigned char *)texto; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(stderr, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(stderr, "\\u%04x", *p);
+        else
+            fputc(*p, stderr);
+    }
+    fputc('"', stderr);
+}
+
+void metricas_inicia(const char *operacao, int json) {
+    memset(&met, 0, sizeof(met));
+    met.ligado = 1;
+    met.json = json;
+    met.operacao = operacao;
+    met.inicio = metricas_relogio();
+    met.es_inicial = le_contadores();
+
+    // Os membros vêm antes dos totais, escritos à medida que são registrados
+    if (json) {
+        fprintf(stderr, "{\"operacao\":");
+        escreve_json(operacao);
+        fprintf(stderr, ",\"membros\":[");
+    }
+}
+
+uint64_t metricas_relogio(void) {
+    if (!met.ligado)
+        return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Fases e bytes também são somados pelas trabalhadoras do teste (-t)
+void metricas_fase(enum Fase fase, uint64_t inicio) {
+    if (met.ligado)
+        __atomic_fetch_add(&met.fases[fase], metricas_relogio() - inicio, __ATOMIC_RELAXED);
+}
+
+void metricas_bytes(uint64_t entrada, uint64_t saida) {
+    __atomic_fetch_add(&met.bytes_entrada, entrada, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&met.bytes_saida, saida, __ATOMIC_RELAXED);
+}
+
+void metricas_membro(const char *nome, uint64_t tam_orig, uint64_t tam_disco, uint64_t inicio) {
+    if (!met.ligado)
+        return;
+
+    double segundos = (metricas_relogio() - inicio) / 1e9;
+    if (met.json) {
+        fprintf(stderr, "%s\n{\"nome\":", met.membros ? "," : "");
+        escreve_json(nome);
+        fprintf(stderr, ",\"tam_orig\":%" PRIu64 ",\"tam_disco\":%" PRIu64 ",\"tempo_s\":%.6f}",
+                tam_orig, tam_disco, segundos);
+    } else {
+        fprintf(stderr, "%s: %" PRIu64 " -> %" PRIu64 " bytes em %.3f ms\n",
+                nome, tam_orig, tam_disco, segundos * 1e3);
+    }
+    met.membros++;
+}
+
+void metricas_finaliza(int resultado) {
+    if (!met.ligado)
+        return;
+
+    double total = (metricas_relogio() - met.inicio) / 1e9;
+    uint64_t maior = met.bytes_entrada > met.bytes_saida ? met.bytes_entrada : met.bytes_saida;
+    double razao = met.bytes_entrada ? (double)met.bytes_saida / met.bytes_entrada : 0;
+    double vazao = total > 0 ? maior / total / (1024 * 1024) : 0;
+
+    struct ContadoresES es = le_contadores();
+    uint64_t leituras = es.chamadas_leitura - met.es_inicial.chamadas_leitura;
+    uint64_t escritas = es.chamadas_escrita - met.es_inicial.chamadas_escrita;
+    int com_es = es.valido && met.es_inicial.valido;
+
+    struct rusage uso;
+    if (getrusage(RUSAGE_SELF, &uso) != 0)
+        memset(&uso, 0, sizeof(uso));
+
+    if (met.json) {
+        fprintf(stderr, "],\"resultado\":%d,\"tempo_s\":%.6f,\"fases_s\":{", resultado, total);
+        for (int f = 0; f < NUM_FASES; f++)
+            fprintf(stderr, "%s\"%s\":%.6f", f ? "," : "", nomes_fases[f], met.fases[f] / 1e9);
+        fprintf(stderr, "},\"num_membros\":%" PRIu64 ",\"bytes_entrada\":%" PRIu64
+                        ",\"bytes_saida\":%" PRIu64 ",\"razao\":%.4f,\"vazao_mib_s\":%.2f",
+                met.membros, met.bytes_entrada, met.bytes_saida, razao, vazao);
+        if (com_es)
+            fprintf(stderr, ",\"chamadas\":{\"leitura\":%" PRIu64 ",\"escrita\":%" PRIu64 "}",
+                    leituras, escritas);
+        fprintf(stderr, ",\"pico_rss_kb\":%ld,\"faltas_pagina\":%ld}\n",
+                uso.ru_maxrss, uso.ru_minflt + uso.ru_majflt);
+    } else {
+        fprintf(stderr, "Operação %s: resultado %d, %.3f s\n", met.operacao, resultado, total);
+        for (int f = 0; f < NUM_FASES; f++)
+            if (met.fases[f])
+                fprintf(stderr, "  %-14s %10.3f s\n", nomes_fases[f], met.fases[f] / 1e9);
+        fprintf(stderr, "  membros: %" PRIu64 ", bytes: %" PRIu64 " -> %" PRIu64
+                        " (razão %.4f), %.2f MiB/s\n",
+                met.membros, met.bytes_entrada, met.bytes_saida, razao, vazao);
+        if (com_es)
+            fprintf(stderr, "  chamadas de leitura: %" PRIu64 ", de escrita: %" PRIu64 "\n",
+                    leituras, escritas);
+        fprintf(stderr, "  pico de RSS: %ld KB, faltas de página: %ld\n",
+                uso.ru_maxrss, uso.ru_minflt + uso.ru_majflt);
+    }
+}
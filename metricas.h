@@ -0,0 +1,44 @@
+#ifndef METRICAS_H
+#define METRICAS_H
+
+#include <stdint.h>
+
+// Métricas de uma operação (--estatisticas): tempo gasto em cada fase, bytes
+// lidos e gravados, um registro por membro, chamadas de leitura e escrita ao
+// sistema e pico de memória. Com a coleta desligada os relógios não são
+// lidos e as funções só testam uma variável.
+enum Fase {
+    FASE_LEITURA,            // Leitura das entradas (arquivos ou fluxo)
+    FASE_COMPRESSAO,
+    FASE_DESCOMPRESSAO,
+    FASE_ESCRITA,            // Escrita de dados no archive ou nos arquivos extraídos
+    FASE_COPIA,              // Cópia de dados dentro do archive (reescritas)
+    FASE_DIRETORIO,          // Leitura e gravação do diretório
+    NUM_FASES
+};
+
+// Liga a coleta para a operação 'operacao' (ex.: "-ip"). O relatório vai para
+// stderr, em texto ou em JSON; em JSON, os membros são escritos à medida que
+// são registrados.
+void metricas_inicia(const char *operacao, int json);
+
+// Lê o relógio
+// RETORNO: instante atual em nanossegundos (0 se a coleta está desligada)
+uint64_t metricas_relogio(void);
+
+// Soma à fase o tempo decorrido desde 'inicio' (vindo de metricas_relogio).
+// Pode ser chamada de várias threads: o tempo de uma fase é a soma do de
+// todas elas.
+void metricas_fase(enum Fase fase, uint64_t inicio);
+
+// Soma bytes lidos ('entrada') e gravados ('saida') pela operação (pode ser
+// chamada de várias threads)
+void metricas_bytes(uint64_t entrada, uint64_t saida);
+
+// Registra um membro processado e o tempo gasto nele desde 'inicio'
+void metricas_membro(const char *nome, uint64_t tam_orig, uint64_t tam_disco, uint64_t inicio);
+
+// Escreve os totais da operação (e fecha o JSON)
+void metricas_finaliza(int resultado);
+
+#endif
@@ -0,0 +1,718 @@
+#define _GNU_SOURCE
+#include "servidor.h"
+#include "archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Conexões aceitas esperando uma trabalhadora
+#define TAM_FILA_CONEXOES 256
+
+// Baldes da tabela de dispersão do cache
+#define NUM_BALDES (1 << 16)
+
+// Handle de uma geração do archive. Os membros são decodificados fora da
+// trava do archive, com uma referência ao handle; um handle substituído só é
+// fechado quando a última decodificação que o usa termina.
+struct Handle {
+    struct Vinac *v;
+    int refs;                // A do archive aberto e a de cada decodificação
+};
+
+// Archive aberto pelo servidor. Se o arquivo muda no disco (outro processo
+// o alterou), o handle é reaberto e a geração avança: itens do cache de
+// gerações antigas não são mais encontrados e saem pelo LRU.
+struct Aberto {
+    char caminho[PATH_MAX];  // Caminho canônico (realpath)
+    struct Handle *h;        // NULL se a última abertura falhou
+    pthread_mutex_t trava;   // Protege 'h' e as referências a ele
+    dev_t dev;               // Identidade do arquivo quando foi aberto
+    ino_t ino;
+    off_t tam;
+    struct timespec mtime;
+    uint64_t geracao;
+    struct Aberto *proximo;
+};
+
+// Membro descomprimido no cache, guardado em um memfd selado (somente
+// leitura), que pode ser entregue ao cliente por SCM_RIGHTS. Enquanto houver
+// referências (a do cache e as das trabalhadoras que o estão enviando), o
+// item não é liberado, mesmo se já saiu do cache.
+struct ItemCache {
+    const struct Aberto *aberto;
+    uint64_t geracao;
+    char *nome;
+    uint32_t dispersao;
+    int fd;
+    const unsigned char *dados; // Mapa do memfd (NULL se vazio)
+    uint64_t tam;
+    int refs;
+    struct ItemCache *anterior;  // LRU: vizinho mais recente
+    struct ItemCache *posterior; // LRU: vizinho menos recente
+    struct ItemCache *prox_balde;
+};
+
+static struct {
+    int socket;
+    uint64_t tam_cache;
+    volatile sig_atomic_t parar;
+
+    // Archives abertos
+    pthread_mutex_t trava_abertos;
+    struct Aberto *abertos;
+
+    // Cache LRU
+    pthread_mutex_t trava_cache;
+    struct ItemCache **baldes;
+    struct ItemCache *mais_recente;
+    struct ItemCache *menos_recente;
+    uint64_t ocupado;
+
+    // Conexões aceitas (fila circular) e conexões em atendimento
+    pthread_mutex_t trava_conexoes;
+    pthread_cond_t tem_conexao;
+    int fila[TAM_FILA_CONEXOES];
+    int inicio_fila;
+    int tam_fila;
+    int *atendendo;          // Uma posição por trabalhadora (-1 = livre)
+} srv;
+
+// Dispersão de archive + nome (FNV-1a de 32 bits)
+static uint32_t dispersao_item(const struct Aberto *aberto, const char *nome) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(aberto); i++) {
+        h ^= (uint32_t)((uintptr_t)aberto >> (8 * i)) & 0xff;
+        h *= 16777619u;
+    }
+    for (const unsigned char *p = (const unsigned char *)nome; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Solta uma referência ao item, liberando-o na última
+static void item_solta(struct ItemCache *item) {
+    pthread_mutex_lock(&srv.trava_cache);
+    int ultima = --item->refs == 0;
+    pthread_mutex_unlock(&srv.trava_cache);
+    if (!ultima)
+        return;
+
+    if (item->dados)
+        munmap((void *)item->dados, item->tam);
+    close(item->fd);
+    free(item->nome);
+    free(item);
+}
+
+// Tira o item da tabela e do LRU (com trava_cache). A referência do cache
+// passa para quem chamou.
+static void cache_retira(struct ItemCache *item) {
+    struct ItemCache **p = &srv.baldes[item->dispersao & (NUM_BALDES - 1)];
+    while (*p != item)
+        p = &(*p)->prox_balde;
+    *p = item->prox_balde;
+
+    if (item->anterior)
+        item->anterior->posterior = item->posterior;
+    else
+        srv.mais_recente = item->posterior;
+    if (item->posterior)
+        item->posterior->anterior = item->anterior;
+    else
+        srv.menos_recente = item->anterior;
+
+    srv.ocupado -= item->tam;
+}
+
+// Põe o item no início do LRU (com trava_cache)
+static void cache_no_inicio(struct ItemCache *item) {
+    item->anterior = NULL;
+    item->posterior = srv.mais_recente;
+    if (srv.mais_recente)
+        srv.mais_recente->anterior = item;
+    srv.mais_recente = item;
+    if (!srv.menos_recente)
+        srv.menos_recente = item;
+}
+
+// Procura um membro no cache e, se achar, o marca como o mais recente
+// RETORNO: item com uma referência a mais ou NULL se não está no cache
+static struct ItemCache *cache_busca(const struct Aberto *aberto, uint64_t geracao,
+                                     const char *nome, uint32_t dispersao) {
+    pthread_mutex_lock(&srv.trava_cache);
+    struct ItemCache *item = srv.baldes[dispersao & (NUM_BALDES - 1)];
+    while (item && !(item->dispersao == dispersao && item->aberto == aberto &&
+                     item->geracao == geracao && strcmp(item->nome, nome) == 0))
+        item = item->prox_balde;
+
+    if (item) {
+        item->refs++;
+        if (item != srv.mais_recente) {
+            if (item->anterior)
+                item->anterior->posterior = item->posterior;
+            if (item->posterior)
+                item->posterior->anterior = item->anterior;
+            else
+                srv.menos_recente = item->anterior;
+            cache_no_inicio(item);
+        }
+    }
+    pthread_mutex_unlock(&srv.trava_cache);
+    return item;
+}
+
+// Guarda um item no cache, tirando os menos recentes até ele caber. Se outra
+// trabalhadora guardou o mesmo membro antes, o item dela é o que vale. A
+// referência de quem chamou passa para o item devolvido.
+// RETORNO: item guardado, com uma referência para quem chamou
+static struct ItemCache *cache_guarda(struct ItemCache *item) {
+    struct ItemCache *soltar = NULL;
+
+    pthread_mutex_lock(&srv.trava_cache);
+    struct ItemCache *existente = srv.baldes[item->dispersao & (NUM_BALDES - 1)];
+    while (existente && !(existente->dispersao == item->dispersao &&
+                          existente->aberto == item->aberto &&
+                          existente->geracao == item->geracao &&
+                          strcmp(existente->nome, item->nome) == 0))
+        existente = existente->prox_balde;
+
+    if (existente) {
+        existente->refs++;
+        item->prox_balde = NULL;
+        soltar = item;
+        item = existente;
+    } else {
+        while (srv.menos_recente && srv.ocupado + item->tam > srv.tam_cache) {
+            struct ItemCache *velho = srv.menos_recente;
+            cache_retira(velho);
+            if (--velho->refs == 0) {
+                // Ninguém mais o usa: libera fora da trava
+                velho->refs = 1;
+                velho->prox_balde = soltar;
+                soltar = velho;
+            }
+        }
+
+        item->refs++;        // A referência do cache
+        struct ItemCache **balde = &srv.baldes[item->dispersao & (NUM_BALDES - 1)];
+        item->prox_balde = *balde;
+        *balde = item;
+        cache_no_inicio(item);
+        srv.ocupado += item->tam;
+    }
+    pthread_mutex_unlock(&srv.trava_cache);
+
+    while (soltar) {
+        struct ItemCache *proximo = soltar->prox_balde;
+        item_solta(soltar);
+        soltar = proximo;
+    }
+    return item;
+}
+
+// Solta uma referência ao handle (com a trava do archive), fechando-o na última
+static void handle_solta(struct Handle *h) {
+    if (--h->refs == 0) {
+        vinac_close(h->v);
+        free(h);
+    }
+}
+
+// Cria um item com o membro 'm' do handle, decodificado direto em um memfd
+// selado (sem cópia intermediária na memória)
+// RETORNO: item com uma referência ou NULL em caso de erro
+static struct ItemCache *item_cria(const struct Aberto *aberto, uint64_t geracao, uint32_t dispersao,
+                                   struct Vinac *v, const struct Membro *m) {
+    struct ItemCache *item = calloc(1, sizeof(struct ItemCache));
+    if (!item)
+        return NULL;
+
+    uint64_t tam = m->tam_orig;
+    item->aberto = aberto;
+    item->geracao = geracao;
+    item->nome = strdup(m->nome);
+    item->dispersao = dispersao;
+    item->tam = tam;
+    item->refs = 1;
+    item->fd = memfd_create("vinac", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    int erro = !item->nome || item->fd < 0 || ftruncate(item->fd, tam) != 0;
+    if (!erro && tam > 0) {
+        void *mapa = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_SHARED, item->fd, 0);
+        if (mapa == MAP_FAILED) {
+            erro = 1;
+        } else {
+            erro = vinac_read_into(v, m, mapa);
+            munmap(mapa, tam);
+        }
+    }
+
+    // Selado, o conteúdo não pode mais mudar, nem pelo cliente que recebe o fd
+    if (!erro)
+        erro = fcntl(item->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0;
+    if (!erro && tam > 0) {
+        void *mapa = mmap(NULL, tam, PROT_READ, MAP_SHARED, item->fd, 0);
+        if (mapa == MAP_FAILED)
+            erro = 1;
+        else
+            item->dados = mapa;
+    }
+
+    if (erro) {
+        fprintf(stderr, "Erro ao guardar o membro %s no cache\n", m->nome);
+        if (item->fd >= 0)
+            close(item->fd);
+        free(item->nome);
+        free(item);
+        return NULL;
+    }
+    return item;
+}
+
+// Obtém o archive aberto de 'caminho', abrindo-o (ou reabrindo, se mudou no
+// disco). Devolve com a trava do archive tomada e a geração atual em *geracao.
+// RETORNO: archive aberto ou NULL em caso de erro
+static struct Aberto *obtem_aberto(const char *caminho, uint64_t *geracao) {
+    char canonico[PATH_MAX];
+    struct stat st;
+    if (!realpath(caminho, canonico) || stat(canonico, &st) != 0) {
+        fprintf(stderr, "Erro ao abrir archive: %s\n", caminho);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&srv.trava_abertos);
+    struct Aberto *aberto = srv.abertos;
+    while (aberto && strcmp(aberto->caminho, canonico) != 0)
+        aberto = aberto->proximo;
+    if (!aberto && (aberto = calloc(1, sizeof(struct Aberto)))) {
+        strcpy(aberto->caminho, canonico);
+        pthread_mutex_init(&aberto->trava, NULL);
+        aberto->proximo = srv.abertos;
+        srv.abertos = aberto;
+    }
+    pthread_mutex_unlock(&srv.trava_abertos);
+    if (!aberto)
+        return NULL;
+
+    pthread_mutex_lock(&aberto->trava);
+    int mudou = !aberto->h || aberto->dev != st.st_dev || aberto->ino != st.st_ino ||
+                aberto->tam != st.st_size || aberto->mtime.tv_sec != st.st_mtim.tv_sec ||
+                aberto->mtime.tv_nsec != st.st_mtim.tv_nsec;
+    if (mudou) {
+        if (aberto->h)
+            handle_solta(aberto->h);
+        aberto->h = calloc(1, sizeof(struct Handle));
+        if (aberto->h && !(aberto->h->v = vinac_open(canonico))) {
+            free(aberto->h);
+            aberto->h = NULL;
+        }
+        if (aberto->h)
+            aberto->h->refs = 1;
+        aberto->dev = st.st_dev;
+        aberto->ino = st.st_ino;
+        aberto->tam = st.st_size;
+        aberto->mtime = st.st_mtim;
+        aberto->geracao++;
+    }
+    if (!aberto->h) {
+        pthread_mutex_unlock(&aberto->trava);
+        return NULL;
+    }
+
+    *geracao = aberto->geracao;
+    return aberto;
+}
+
+// Obtém os dados de um membro, do cache ou do archive
+// RETORNO: item com uma referência ou NULL em caso de erro
+static struct ItemCache *obtem_membro(const char *caminho, const char *nome) {
+    uint64_t geracao;
+    struct Aberto *aberto = obtem_aberto(caminho, &geracao);
+    if (!aberto)
+        return NULL;
+
+    // Procura no cache e no diretório com a trava do archive ainda tomada,
+    // para que a geração não mude no meio
+    uint32_t dispersao = dispersao_item(aberto, nome);
+    struct ItemCache *item = cache_busca(aberto, geracao, nome, dispersao);
+    if (item) {
+        pthread_mutex_unlock(&aberto->trava);
+        return item;
+    }
+
+    struct Membro m;
+    struct Handle *h = aberto->h;
+    if (vinac_stat(h->v, nome, &m) != 0) {
+        pthread_mutex_unlock(&aberto->trava);
+        fprintf(stderr, "Membro não encontrado: %s\n", nome);
+        return NULL;
+    }
+
+    // A decodificação não precisa da trava: faltas em membros diferentes do
+    // mesmo archive são atendidas em paralelo
+    h->refs++;
+    pthread_mutex_unlock(&aberto->trava);
+    item = item_cria(aberto, geracao, dispersao, h->v, &m);
+    pthread_mutex_lock(&aberto->trava);
+    handle_solta(h);
+    pthread_mutex_unlock(&aberto->trava);
+    if (!item)
+        return NULL;
+
+    // Membros maiores que o cache são servidos sem entrar nele
+    if (m.tam_orig > srv.tam_cache)
+        return item;
+    return cache_guarda(item);
+}
+
+// Recebe exatamente 'tam' bytes
+// RETORNO: 0 em caso de sucesso, 1 se a conexão terminou ou houve erro
+static int recebe_tudo(int fd, void *dados, size_t tam) {
+    unsigned char *p = dados;
+    while (tam > 0) {
+        ssize_t n = recv(fd, p, tam, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        tam -= n;
+    }
+    return 0;
+}
+
+// Envia os vetores inteiros, continuando de onde um envio parcial parou
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int envia_tudo(int fd, struct iovec *iov, int num_iov) {
+    while (num_iov > 0) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = num_iov };
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        while (num_iov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            num_iov--;
+        }
+        if (num_iov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Envia a resposta com um descritor anexado (SCM_RIGHTS)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int envia_descritor(int fd, struct Resposta *resp, int fd_dados) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr alinhamento;
+    } controle;
+    struct iovec iov = { resp, sizeof(*resp) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = controle.buffer, .msg_controllen = sizeof(controle.buffer) };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd_dados, sizeof(int));
+
+    ssize_t n;
+    while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    return n != sizeof(*resp);
+}
+
+// Atende os pedidos de uma conexão até o cliente fechá-la
+static void atende_conexao(int fd) {
+    char archive[PATH_MAX];
+    char nome[1024];
+    struct Pedido pedido;
+
+    while (!srv.parar && recebe_tudo(fd, &pedido, sizeof(pedido)) == 0) {
+        if (pedido.tam_archive == 0 || pedido.tam_archive >= sizeof(archive) ||
+            pedido.tam_nome == 0 || pedido.tam_nome >= sizeof(nome) ||
+            (pedido.tipo != PEDIDO_LER && pedido.tipo != PEDIDO_LER_FD) ||
+            recebe_tudo(fd, archive, pedido.tam_archive) != 0 ||
+            recebe_tudo(fd, nome, pedido.tam_nome) != 0)
+            break;
+        archive[pedido.tam_archive] = '\0';
+        nome[pedido.tam_nome] = '\0';
+
+        struct ItemCache *item = obtem_membro(archive, nome);
+        struct Resposta resp = { item == NULL, 0, item ? item->tam : 0 };
+
+        int erro;
+        if (item && pedido.tipo == PEDIDO_LER_FD) {
+            erro = envia_descritor(fd, &resp, item->fd);
+        } else {
+            struct iovec iov[2] = { { &resp, sizeof(resp) },
+                                    { item ? (void *)item->dados : NULL, resp.tam } };
+            erro = envia_tudo(fd, iov, resp.tam > 0 ? 2 : 1);
+        }
+
+        if (item)
+            item_solta(item);
+        if (erro)
+            break;
+    }
+}
+
+// Laço de uma trabalhadora: pega a próxima conexão aceita e a atende
+static void *trabalhadora(void *arg) {
+    int id = (int)(intptr_t)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&srv.trava_conexoes);
+        while (srv.tam_fila == 0 && !srv.parar)
+            pthread_cond_wait(&srv.tem_conexao, &srv.trava_conexoes);
+        if (srv.parar) {
+            pthread_mutex_unlock(&srv.trava_conexoes);
+            return NULL;
+        }
+        int fd = srv.fila[srv.inicio_fila];
+        srv.inicio_fila = (srv.inicio_fila + 1) % TAM_FILA_CONEXOES;
+        srv.tam_fila--;
+        srv.atendendo[id] = fd;
+        pthread_mutex_unlock(&srv.trava_conexoes);
+
+        atende_conexao(fd);
+
+        pthread_mutex_lock(&srv.trava_conexoes);
+        srv.atendendo[id] = -1;
+        pthread_mutex_unlock(&srv.trava_conexoes);
+        close(fd);
+    }
+}
+
+// Pede o encerramento do servidor (SIGINT/SIGTERM)
+static void ao_sinal(int sinal) {
+    (void)sinal;
+    srv.parar = 1;
+}
+
+int servidor_executa(const char *socket_caminho, uint64_t tam_cache, int num_threads) {
+    struct sockaddr_un endereco = { .sun_family = AF_UNIX };
+    if (strlen(socket_caminho) >= sizeof(endereco.sun_path)) {
+        fprintf(stderr, "Erro: caminho do socket longo demais: %s\n", socket_caminho);
+        return 1;
+    }
+    strcpy(endereco.sun_path, socket_caminho);
+
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+    srv.tam_cache = tam_cache;
+    srv.baldes = calloc(NUM_BALDES, sizeof(struct ItemCache *));
+    srv.atendendo = malloc(num_threads * sizeof(int));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (!srv.baldes || !srv.atendendo || !threads) {
+        fprintf(stderr, "Erro ao alocar memória\n");
+        free(srv.baldes);
+        free(srv.atendendo);
+        free(threads);
+        return 1;
+    }
+    for (int i = 0; i < num_threads; i++)
+        srv.atendendo[i] = -1;
+    pthread_mutex_init(&srv.trava_abertos, NULL);
+    pthread_mutex_init(&srv.trava_cache, NULL);
+    pthread_mutex_init(&srv.trava_conexoes, NULL);
+    pthread_cond_init(&srv.tem_conexao, NULL);
+
+    // Só o dono do servidor conecta no socket
+    srv.socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mascara = umask(0077);
+    int erro = srv.socket < 0 ||
+               bind(srv.socket, (struct sockaddr *)&endereco, sizeof(endereco)) != 0 ||
+               listen(srv.socket, SOMAXCONN) != 0;
+    umask(mascara);
+    if (erro) {
+        fprintf(stderr, "Erro ao escutar no socket %s: %s\n", socket_caminho, strerror(errno));
+        if (srv.socket >= 0)
+            close(srv.socket);
+        free(srv.baldes);
+        free(srv.atendendo);
+        free(threads);
+        return 1;
+    }
+
+    // Os sinais interrompem o accept (sem SA_RESTART): só esta thread os
+    // recebe, as trabalhadoras nascem com eles bloqueados. Um cliente que
+    // some no meio de uma resposta não derruba o servidor.
+    struct sigaction acao = { .sa_handler = ao_sinal };
+    sigemptyset(&acao.sa_mask);
+    sigaction(SIGINT, &acao, NULL);
+    sigaction(SIGTERM, &acao, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t sinais, anteriores;
+    sigemptyset(&sinais);
+    sigaddset(&sinais, SIGINT);
+    sigaddset(&sinais, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sinais, &anteriores);
+    int num_criadas = 0;
+    while (num_criadas < num_threads &&
+           pthread_create(&threads[num_criadas], NULL, trabalhadora, (void *)(intptr_t)num_criadas) == 0)
+        num_criadas++;
+    pthread_sigmask(SIG_SETMASK, &anteriores, NULL);
+    erro = num_criadas == 0;
+
+    while (!erro && !srv.parar) {
+        int fd = accept4(srv.socket, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "Erro ao aceitar conexão: %s\n", strerror(errno));
+                erro = 1;
+            }
+            continue;
+        }
+
+        // Com a fila cheia, a conexão é recusada
+        pthread_mutex_lock(&srv.trava_conexoes);
+        if (srv.tam_fila < TAM_FILA_CONEXOES) {
+            srv.fila[(srv.inicio_fila + srv.tam_fila) % TAM_FILA_CONEXOES] = fd;
+            srv.tam_fila++;
+            fd = -1;
+            pthread_cond_signal(&srv.tem_conexao);
+        }
+        pthread_mutex_unlock(&srv.trava_conexoes);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Acorda as trabalhadoras, inclusive as que esperam um cliente parado
+    pthread_mutex_lock(&srv.trava_conexoes);
+    srv.parar = 1;
+    for (int i = 0; i < num_criadas; i++)
+        if (srv.atendendo[i] >= 0)
+            shutdown(srv.atendendo[i], SHUT_RDWR);
+    pthread_cond_broadcast(&srv.tem_conexao);
+    pthread_mutex_unlock(&srv.trava_conexoes);
+    for (int i = 0; i < num_criadas; i++)
+        pthread_join(threads[i], NULL);
+
+    close(srv.socket);
+    unlink(socket_caminho);
+    for (int i = 0; i < srv.tam_fila; i++)
+        close(srv.fila[(srv.inicio_fila + i) % TAM_FILA_CONEXOES]);
+
+    // Limpeza
+    while (srv.mais_recente) {
+        struct ItemCache *item = srv.mais_recente;
+        cache_retira(item);
+        item_solta(item);
+    }
+    while (srv.abertos) {
+        struct Aberto *aberto = srv.abertos;
+        srv.abertos = aberto->proximo;
+        if (aberto->h)
+            handle_solta(aberto->h);
+        pthread_mutex_destroy(&aberto->trava);
+        free(aberto);
+    }
+    free(srv.baldes);
+    free(srv.atendendo);
+    free(threads);
+    return erro;
+}
+
+// Recebe a resposta e, se houver, o descritor anexado
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int recebe_resposta(int fd, struct Resposta *resp, int *fd_dados) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr alinhamento;
+    } controle;
+    struct iovec iov = { resp, sizeof(*resp) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = controle.buffer, .msg_controllen = sizeof(controle.buffer) };
+
+    *fd_dados = -1;
+    ssize_t n;
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return 1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fd_dados, CMSG_DATA(cmsg), sizeof(int));
+
+    // O resto do cabeçalho, se veio em partes (nunca junto com o descritor)
+    return (size_t)n < sizeof(*resp) && recebe_tudo(fd, (char *)resp + n, sizeof(*resp) - n) != 0;
+}
+
+int cliente_le(const char *socket_caminho, const char *archive, const char *membro, int por_descritor) {
+    // O servidor não está no diretório atual do cliente: manda o caminho absoluto
+    char absoluto[PATH_MAX];
+    if (realpath(archive, absoluto))
+        archive = absoluto;
+
+    struct sockaddr_un endereco = { .sun_family = AF_UNIX };
+    size_t tam_archive = strlen(archive);
+    size_t tam_nome = strlen(membro);
+    if (strlen(socket_caminho) >= sizeof(endereco.sun_path) || tam_archive == 0 ||
+        tam_archive >= PATH_MAX || tam_nome == 0 || tam_nome >= 1024) {
+        fprintf(stderr, "Erro: pedido inválido\n");
+        return 1;
+    }
+    strcpy(endereco.sun_path, socket_caminho);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&endereco, sizeof(endereco)) != 0) {
+        fprintf(stderr, "Erro ao conectar no servidor %s: %s\n", socket_caminho, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    struct Pedido pedido = { por_descritor ? PEDIDO_LER_FD : PEDIDO_LER, tam_archive, tam_nome };
+    struct iovec iov[3] = { { &pedido, sizeof(pedido) }, { (void *)archive, tam_archive },
+                            { (void *)membro, tam_nome } };
+    struct Resposta resp;
+    int fd_dados = -1;
+    int erro = envia_tudo(fd, iov, 3) != 0 || recebe_resposta(fd, &resp, &fd_dados) != 0;
+    if (!erro && resp.erro) {
+        fprintf(stderr, "Erro: o servidor não conseguiu ler %s de %s\n", membro, archive);
+        erro = 1;
+    }
+
+    // Copia os dados para a saída padrão, do socket ou do descritor recebido
+    int origem = por_descritor ? fd_dados : fd;
+    if (!erro && origem < 0)
+        erro = 1;
+    char buffer[64 * 1024];
+    for (uint64_t pos = 0; !erro && pos < resp.tam;) {
+        size_t n = resp.tam - pos < sizeof(buffer) ? resp.tam - pos : sizeof(buffer);
+        ssize_t lidos = por_descritor ? pread(origem, buffer, n, pos) : recv(origem, buffer, n, 0);
+        if (lidos <= 0 || fwrite(buffer, 1, lidos, stdout) != (size_t)lidos)
+            erro = 1;
+        else
+            pos += lidos;
+    }
+    if (fflush(stdout) != 0)
+        erro = 1;
+
+    if (fd_dados >= 0)
+        close(fd_dados);
+    close(fd);
+    return erro;
+}
@@ -0,0 +1,44 @@
+#ifndef SERVIDOR_H
+#define SERVIDOR_H
+
+#include <stdint.h>
+
+// Servidor de extração (-s): escuta em um socket Unix, mantém os archives
+// abertos (ver vinac_open) e serve o conteúdo de membros a partir de um cache
+// LRU de dados já descomprimidos, limitado em bytes. Cada conexão pode fazer
+// vários pedidos seguidos e é atendida por uma thread do conjunto de
+// trabalhadoras.
+//
+// Protocolo: o cliente envia um struct Pedido seguido do caminho do archive
+// e do nome do membro (sem '\0'); o servidor responde com um struct Resposta
+// seguido de 'tam' bytes (PEDIDO_LER) ou com um descritor somente leitura
+// (memfd selado) em uma mensagem SCM_RIGHTS (PEDIDO_LER_FD).
+#define PEDIDO_LER 1
+#define PEDIDO_LER_FD 2
+
+struct Pedido {
+    uint32_t tipo;           // PEDIDO_LER ou PEDIDO_LER_FD
+    uint16_t tam_archive;    // Bytes do caminho do archive
+    uint16_t tam_nome;       // Bytes do nome do membro
+};
+
+struct Resposta {
+    int32_t erro;            // 0 em caso de sucesso
+    uint32_t reservado;      // Preenchimento (sempre 0)
+    uint64_t tam;            // Tamanho do membro
+};
+
+// Tamanho padrão do cache (--cache)
+#define TAM_CACHE_PADRAO (256 * 1024 * 1024)
+
+// Atende pedidos em 'socket' até receber SIGINT ou SIGTERM, com 'tam_cache'
+// bytes de cache e 'num_threads' trabalhadoras (0 = uma por processador)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int servidor_executa(const char *socket, uint64_t tam_cache, int num_threads);
+
+// Pede um membro ao servidor e o escreve na saída padrão (-g, ou -gd para
+// recebê-lo por descritor)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int cliente_le(const char *socket, const char *archive, const char *membro, int por_descritor);
+
+#endif
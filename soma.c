@@ -0,0 +1,165 @@
+#include "soma.h"
+#include "io.h"
+#include "metricas.h"
+#include <string.h>
+
+#define PRIMO1 11400714785074694791ULL
+#define PRIMO2 14029467366897019727ULL
+#define PRIMO3 1609587929392839161ULL
+#define PRIMO4 9650029242287828579ULL
+#define PRIMO5 2870177450012600261ULL
+
+static uint64_t gira(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+// Lê 8 ou 4 bytes sem exigir alinhamento (na ordem da máquina, como o resto
+// do formato do archive)
+static uint64_t le64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Mistura 8 bytes em um acumulador
+static uint64_t rodada(uint64_t acum, uint64_t valor) {
+    acum += valor * PRIMO2;
+    return gira(acum, 31) * PRIMO1;
+}
+
+// Junta um acumulador de faixa à soma final
+static uint64_t junta(uint64_t soma, uint64_t acum) {
+    soma ^= rodada(0, acum);
+    return soma * PRIMO1 + PRIMO4;
+}
+
+// Consome uma faixa completa de 32 bytes
+static void consome_faixa(struct Soma *s, const unsigned char *p) {
+    s->acum[0] = rodada(s->acum[0], le64(p));
+    s->acum[1] = rodada(s->acum[1], le64(p + 8));
+    s->acum[2] = rodada(s->acum[2], le64(p + 16));
+    s->acum[3] = rodada(s->acum[3], le64(p + 24));
+}
+
+void soma_inicia(struct Soma *s) {
+    s->acum[0] = PRIMO1 + PRIMO2;
+    s->acum[1] = PRIMO2;
+    s->acum[2] = 0;
+    s->acum[3] = -PRIMO1;
+    s->total = 0;
+    s->tam_resto = 0;
+}
+
+void soma_acrescenta(struct Soma *s, const void *dados, size_t tam) {
+    const unsigned char *p = dados;
+    s->total += tam;
+
+    // Completa a faixa pendente
+    if (s->tam_resto > 0) {
+        size_t falta = sizeof(s->resto) - s->tam_resto;
+        if (tam < falta) {
+            memcpy(s->resto + s->tam_resto, p, tam);
+            s->tam_resto += tam;
+            return;
+        }
+        memcpy(s->resto + s->tam_resto, p, falta);
+        consome_faixa(s, s->resto);
+        p += falta;
+        tam -= falta;
+        s->tam_resto = 0;
+    }
+
+    for (; tam >= 32; p += 32, tam -= 32)
+        consome_faixa(s, p);
+
+    memcpy(s->resto, p, tam);
+    s->tam_resto = tam;
+}
+
+uint64_t soma_final(const struct Soma *s) {
+    uint64_t soma;
+    if (s->total >= 32) {
+        soma = gira(s->acum[0], 1) + gira(s->acum[1], 7) + gira(s->acum[2], 12) +
+               gira(s->acum[3], 18);
+        for (int i = 0; i < 4; i++)
+            soma = junta(soma, s->acum[i]);
+    } else {
+        soma = PRIMO5;
+    }
+    soma += s->total;
+
+    // Bytes que sobraram, de 8 em 8, depois de 4 e um a um
+    const unsigned char *p = s->resto;
+    size_t tam = s->tam_resto;
+    for (; tam >= 8; p += 8, tam -= 8) {
+        soma ^= rodada(0, le64(p));
+        soma = gira(soma, 27) * PRIMO1 + PRIMO4;
+    }
+    if (tam >= 4) {
+        soma ^= (uint64_t)le32(p) * PRIMO1;
+        soma = gira(soma, 23) * PRIMO2 + PRIMO3;
+        p += 4;
+        tam -= 4;
+    }
+    for (; tam > 0; p++, tam--) {
+        soma ^= *p * PRIMO5;
+        soma = gira(soma, 11) * PRIMO1;
+    }
+
+    // Avalanche
+    soma ^= soma >> 33;
+    soma *= PRIMO2;
+    soma ^= soma >> 29;
+    soma *= PRIMO3;
+    soma ^= soma >> 32;
+
+    // O valor reservado para "sem soma" nunca é devolvido
+    return soma == SOMA_DESCONHECIDA ? 1 : soma;
+}
+
+uint64_t soma_dados(const void *dados, size_t tam) {
+    struct Soma s;
+    soma_inicia(&s);
+    soma_acrescenta(&s, dados, tam);
+    return soma_final(&s);
+}
+
+void soma_zeros(struct Soma *s, uint64_t tam) {
+    static const unsigned char zeros[4096];
+    while (tam > 0) {
+        size_t n = tam < sizeof(zeros) ? tam : sizeof(zeros);
+        soma_acrescenta(s, zeros, n);
+        tam -= n;
+    }
+}
+
+int soma_arquivo(const char *caminho, uint64_t *soma) {
+    struct Entrada entrada;
+    if (entrada_abre(&entrada, caminho, TAM_BUFFER_COPIA) != 0)
+        return 1;
+
+    struct Soma s;
+    soma_inicia(&s);
+
+    uint64_t relogio = metricas_relogio();
+    const unsigned char *dados;
+    size_t lidos;
+    while ((lidos = entrada_le(&entrada, &dados)) > 0) {
+        if (entrada_buraco(&entrada, entrada.pos - lidos, lidos))
+            soma_zeros(&s, lidos);
+        else
+            soma_acrescenta(&s, dados, lidos);
+    }
+    metricas_fase(FASE_LEITURA, relogio);
+
+    int erro = entrada.erro;
+    entrada_fecha(&entrada);
+    *soma = soma_final(&s);
+    return erro;
+}
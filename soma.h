@@ -0,0 +1,43 @@
+#ifndef SOMA_H
+#define SOMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Soma de conteúdo de 64 bits (algoritmo do XXH64, semente 0), calculada em
+// uma passada e em pedaços de qualquer tamanho: o resultado não depende de
+// como os dados foram divididos. Serve para o -u reconhecer arquivos que não
+// mudaram; não é uma soma criptográfica.
+struct Soma {
+    uint64_t acum[4];        // Acumuladores das quatro faixas
+    uint64_t total;          // Bytes já somados
+    unsigned char resto[32]; // Bytes que ainda não completaram uma faixa
+    size_t tam_resto;
+};
+
+// Soma guardada quando o conteúdo não foi somado (archives antigos)
+#define SOMA_DESCONHECIDA 0
+
+// Começa uma soma vazia
+void soma_inicia(struct Soma *s);
+
+// Acrescenta 'tam' bytes de 'dados' à soma
+void soma_acrescenta(struct Soma *s, const void *dados, size_t tam);
+
+// RETORNO: soma dos bytes acrescentados (nunca SOMA_DESCONHECIDA)
+uint64_t soma_final(const struct Soma *s);
+
+// Acrescenta 'tam' bytes zero à soma (buracos e blocos de zeros, que não
+// estão em buffer nenhum)
+void soma_zeros(struct Soma *s, uint64_t tam);
+
+// Soma 'tam' bytes de 'dados' de uma vez
+// RETORNO: a soma
+uint64_t soma_dados(const void *dados, size_t tam);
+
+// Soma o conteúdo do arquivo 'caminho', lido em pedaços (os buracos não são
+// lidos)
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+int soma_arquivo(const char *caminho, uint64_t *soma);
+
+#endif
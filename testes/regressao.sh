@@ -0,0 +1,74 @@
+#!/bin/sh
+# Testes de regressão do vinac pela linha de comando (make teste).
+#
+# Cada caso monta um archive num diretório temporário próprio e confere o
+# resultado de uma operação; o primeiro caso que falha interrompe a bateria.
+#
+# Variáveis:
+#   VINAC       executável (padrão: login/vinac)
+#   DIR_TESTE   diretório temporário (padrão: $TMPDIR ou /tmp)
+
+set -e
+
+VINAC=${VINAC:-login/vinac}
+
+if [ ! -x "$VINAC" ]; then
+    echo "Erro: Executável não encontrado: $VINAC" >&2
+    exit 1
+fi
+VINAC=$(cd "$(dirname "$VINAC")" && pwd)/$(basename "$VINAC")
+
+DIR=$(mktemp -d "${DIR_TESTE:-${TMPDIR:-/tmp}}/vinac-teste.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT INT TERM
+
+# falha MENSAGEM: interrompe a bateria
+falha() {
+    echo "FALHOU: $caso: $1" >&2
+    exit 1
+}
+
+# novo_caso NOME: começa um caso num diretório vazio
+novo_caso() {
+    caso=$1
+    mkdir "$DIR/$caso"
+    cd "$DIR/$caso"
+}
+
+# Um membro cujo nome tem metacaracteres de glob é extraído pelo nome exato,
+# não pelo que o nome casaria como padrão
+novo_caso nome_com_colchetes
+echo colchetes > 'f[1].txt'
+echo simples > f1.txt
+echo estrela > 'g*'
+echo outro > gx
+"$VINAC" -ip a.vc 'f[1].txt' f1.txt 'g*' gx > /dev/null || falha "-ip"
+mkdir saida
+(cd saida && "$VINAC" -x ../a.vc 'f[1].txt' 'g*') || falha "-x"
+[ "$(ls saida | tr '\n' ' ')" = "f[1].txt g* " ] || falha "extraiu: $(ls saida | tr '\n' ' ')"
+cmp -s 'f[1].txt' 'saida/f[1].txt' && cmp -s 'g*' 'saida/g*' || falha "conteúdo diferente"
+"$VINAC" -t a.vc 'f[1].txt' | grep -q "^1 membros testados, 0 com erro" || falha "-t"
+rm -r saida
+mkdir saida
+(cd saida && "$VINAC" -x ../a.vc 'f?.txt') || falha "-x de glob"
+[ "$(ls saida)" = "f1.txt" ] || falha "glob extraiu: $(ls saida | tr '\n' ' ')"
+echo "ok: $caso"
+
+# Um lote entra no archive na ordem dos argumentos; um nome repetido fica na
+# posição da primeira ocorrência, com o conteúdo da última
+novo_caso ordem_do_lote
+echo c > c
+echo a > a
+echo b1 > b
+"$VINAC" -ip a.vc c a b > /dev/null || falha "-ip"
+echo e > e
+echo d > d
+echo b2 > b
+"$VINAC" -ip a.vc e d e b > /dev/null || falha "-ip de lote com repetição"
+ordem=$("$VINAC" -d a.vc | awk 'NR > 3 { printf "%s ", $3 }')
+[ "$ordem" = "c a b e d " ] || falha "ordem no -d: $ordem"
+mkdir saida
+(cd saida && "$VINAC" -x ../a.vc b) || falha "-x"
+[ "$(cat saida/b)" = "b2" ] || falha "b não tem o conteúdo da última ocorrência"
+echo "ok: $caso"
+
+echo "OK"
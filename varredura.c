@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include "varredura.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+// Tamanho do buffer de cada chamada a getdents64
+#define TAM_BUFFER_DIRENT (64 * 1024)
+
+// Arquivos encontrados e ainda não entregues; acima disso as threads esperam
+#define LIMITE_ENCONTRADOS (64 * 1024)
+
+// Arquivos acumulados por uma thread antes de publicá-los
+#define LOTE_PUBLICACAO 256
+
+// Vetor de caminhos que cresce conforme necessário
+struct Lista {
+    char **itens;
+    int quantidade;
+    int capacidade;
+};
+
+struct Varredura {
+    const struct Filtro *filtro;
+    pthread_t *threads;
+    int num_threads;
+    pthread_mutex_t trava;
+    pthread_cond_t tem_trabalho;   // Há diretórios pendentes (ou a varredura acabou)
+    pthread_cond_t tem_arquivos;   // Há arquivos para entregar (ou a varredura acabou)
+    pthread_cond_t tem_espaco;     // O consumidor liberou espaço em 'arquivos'
+    struct Lista pendentes;        // Diretórios ainda não lidos
+    struct Lista arquivos;         // Arquivos encontrados, ainda não entregues
+    int ativos;                    // Diretórios sendo lidos neste momento
+    int erro;                      // 1 se algum diretório não pôde ser lido
+    int encerrar;                  // 1 quando as threads devem parar
+};
+
+// Acrescenta um caminho à lista
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int lista_adiciona(struct Lista *lista, char *caminho) {
+    if (lista->quantidade == lista->capacidade) {
+        int nova_capacidade = lista->capacidade ? lista->capacidade * 2 : 64;
+        char **novos = realloc(lista->itens, nova_capacidade * sizeof(char *));
+        if (!novos)
+            return 1;
+        lista->itens = novos;
+        lista->capacidade = nova_capacidade;
+    }
+    lista->itens[lista->quantidade++] = caminho;
+    return 0;
+}
+
+// Passa todos os itens de 'orig' para o final de 'dest'
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int lista_transfere(struct Lista *dest, struct Lista *orig) {
+    for (int i = 0; i < orig->quantidade; i++) {
+        if (lista_adiciona(dest, orig->itens[i]) != 0) {
+            for (int j = i; j < orig->quantidade; j++)
+                free(orig->itens[j]);
+            orig->quantidade = 0;
+            return 1;
+        }
+    }
+    orig->quantidade = 0;
+    return 0;
+}
+
+static void lista_libera(struct Lista *lista) {
+    for (int i = 0; i < lista->quantidade; i++)
+        free(lista->itens[i]);
+    free(lista->itens);
+    lista->itens = NULL;
+    lista->quantidade = lista->capacidade = 0;
+}
+
+// Verifica se o padrão casa com o caminho inteiro ou com o último componente
+static int casa_caminho(const char *padrao, const char *caminho) {
+    const char *barra = strrchr(caminho, '/');
+    return fnmatch(padrao, caminho, 0) == 0 ||
+           (barra && fnmatch(padrao, barra + 1, 0) == 0);
+}
+
+int filtro_aceita(const struct Filtro *filtro, const char *caminho, int eh_diretorio) {
+    if (!filtro)
+        return 1;
+
+    for (int i = 0; i < filtro->num_excluir; i++)
+        if (casa_caminho(filtro->excluir[i], caminho))
+            return 0;
+
+    if (eh_diretorio || filtro->num_incluir == 0)
+        return 1;
+
+    for (int i = 0; i < filtro->num_incluir; i++)
+        if (casa_caminho(filtro->incluir[i], caminho))
+            return 1;
+
+    return 0;
+}
+
+// Monta "diretorio/nome"
+// RETORNO: caminho alocado ou NULL em caso de erro
+static char *junta_caminho(const char *diretorio, const char *nome) {
+    size_t tam_dir = strlen(diretorio);
+    size_t tam_nome = strlen(nome);
+    int barra = tam_dir > 0 && diretorio[tam_dir - 1] != '/';
+
+    char *caminho = malloc(tam_dir + barra + tam_nome + 1);
+    if (!caminho)
+        return NULL;
+
+    memcpy(caminho, diretorio, tam_dir);
+    if (barra)
+        caminho[tam_dir] = '/';
+    memcpy(caminho + tam_dir + barra, nome, tam_nome + 1);
+    return caminho;
+}
+
+// Entrega os arquivos acumulados pela thread ao consumidor, esperando se já
+// há arquivos demais aguardando
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int publica_arquivos(struct Varredura *var, struct Lista *arquivos) {
+    if (arquivos->quantidade == 0)
+        return 0;
+
+    pthread_mutex_lock(&var->trava);
+    while (var->arquivos.quantidade >= LIMITE_ENCONTRADOS && !var->encerrar)
+        pthread_cond_wait(&var->tem_espaco, &var->trava);
+
+    int erro = lista_transfere(&var->arquivos, arquivos);
+    pthread_cond_signal(&var->tem_arquivos);
+    pthread_mutex_unlock(&var->trava);
+
+    return erro;
+}
+
+// Classifica uma entrada do diretório. Usa o tipo devolvido por getdents64 e
+// só recorre a fstatat quando ele é desconhecido ou um link simbólico. Links
+// são seguidos apenas para arquivos (diretórios via link poderiam formar ciclos).
+// RETORNO: DT_DIR, DT_REG ou DT_UNKNOWN (entrada ignorada)
+static int tipo_entrada(int fd_dir, const char *nome, unsigned char d_type) {
+    struct stat st;
+
+    if (d_type == DT_DIR || d_type == DT_REG)
+        return d_type;
+
+    if (d_type == DT_UNKNOWN) {
+        if (fstatat(fd_dir, nome, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            return DT_UNKNOWN;
+        if (S_ISDIR(st.st_mode))
+            return DT_DIR;
+        if (S_ISREG(st.st_mode))
+            return DT_REG;
+        if (!S_ISLNK(st.st_mode))
+            return DT_UNKNOWN;
+    } else if (d_type != DT_LNK) {
+        return DT_UNKNOWN;
+    }
+
+    if (fstatat(fd_dir, nome, &st, 0) == 0 && S_ISREG(st.st_mode))
+        return DT_REG;
+    return DT_UNKNOWN;
+}
+
+// Lê um diretório, separando subdiretórios (que voltam para a fila) e arquivos
+// RETORNO: 0 em caso de sucesso, 1 em caso de erro
+static int le_diretorio_varredura(struct Varredura *var, const char *caminho, char *buffer,
+                                  struct Lista *subdirs, struct Lista *arquivos) {
+    int fd = openat(AT_FDCWD, caminho, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Erro ao abrir diretório: %s\n", caminho);
+        return 1;
+    }
+
+    int erro = 0;
+    ssize_t lidos;
+    while (!erro && (lidos = getdents64(fd, buffer, TAM_BUFFER_DIRENT)) > 0) {
+        for (ssize_t pos = 0; pos < lidos; ) {
+            struct dirent64 *ent = (struct dirent64 *)(buffer + pos);
+            pos += ent->d_reclen;
+
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+
+            int tipo = tipo_entrada(fd, ent->d_name, ent->d_type);
+            if (tipo == DT_UNKNOWN)
+                continue;
+
+            char *filho = junta_caminho(caminho, ent->d_name);
+            if (!filho) {
+                erro = 1;
+                break;
+            }
+
+            if (!filtro_aceita(var->filtro, filho, tipo == DT_DIR)) {
+                free(filho);
+                continue;
+            }
+
+            if (lista_adiciona(tipo == DT_DIR ? subdirs : arquivos, filho) != 0) {
+                free(filho);
+                erro = 1;
+                break;
+            }
+
+            if (arquivos->quantidade >= LOTE_PUBLICACAO && publica_arquivos(var, arquivos) != 0)
+                erro = 1;
+        }
+    }
+
+    if (lidos < 0) {
+        fprintf(stderr, "Erro ao ler diretório: %s\n", caminho);
+        erro = 1;
+    }
+
+    close(fd);
+    return erro;
+}
+
+// Laço de cada thread: pega um diretório pendente, lê, publica o que achou.
+// A varredura termina quando não há pendentes nem diretórios em leitura.
+static void *percorre(void *arg) {
+    struct Varredura *var = arg;
+    struct Lista subdirs = { 0 };
+    struct Lista arquivos = { 0 };
+    char *buffer = malloc(TAM_BUFFER_DIRENT);
+
+    pthread_mutex_lock(&var->trava);
+    if (!buffer)
+        var->erro = 1;
+
+    while (buffer) {
+        while (var->pendentes.quantidade == 0 && var->ativos > 0 && !var->encerrar)
+            pthread_cond_wait(&var->tem_trabalho, &var->trava);
+        if (var->encerrar || var->pendentes.quantidade == 0)
+            break;
+
+        char *caminho = var->pendentes.itens[--var->pendentes.quantidade];
+        var->ativos++;
+        pthread_mutex_unlock(&var->trava);
+
+        int erro = le_diretorio_varredura(var, caminho, buffer, &subdirs, &arquivos);
+        if (publica_arquivos(var, &arquivos) != 0)
+            erro = 1;
+        free(caminho);
+
+        pthread_mutex_lock(&var->trava);
+        if (lista_transfere(&var->pendentes, &subdirs) != 0)
+            erro = 1;
+        if (erro)
+            var->erro = 1;
+        var->ativos--;
+
+        if (var->pendentes.quantidade > 0)
+            pthread_cond_broadcast(&var->tem_trabalho);
+        else if (var->ativos == 0)
+            pthread_cond_broadcast(&var->tem_arquivos);
+    }
+
+    // Acorda as outras threads para que também percebam o fim
+    pthread_cond_broadcast(&var->tem_trabalho);
+    pthread_cond_broadcast(&var->tem_arquivos);
+    pthread_mutex_unlock(&var->trava);
+
+    lista_libera(&subdirs);
+    lista_libera(&arquivos);
+    free(buffer);
+    return NULL;
+}
+
+struct Varredura *varredura_inicia(const char *raiz, int num_threads, const struct Filtro *filtro) {
+    struct Varredura *var = calloc(1, sizeof(struct Varredura));
+    if (!var)
+        return NULL;
+
+    char *copia = strdup(raiz);
+    var->threads = malloc(num_threads * sizeof(pthread_t));
+    if (!copia || !var->threads || lista_adiciona(&var->pendentes, copia) != 0) {
+        free(copia);
+        free(var->threads);
+        free(var->pendentes.itens);
+        free(var);
+        return NULL;
+    }
+
+    var->filtro = filtro;
+    pthread_mutex_init(&var->trava, NULL);
+    pthread_cond_init(&var->tem_trabalho, NULL);
+    pthread_cond_init(&var->tem_arquivos, NULL);
+    pthread_cond_init(&var->tem_espaco, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&var->threads[i], NULL, percorre, var) != 0)
+            break;
+        var->num_threads++;
+    }
+
+    if (var->num_threads == 0) {
+        varredura_termina(var);
+        return NULL;
+    }
+
+    return var;
+}
+
+int varredura_lote(struct Varredura *var, char **caminhos, int max) {
+    pthread_mutex_lock(&var->trava);
+    while (var->arquivos.quantidade == 0 && !var->encerrar &&
+           (var->pendentes.quantidade > 0 || var->ativos > 0))
+        pthread_cond_wait(&var->tem_arquivos, &var->trava);
+
+    int n = var->arquivos.quantidade < max ? var->arquivos.quantidade : max;
+    var->arquivos.quantidade -= n;
+    memcpy(caminhos, var->arquivos.itens + var->arquivos.quantidade, n * sizeof(char *));
+
+    pthread_cond_broadcast(&var->tem_espaco);
+    pthread_mutex_unlock(&var->trava);
+    return n;
+}
+
+int varredura_termina(struct Varredura *var) {
+    pthread_mutex_lock(&var->trava);
+    var->encerrar = 1;
+    pthread_cond_broadcast(&var->tem_trabalho);
+    pthread_cond_broadcast(&var->tem_espaco);
+    pthread_mutex_unlock(&var->trava);
+
+    for (int i = 0; i < var->num_threads; i++)
+        pthread_join(var->threads[i], NULL);
+
+    int erro = var->erro;
+
+    pthread_mutex_destroy(&var->trava);
+    pthread_cond_destroy(&var->tem_trabalho);
+    pthread_cond_destroy(&var->tem_arquivos);
+    pthread_cond_destroy(&var->tem_espaco);
+    lista_libera(&var->pendentes);
+    lista_libera(&var->arquivos);
+    free(var->threads);
+    free(var);
+    return erro;
+}
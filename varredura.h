@@ -0,0 +1,36 @@
+#ifndef VARREDURA_H
+#define VARREDURA_H
+
+// Varredura recursiva de diretórios feita por várias threads em paralelo
+// (openat/getdents64/fstatat). Os arquivos encontrados são entregues em lotes
+// enquanto a varredura continua.
+struct Varredura;
+
+// Padrões de inclusão e exclusão (glob). Um padrão casa com o caminho inteiro
+// ou com o último componente. Exclusões também podam diretórios; inclusões,
+// se houver alguma, valem só para arquivos.
+struct Filtro {
+    const char **incluir;
+    int num_incluir;
+    const char **excluir;
+    int num_excluir;
+};
+
+// Inicia a varredura de 'raiz' com 'num_threads' threads
+// RETORNO: ponteiro para a varredura ou NULL em caso de erro
+struct Varredura *varredura_inicia(const char *raiz, int num_threads, const struct Filtro *filtro);
+
+// Espera até haver arquivos encontrados (ou o fim da varredura) e entrega
+// até 'max' caminhos em 'caminhos'. Cada caminho deve ser liberado com free.
+// RETORNO: quantidade entregue; 0 quando a varredura terminou
+int varredura_lote(struct Varredura *var, char **caminhos, int max);
+
+// Espera as threads terminarem e libera a varredura
+// RETORNO: 0 se todos os diretórios foram lidos, 1 se algum falhou
+int varredura_termina(struct Varredura *var);
+
+// Verifica se um caminho passa pelo filtro
+// RETORNO: 1 se o caminho deve ser usado, 0 caso contrário
+int filtro_aceita(const struct Filtro *filtro, const char *caminho, int eh_diretorio);
+
+#endif